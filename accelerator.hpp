@@ -0,0 +1,262 @@
+// header file for accelerating the price iteration.
+//
+// Whatever the sweep mode, one sweep is a fixed-point map p <- G(p) whose
+// fixed point is the price vector (for Jacobi, G(p) = l + Ap). When the
+// spectral radius of A is close to 1 the plain iteration crawls, so these
+// solvers extrapolate from the last few sweeps instead of only taking the
+// newest one:
+//
+//   - Anderson mixing (depth m) takes the combination of the last m sweeps
+//     whose residual G(p) - p is smallest in the least-squares sense.
+//   - Aitken's delta-squared process estimates the slowest-decaying mode
+//     from three consecutive sweeps and jumps to where it would converge.
+//
+// Both are safeguarded: if an extrapolated point has a larger residual than
+// the point before it, the history is dropped and a plain sweep is taken.
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include <vector>
+#include <functional>
+using namespace std;
+
+// writes G(in) into out (out is the same size as in, and is never in itself)
+typedef function<void(const vector<double>&, vector<double>&)> FixedPointMap;
+
+
+/*///////////////////////
+    UTILITY FUNCTIONS
+///////////////////////*/
+
+
+double dotProduct(const vector<double>& a, const vector<double>& b)
+{
+    double sum{0};
+    for (size_t i = 0; i < a.size(); i++) sum += a[i] * b[i];
+    return sum;
+}
+
+
+// Solves the small dense system M y = b in place (b becomes y) by Gaussian
+// elimination with partial pivoting. M is size x size, row-major.
+// Returns false if M is numerically singular.
+bool solveSmallSystem(vector<double> M, vector<double>& b, size_t size)
+{
+    for (size_t col = 0; col < size; col++)
+    {
+        size_t pivot = col;
+        for (size_t row = col + 1; row < size; row++)
+        {
+            if (abs(M[row*size + col]) > abs(M[pivot*size + col])) pivot = row;
+        }
+        if (abs(M[pivot*size + col]) < 1e-300) return false;
+
+        if (pivot != col)
+        {
+            for (size_t k = 0; k < size; k++) swap(M[col*size + k], M[pivot*size + k]);
+            swap(b[col], b[pivot]);
+        }
+
+        for (size_t row = col + 1; row < size; row++)
+        {
+            double factor = M[row*size + col] / M[col*size + col];
+            for (size_t k = col; k < size; k++) M[row*size + k] -= factor * M[col*size + k];
+            b[row] -= factor * b[col];
+        }
+    }
+
+    for (size_t col = size; col-- > 0; )
+    {
+        for (size_t k = col + 1; k < size; k++) b[col] -= M[col*size + k] * b[k];
+        b[col] /= M[col*size + col];
+    }
+    return true;
+}
+
+
+
+
+/*///////////////////////
+       ACCELERATORS
+///////////////////////*/
+
+
+// Anderson-accelerated fixed-point iteration. prices holds the starting point
+// and receives the result. Stops after -i sweeps, or once a sweep's change
+// meets the tolerances (see toleranceMet). Returns the number of sweeps taken.
+int andersonSolve(const FixedPointMap& sweep,
+                  vector<double>&      prices,
+                  size_t               depth,
+                  const RunOptions&    options)
+{
+    const size_t n = prices.size();
+    depth = max<size_t>(1, depth);
+
+    // ring buffers of differences between consecutive residuals (f) and sweeps (g),
+    // and their Gram matrix deltaF^T deltaF, updated one column at a time
+    vector<vector<double>> deltaF(depth, vector<double>(n));
+    vector<vector<double>> deltaG(depth, vector<double>(n));
+    vector<double> gram(depth * depth, 0.0);
+    size_t stored{0}, newest{0};
+
+    vector<double> swept(n), residual(n), prevSwept(n), prevResidual(n);
+    double prevResidualNorm = INFINITY;
+    bool   lastStepAccelerated{false};
+    int    sweepCount{0};
+
+    while (true)
+    {
+        sweep(prices, swept);
+        sweepCount++;
+
+        SweepChange change;
+        for (size_t i = 0; i < n; i++)
+        {
+            residual[i] = swept[i] - prices[i];
+            change.add(prices[i], swept[i]);
+        }
+        double residualNorm = change.maxAbsolute;
+
+        cout << "iteration " << sweepCount << " complete" << endl;
+        if (toleranceMet(change, options) || (options.iterations > 0 && sweepCount >= options.iterations))
+        {
+            prices.swap(swept);
+            return sweepCount;
+        }
+
+        // safeguard: an extrapolation that made things worse is thrown away
+        if (lastStepAccelerated && residualNorm > prevResidualNorm)
+        {
+            cout << "  accelerated step increased the residual; restarting from a plain sweep" << endl;
+            stored = 0;
+            lastStepAccelerated = false;
+            prevResidualNorm = residualNorm;
+            prevSwept.swap(swept);
+            prevResidual.swap(residual);
+            prices = prevSwept;
+            continue;
+        }
+
+        if (prevResidualNorm != INFINITY)
+        {
+            newest = (stored == 0) ? 0 : (newest + 1) % depth;
+            stored = min(stored + 1, depth);
+            for (size_t i = 0; i < n; i++)
+            {
+                deltaF[newest][i] = residual[i] - prevResidual[i];
+                deltaG[newest][i] = swept[i]    - prevSwept[i];
+            }
+            for (size_t j = 0; j < stored; j++)
+            {
+                size_t col = (newest + depth - j) % depth;
+                gram[newest*depth + col] = gram[col*depth + newest] = dotProduct(deltaF[newest], deltaF[col]);
+            }
+        }
+
+        prevResidualNorm = residualNorm;
+        prevSwept    = swept;
+        prevResidual = residual;
+
+        // least-squares weights gamma minimizing |residual - deltaF gamma|
+        vector<double> gamma(stored);
+        vector<double> normal(stored * stored);
+        bool solved = stored > 0;
+        double trace{0};
+        for (size_t a = 0; a < stored; a++)
+        {
+            size_t colA = (newest + depth - a) % depth;
+            gamma[a] = dotProduct(deltaF[colA], residual);
+            for (size_t b = 0; b < stored; b++)
+            {
+                size_t colB = (newest + depth - b) % depth;
+                normal[a*stored + b] = gram[colA*depth + colB];
+            }
+            trace += normal[a*stored + a];
+        }
+        for (size_t a = 0; a < stored; a++) normal[a*stored + a] += 1e-12 * trace;   // mild regularization
+        if (solved) solved = solveSmallSystem(normal, gamma, stored);
+
+        prices = swept;
+        lastStepAccelerated = solved;
+        if (!solved) continue;
+
+        for (size_t a = 0; a < stored; a++)
+        {
+            const vector<double>& column = deltaG[(newest + depth - a) % depth];
+            for (size_t i = 0; i < n; i++) prices[i] -= gamma[a] * column[i];
+        }
+    }
+}
+
+
+// Aitken delta-squared accelerated iteration. After two plain sweeps, the
+// ratio between consecutive steps estimates the dominant eigenvalue lambda
+// of the iteration, and the prices are extrapolated along the last step to
+// where that geometric series ends: p + lambda / (1 - lambda) * step.
+// A rejected extrapolation is undone, and the next one waits twice as long.
+// Same stopping rules and return value as andersonSolve.
+int aitkenSolve(const FixedPointMap& sweep,
+                vector<double>&      prices,
+                const RunOptions&    options)
+{
+    const size_t n = prices.size();
+    vector<double> current(prices), next(n), prevStep(n, 0.0), fallback;
+    double prevResidualNorm = INFINITY;
+    int    plainSweeps{0};
+    int    sweepsBetween{2};
+    int    sweepCount{0};
+    bool   lastStepAccelerated{false};
+
+    while (true)
+    {
+        sweep(current, next);
+        sweepCount++;
+
+        SweepChange change;
+        for (size_t i = 0; i < n; i++) change.add(current[i], next[i]);
+        double residualNorm = change.maxAbsolute;
+
+        cout << "iteration " << sweepCount << " complete" << endl;
+        if (toleranceMet(change, options) || (options.iterations > 0 && sweepCount >= options.iterations))
+        {
+            prices.swap(next);
+            return sweepCount;
+        }
+
+        // safeguard: go back to the point we extrapolated from
+        if (lastStepAccelerated && residualNorm > prevResidualNorm)
+        {
+            cout << "  accelerated step increased the residual; continuing with plain sweeps" << endl;
+            lastStepAccelerated = false;
+            current.swap(fallback);
+            plainSweeps   = 0;
+            sweepsBetween = min(2 * sweepsBetween, 64);
+            continue;
+        }
+        lastStepAccelerated = false;
+        prevResidualNorm    = residualNorm;
+
+        // step = next - current, and its ratio to the previous step
+        double stepDot{0}, prevStepDot{0};
+        for (size_t i = 0; i < n; i++)
+        {
+            double step  = next[i] - current[i];
+            stepDot     += step * prevStep[i];
+            prevStepDot += prevStep[i] * prevStep[i];
+            prevStep[i]  = step;
+        }
+        current.swap(next);
+
+        if (++plainSweeps < sweepsBetween || prevStepDot == 0) continue;
+        plainSweeps = 0;
+
+        double lambda = stepDot / prevStepDot;
+        if (lambda <= 0 || lambda >= 1) continue;
+
+        fallback = current;
+        double factor = lambda / (1 - lambda);
+        for (size_t i = 0; i < n; i++) current[i] += factor * prevStep[i];
+        lastStepAccelerated = true;
+    }
+}
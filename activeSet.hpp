@@ -0,0 +1,316 @@
+// header file for active-set iteration (--active-set).
+//
+// A precision solve sweeps every product until the slowest one in the
+// whole table settles, though most settle long before. In active-set mode a
+// sweep only recomputes the products whose inputs are still moving:
+//
+//   1. a full Jacobi sweep; if its change meets the tolerances, its result
+//      is the answer, exactly as in an ordinary solve;
+//   2. otherwise every product that moved by more than the activity
+//      threshold (half the tolerance, per product) puts its consumers, found
+//      through a consumer index, into the active set;
+//   3. the active products are recomputed from the current prices, Jacobi
+//      style, and those that moved put their consumers into the next active
+//      set; this repeats until the set is empty, and then it's back to 1.
+//
+// While most of the table is still moving, tracking the set would cost more
+// than it saves, so sweeps stay full until fewer than half the products
+// would be active.
+//
+// Products left out of a partial sweep can still drift by small amounts, so
+// only a full sweep ever ends the solve. If one doesn't meet the tolerances,
+// some product moved by more than the threshold in it, so the next active
+// set isn't empty and the solve carries on.
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include "runProfile.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+using namespace std;
+
+// a product is still moving if it moved by more than this fraction of the tolerance
+const double ACTIVE_MARGIN  = 0.5;
+
+// partial sweeps only take over from full ones once the active products are
+// fewer than this fraction of the table
+const double ACTIVE_DENSITY = 0.5;
+
+// out = l + A in, over every product; returns the change from in
+typedef function<SweepChange(const vector<double>&, vector<double>&)> FullSweep;
+
+// newPrices[i] = the price of rows[i] computed from prices
+typedef function<void(const vector<uint32_t>&, const vector<double>&, vector<double>&)> ActiveSweep;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// The per-product form of the tolerances: a product has settled when its
+// change is at most absolute and at most relative times its price
+class ActiveThreshold
+{
+    public:
+        double absolute{HUGE_VAL};
+        double relative{HUGE_VAL};
+
+        bool moved(double oldPrice, double newPrice) const
+        {
+            double change = abs(newPrice - oldPrice);
+            return change > absolute || change > relative * abs(newPrice);
+        }
+};
+
+
+// The products to recompute: those with at least one input that moved the
+// last time it was computed. Each product's count of moving inputs is kept
+// up to date as products start and stop moving, so a sweep costs the
+// consumers of the products that changed state, not of all that moved.
+class ActiveSet
+{
+    public:
+        vector<uint32_t> rows;          // the active products, ascending
+
+        ActiveSet(const ConsumerIndex& consumers, size_t products)
+            : consumers(consumers), movingInputs(products, 0), moving(products, 0), listed(products, 0) {}
+
+        // starts over from the products that moved in a full sweep
+        void reset(const vector<uint32_t>& moved)
+        {
+            for (uint32_t r : rows) listed[r] = 0;
+            fill(movingInputs.begin(), movingInputs.end(), 0);
+            fill(moving.begin(), moving.end(), 0);
+            rows.clear();
+            unlisted.clear();
+            for (uint32_t r : moved) setMoving(r, true);
+            addNewRows();
+            for (uint32_t r : moved) if (!listed[r]) unlisted.push_back(r);
+        }
+
+        // records whether each active product moved in the sweep just made,
+        // then drops the products none of whose inputs are moving any more
+        // and adds those that have started to
+        template <typename Moved>
+        void update(Moved moved)
+        {
+            for (size_t i = 0; i < rows.size(); i++)
+            {
+                bool m = moved(i);
+                if (m != (bool) moving[rows[i]]) setMoving(rows[i], m);
+            }
+
+            // products left out of this sweep have now been seen at their
+            // last price by all their consumers
+            for (uint32_t r : unlisted) if (!listed[r] && moving[r]) setMoving(r, false);
+            unlisted.clear();
+
+            size_t kept{0};
+            for (uint32_t r : rows)
+            {
+                if (movingInputs[r] > 0) rows[kept++] = r;
+                else
+                {
+                    // its consumers still have to see where it moved to
+                    listed[r] = 0;
+                    if (moving[r]) unlisted.push_back(r);
+                }
+            }
+            rows.resize(kept);
+            addNewRows();
+        }
+
+    private:
+        const ConsumerIndex& consumers;
+        vector<uint32_t>     movingInputs;
+        vector<char>         moving;    // whether the product moved when last computed
+        vector<char>         listed;    // whether it's in rows (or added)
+        vector<uint32_t>     added;
+        vector<uint32_t>     unlisted;  // moving, but not in rows
+
+        void setMoving(uint32_t r, bool m)
+        {
+            moving[r] = m;
+            for (uint64_t k = consumers.consumerStart[r]; k < consumers.consumerStart[r+1]; k++)
+            {
+                uint32_t consumer = consumers.consumers[k];
+                if (!m) movingInputs[consumer]--;
+                else if (movingInputs[consumer]++ == 0 && !listed[consumer])
+                {
+                    listed[consumer] = 1;
+                    added.push_back(consumer);
+                }
+            }
+        }
+
+        // merges the newly active products in, keeping rows in memory order
+        void addNewRows()
+        {
+            if (added.empty()) return;
+            sort(added.begin(), added.end());
+            size_t middle = rows.size();
+            rows.insert(rows.end(), added.begin(), added.end());
+            inplace_merge(rows.begin(), rows.begin() + middle, rows.end());
+            added.clear();
+        }
+};
+
+
+class ActiveSetResult
+{
+    public:
+        int    fullSweeps{0};
+        int    partialSweeps{0};
+        size_t recomputed{0};       // products computed, over every sweep
+};
+
+
+
+
+/*///////////////////////
+    UTILITY FUNCTIONS
+///////////////////////*/
+
+
+// Every tolerance given is split down to products: -p directly, --tol-rel
+// per price, and --tol-res as if every product's change were equal (if no
+// change is over resTol / sqrt(n), then neither is their L2 norm)
+ActiveThreshold activeThreshold(const RunOptions& options, size_t products)
+{
+    ActiveThreshold threshold;
+    if (options.precision)             threshold.absolute = ACTIVE_MARGIN * pow(10, -options.precision);
+    if (options.residualTolerance > 0)
+    {
+        threshold.absolute = min(threshold.absolute, ACTIVE_MARGIN * options.residualTolerance / sqrt((double) max<size_t>(products, 1)));
+    }
+    if (options.relativeTolerance > 0) threshold.relative = ACTIVE_MARGIN * options.relativeTolerance;
+    return threshold;
+}
+
+
+
+
+/*///////////////////////
+     SWEEP FUNCTIONS
+///////////////////////*/
+
+
+// Jacobi update of the listed rows [first, last) of rows, from prices
+void activeRowsSweep(const PriceEngine&      engine,
+                     const vector<uint32_t>& rows,
+                     size_t                  first,
+                     size_t                  last,
+                     const vector<double>&   prices,
+                     vector<double>&         newPrices)
+{
+    const uint64_t* rowStart   = engine.rowStart.data();
+    const uint32_t* inputIndex = engine.inputIndex.data();
+    const double*   coeffs     = engine.coeffs.data();
+
+    for (size_t i = first; i < last; i++)
+    {
+        uint32_t r     = rows[i];
+        double   price = engine.laborOnly[r];
+        for (uint64_t k = rowStart[r]; k < rowStart[r+1]; k++)
+        {
+            price += coeffs[k] * prices[inputIndex[k]];
+        }
+        newPrices[i] = price;
+    }
+}
+
+
+
+
+/*///////////////////////
+     SOLVER FUNCTIONS
+///////////////////////*/
+
+
+// Solves to the tolerances as laid out at the top of this file, starting
+// from and returning through prices. Given -i instead (as a server's solve
+// request can be), it makes that many full sweeps.
+ActiveSetResult activeSetSolve(const PriceEngine& engine,
+                               const FullSweep&   fullSweep,
+                               const ActiveSweep& activeSweep,
+                               vector<double>&    prices,
+                               const RunOptions&  options)
+{
+    const size_t n = engine.productCount();
+    ConsumerIndex consumers;
+    buildConsumerIndex(engine, consumers);
+    ActiveThreshold threshold = activeThreshold(options, n);
+    ActiveSet       active(consumers, n);
+
+    ActiveSetResult  result;
+    vector<double>   next(n);
+    vector<double>   newPrices;
+    vector<uint32_t> moved;
+    bool             full{true};
+
+    while (true)
+    {
+        if (full)
+        {
+            SweepChange change = fullSweep(prices, next);
+            result.fullSweeps++;
+            result.recomputed += n;
+            cout << "full sweep " << result.fullSweeps << " complete" << endl;
+
+            // with -i alone nothing counts as moving, so every sweep is a full one
+            bool done = options.stopsOnTolerance() ? profiledToleranceMet(change, options)
+                                                   : result.fullSweeps >= options.iterations;
+            if (done)
+            {
+                prices.swap(next);
+                break;
+            }
+
+            // the products that moved, unless their consumers add up to
+            // too many to track
+            uint64_t movedEdges{0};
+            moved.clear();
+            for (size_t r = 0; r < n && movedEdges <= ACTIVE_DENSITY * engine.nonzeroCount(); r++)
+            {
+                if (!threshold.moved(prices[r], next[r])) continue;
+                moved.push_back(r);
+                movedEdges += consumers.consumerStart[r+1] - consumers.consumerStart[r];
+            }
+            prices.swap(next);
+            if (movedEdges > ACTIVE_DENSITY * engine.nonzeroCount()) continue;
+            active.reset(moved);
+        }
+        else
+        {
+            const vector<uint32_t>& rows = active.rows;
+            newPrices.resize(rows.size());
+            activeSweep(rows, prices, newPrices);
+            result.partialSweeps++;
+            result.recomputed += rows.size();
+
+            active.update([&](size_t i)
+            {
+                bool m = threshold.moved(prices[rows[i]], newPrices[i]);
+                prices[rows[i]] = newPrices[i];
+                return m;
+            });
+        }
+
+        // a full sweep checks the tolerances once nothing is moving, and
+        // takes over while most of the table still is
+        full = active.rows.empty() || active.rows.size() > ACTIVE_DENSITY * n;
+    }
+    return result;
+}
+
+
+void printActiveSet(const ActiveSetResult& result, size_t products)
+{
+    int    sweeps = result.fullSweeps + result.partialSweeps;
+    double share  = sweeps && products ? 100.0 * result.recomputed / ((double) sweeps * products) : 0;
+    cout << result.fullSweeps << " full and " << result.partialSweeps << " partial sweeps recomputed "
+         << result.recomputed << " prices, " << setprecision(3) << share << "% of " << sweeps << " full sweeps" << endl;
+}
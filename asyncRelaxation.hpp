@@ -0,0 +1,195 @@
+// header file for asynchronous relaxation in plecpr-mt (--async).
+//
+// A parallel Jacobi sweep ends at a barrier: every thread waits for the
+// slowest one before the next sweep can start. In async mode there are no
+// sweeps to wait for. Each thread of the pool relaxes its own rows over and
+// over, in place, reading every other thread's prices as they stand at that
+// moment (chaotic relaxation). The prices are shared as atomics, loaded and
+// stored with relaxed ordering, which costs no more than plain loads and
+// stores on x86; a thread may read a price a few updates old, and that's
+// fine. The table's matrix is non-negative with a spectral radius below one
+// (that's what a productive table is), and for such a matrix this converges
+// to the same fixed point as Jacobi, whatever the order and delays of the
+// updates (Chazan and Miranker, 1969).
+//
+// Convergence is detected in two steps:
+//
+//   1. after each pass over its rows, a thread raises its flag if the pass
+//      met the tolerances over those rows, and lowers it otherwise; a thread
+//      that finds every flag raised tells all of them to stop;
+//   2. the stopped prices get one ordinary parallel Jacobi sweep. If its
+//      change meets the tolerances, its result is the answer, exactly as in
+//      a Jacobi solve; if not, the threads go back to relaxing.
+//
+// The flags only say that each thread's last pass was small, not that the
+// passes were small at the same moment, hence step 2. With -i alone, each
+// thread makes -i passes over its rows and there is no check.
+
+#pragma once
+#include "priceEngine.hpp"
+#include "runProfile.hpp"
+#include "sweepPool.hpp"
+#include <algorithm>
+#include <atomic>
+using namespace std;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// whether a thread's last pass met the tolerances, on its own cache line
+struct alignas(64) ConvergedFlag
+{
+    atomic<bool> value{false};
+};
+
+
+class AsyncResult
+{
+    public:
+        int    rounds{0};           // relaxation phases, each ended by a check sweep
+        size_t fewestPasses{0};     // passes over its rows by the least busy thread
+        size_t mostPasses{0};       // and by the busiest
+};
+
+
+
+
+/*///////////////////////
+     SWEEP FUNCTIONS
+///////////////////////*/
+
+
+// Relaxes rows [firstRow, lastRow) once, in place, from the prices as they
+// are right now. Returns the change over these rows.
+SweepChange asyncPass(const PriceEngine&      engine,
+                      vector<atomic<double>>& prices,
+                      size_t                  firstRow,
+                      size_t                  lastRow)
+{
+    const uint64_t* rowStart   = engine.rowStart.data();
+    const uint32_t* inputIndex = engine.inputIndex.data();
+    const double*   coeffs     = engine.coeffs.data();
+    const double*   laborOnly  = engine.laborOnly.data();
+    SweepChange     change;
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double price = laborOnly[r];
+        for (uint64_t k = rowStart[r]; k < rowStart[r+1]; k++)
+        {
+            price += coeffs[k] * prices[inputIndex[k]].load(memory_order_relaxed);
+        }
+        change.add(prices[r].load(memory_order_relaxed), price);
+        prices[r].store(price, memory_order_relaxed);
+    }
+    return change;
+}
+
+
+
+
+/*///////////////////////
+     SOLVER FUNCTIONS
+///////////////////////*/
+
+
+// Every pool thread relaxes its own rows until all of their last passes met
+// the tolerances (or, with -i alone, for -i passes). passes[t] counts
+// thread t's passes.
+void relaxAsynchronously(SweepPool&              pool,
+                         const PriceEngine&      engine,
+                         vector<atomic<double>>& prices,
+                         vector<size_t>&         passes,
+                         const RunOptions&       options)
+{
+    vector<ConvergedFlag> converged(pool.size());
+    atomic<bool>          stopping{false};
+
+    pool.run([&](size_t t, size_t firstRow, size_t lastRow)
+    {
+        size_t made{0};
+        while (!stopping.load(memory_order_relaxed))
+        {
+            SweepChange change = asyncPass(engine, prices, firstRow, lastRow);
+            made++;
+
+            if (!options.stopsOnTolerance())
+            {
+                if (made >= (size_t) options.iterations) break;
+                continue;
+            }
+
+            // a diverging pass stops every thread; the check sweep then reports it
+            if (!change.finite())
+            {
+                stopping.store(true, memory_order_relaxed);
+                break;
+            }
+
+            bool met = toleranceMet(change, options);
+            converged[t].value.store(met, memory_order_relaxed);
+            if (!met) continue;
+
+            bool all{true};
+            for (const ConvergedFlag& flag : converged) all = all && flag.value.load(memory_order_relaxed);
+            if (all) stopping.store(true, memory_order_relaxed);
+            else     this_thread::yield();      // let the threads still moving have the core
+        }
+        passes[t] += made;
+    });
+}
+
+
+// Solves as laid out at the top of this file, starting from and returning
+// through prices
+AsyncResult asyncSolve(SweepPool&         pool,
+                       const PriceEngine& engine,
+                       vector<double>&    prices,
+                       const RunOptions&  options)
+{
+    const size_t           n = engine.productCount();
+    vector<atomic<double>> shared(n);
+    vector<size_t>         passes(pool.size(), 0);
+    vector<double>         next(n);
+    vector<ThreadChange>   changes(pool.size());
+    AsyncResult            result;
+
+    while (true)
+    {
+        // the pool's barriers publish these to every thread, and back
+        for (size_t r = 0; r < n; r++) shared[r].store(prices[r], memory_order_relaxed);
+        relaxAsynchronously(pool, engine, shared, passes, options);
+        for (size_t r = 0; r < n; r++) prices[r] = shared[r].load(memory_order_relaxed);
+        result.rounds++;
+
+        if (!options.stopsOnTolerance()) break;
+
+        SweepChange change;
+        {
+            SweepTimer timer;
+            pool.run([&](size_t t, size_t firstRow, size_t lastRow)
+            {
+                changes[t].value = jacobiSweep(engine, prices, next, firstRow, lastRow);
+            });
+            change = mergeChanges(changes);
+        }
+        prices.swap(next);
+
+        cout << "round " << result.rounds << " complete" << endl;
+        if (profiledToleranceMet(change, options)) break;
+    }
+
+    result.fewestPasses = *min_element(passes.begin(), passes.end());
+    result.mostPasses   = *max_element(passes.begin(), passes.end());
+    return result;
+}
+
+
+void printAsyncResult(const AsyncResult& result)
+{
+    cout << "Threads made between " << result.fewestPasses << " and " << result.mostPasses
+         << " passes over their rows, in " << result.rounds << " rounds" << endl;
+}
@@ -0,0 +1,232 @@
+// header file for the compiled (binary) table format.
+//
+// A compiled table is the PriceEngine written straight to disk: the UPC
+// dictionary, the CSR row pointers and input indices, the normalized
+// coefficients, the labor vector, the output quantities and any other
+// primary resources, each 64-byte aligned after a small header. Opening one
+// is a single mmap; the engine's views point into the mapping, so there is
+// nothing to parse and no hash map to build.
+//
+// Layout (native byte order, checked through byteOrderMark):
+//
+//     CompiledTableHeader
+//     long int  upcs[productCount]
+//     uint64_t  rowStart[productCount+1]
+//     uint32_t  inputIndex[nonzeroCount]
+//     double    coeffs[nonzeroCount]
+//     double    laborOnly[productCount]
+//     double    output[productCount]
+//     long int  resourceCodes[resourceCount]
+//     double    resourceOnly[productCount * resourceCount]
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include "runProfile.hpp"
+#include <cstring>
+using namespace std;
+
+const char     COMPILED_TABLE_MAGIC[8]   = {'P','L','E','C','P','R','T','B'};
+const uint32_t COMPILED_TABLE_VERSION    = 3;     // 2 added the output quantities, 3 the resources
+const uint32_t COMPILED_TABLE_BYTE_ORDER = 0x01020304;
+const uint64_t COMPILED_TABLE_ALIGNMENT  = 64;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+class CompiledTableHeader
+{
+    public:
+        char     magic[8];
+        uint32_t version;
+        uint32_t byteOrderMark;
+        uint64_t productCount;
+        uint64_t nonzeroCount;
+        uint64_t resourceCount;
+
+        // byte offsets from the start of the file
+        uint64_t upcsOffset;
+        uint64_t rowStartOffset;
+        uint64_t inputIndexOffset;
+        uint64_t coeffsOffset;
+        uint64_t laborOffset;
+        uint64_t outputOffset;
+        uint64_t resourceCodesOffset;
+        uint64_t resourcesOffset;
+        uint64_t fileSize;
+};
+
+
+
+
+/*///////////////////////
+    UTILITY FUNCTIONS
+///////////////////////*/
+
+
+uint64_t alignCompiledOffset(uint64_t offset)
+{
+    return (offset + COMPILED_TABLE_ALIGNMENT - 1) / COMPILED_TABLE_ALIGNMENT * COMPILED_TABLE_ALIGNMENT;
+}
+
+
+// fills in the header's offsets for an engine of the given size
+void layOutCompiledTable(CompiledTableHeader& header,
+                         uint64_t productCount,
+                         uint64_t nonzeroCount,
+                         uint64_t resourceCount)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPILED_TABLE_MAGIC, sizeof(header.magic));
+    header.version       = COMPILED_TABLE_VERSION;
+    header.byteOrderMark = COMPILED_TABLE_BYTE_ORDER;
+    header.productCount  = productCount;
+    header.nonzeroCount  = nonzeroCount;
+    header.resourceCount = resourceCount;
+
+    header.upcsOffset       = alignCompiledOffset(sizeof(header));
+    header.rowStartOffset   = alignCompiledOffset(header.upcsOffset       + productCount       * sizeof(long int));
+    header.inputIndexOffset = alignCompiledOffset(header.rowStartOffset   + (productCount + 1) * sizeof(uint64_t));
+    header.coeffsOffset     = alignCompiledOffset(header.inputIndexOffset + nonzeroCount       * sizeof(uint32_t));
+    header.laborOffset      = alignCompiledOffset(header.coeffsOffset     + nonzeroCount       * sizeof(double));
+    header.outputOffset     = alignCompiledOffset(header.laborOffset      + productCount       * sizeof(double));
+    header.resourceCodesOffset = alignCompiledOffset(header.outputOffset        + productCount       * sizeof(double));
+    header.resourcesOffset     = alignCompiledOffset(header.resourceCodesOffset + resourceCount      * sizeof(long int));
+    header.fileSize            = header.resourcesOffset + productCount * resourceCount * sizeof(double);
+}
+
+
+// true if the file starts with the compiled table magic number
+bool isCompiledTable(const char* fileLoc)
+{
+    ifstream fin(fileLoc, ios::in | ios::binary);
+    char magic[sizeof(COMPILED_TABLE_MAGIC)]{};
+
+    if (!fin.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, COMPILED_TABLE_MAGIC, sizeof(magic)) == 0;
+}
+
+
+// writes the engine out as a compiled table
+void saveCompiledTable(const PriceEngine& engine, const char* compiledFile)
+{
+    ofstream fout(compiledFile, ios::out | ios::binary | ios::trunc);
+    if (!fout.good()) throw bad_file();
+
+    cout << "\nWriting compiled table..." << endl;
+
+    CompiledTableHeader header;
+    layOutCompiledTable(header, engine.productCount(), engine.nonzeroCount(), engine.resourceCount());
+
+    // writes one array at its offset, padding with zeros up to it
+    auto writeSection = [&fout](uint64_t offset, const void* data, size_t bytes)
+    {
+        static const char padding[COMPILED_TABLE_ALIGNMENT]{};
+        fout.write(padding, offset - (uint64_t) fout.tellp());
+        fout.write((const char*) data, bytes);
+    };
+
+    fout.write((const char*) &header, sizeof(header));
+    writeSection(header.upcsOffset,       engine.upcs.data(),       engine.upcs.size()       * sizeof(long int));
+    writeSection(header.rowStartOffset,   engine.rowStart.data(),   engine.rowStart.size()   * sizeof(uint64_t));
+    writeSection(header.inputIndexOffset, engine.inputIndex.data(), engine.inputIndex.size() * sizeof(uint32_t));
+    writeSection(header.coeffsOffset,     engine.coeffs.data(),     engine.coeffs.size()     * sizeof(double));
+    writeSection(header.laborOffset,      engine.laborOnly.data(),  engine.laborOnly.size()  * sizeof(double));
+    writeSection(header.outputOffset,     engine.output.data(),     engine.output.size()     * sizeof(double));
+    writeSection(header.resourceCodesOffset, engine.resourceCodes.data(), engine.resourceCodes.size() * sizeof(long int));
+    writeSection(header.resourcesOffset,     engine.resourceOnly.data(),  engine.resourceOnly.size()  * sizeof(double));
+
+    if (!fout.good()) throw bad_file();
+    fout.close();
+
+    cout << "Compiled table (" << engine.productCount() << " products, "
+         << engine.nonzeroCount() << " inputs) saved to: " << compiledFile << endl << endl;
+}
+
+
+// maps a compiled table and points the engine's views into it.
+// The mapping is copy-on-write, so the engine can still be edited in memory.
+void openCompiledTable(const char* fileLoc, PriceEngine& engine)
+{
+    auto mapping = make_unique<MappedFile>(fileLoc, true);
+
+    CompiledTableHeader header;
+    if (mapping->size < sizeof(header)) throw malformed_table("Compiled table is truncated.");
+    memcpy(&header, mapping->data, sizeof(header));
+
+    if (memcmp(header.magic, COMPILED_TABLE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        throw malformed_table("Not a compiled table.");
+    }
+    if (header.byteOrderMark != COMPILED_TABLE_BYTE_ORDER)
+    {
+        throw malformed_table("Compiled table was written on a machine with a different byte order.");
+    }
+    if (header.version != COMPILED_TABLE_VERSION)
+    {
+        throw malformed_table("Compiled table version " + to_string(header.version)
+                              + " is not supported (expected " + to_string(COMPILED_TABLE_VERSION) 
+                              + "); compile it again from the text table.");
+    }
+
+    // recompute the layout rather than trusting the offsets blindly
+    CompiledTableHeader expected;
+    layOutCompiledTable(expected, header.productCount, header.nonzeroCount, header.resourceCount);
+    if (memcmp(&expected, &header, sizeof(header)) != 0 || mapping->size < header.fileSize)
+    {
+        throw malformed_table("Compiled table is truncated or corrupt.");
+    }
+
+    char* base = mapping->data;
+
+    // the sweeps index by these without checking, so check them once here
+    const uint64_t* rowStart   = (const uint64_t*) (base + header.rowStartOffset);
+    const uint32_t* inputIndex = (const uint32_t*) (base + header.inputIndexOffset);
+    if (rowStart[0] != 0 || rowStart[header.productCount] != header.nonzeroCount)
+    {
+        throw malformed_table("Compiled table row starts don't cover its inputs.");
+    }
+    for (size_t i = 0; i < header.productCount; i++)
+    {
+        if (rowStart[i+1] < rowStart[i]) throw malformed_table("Compiled table row starts go backwards.");
+    }
+    for (size_t k = 0; k < header.nonzeroCount; k++)
+    {
+        if (inputIndex[k] >= header.productCount) throw malformed_table("Compiled table has an input past its last product.");
+    }
+
+    engine.adoptMapping(move(mapping));
+    engine.upcs       = {(long int*) (base + header.upcsOffset),       header.productCount};
+    engine.rowStart   = {(uint64_t*) (base + header.rowStartOffset),   header.productCount + 1};
+    engine.inputIndex = {(uint32_t*) (base + header.inputIndexOffset), header.nonzeroCount};
+    engine.coeffs     = {(double*)   (base + header.coeffsOffset),     header.nonzeroCount};
+    engine.laborOnly  = {(double*)   (base + header.laborOffset),      header.productCount};
+    engine.output     = {(double*)   (base + header.outputOffset),     header.productCount};
+    engine.resourceCodes = {(long int*) (base + header.resourceCodesOffset), header.resourceCount};
+    engine.resourceOnly  = {(double*)   (base + header.resourcesOffset),     header.productCount * header.resourceCount};
+}
+
+
+// Opens either kind of table file: compiled tables are mapped,
+// text tables are parsed and indexed.
+void loadPriceEngine(const char* fileLoc, PriceEngine& engine)
+{
+    if (isCompiledTable(fileLoc))
+    {
+        PhaseTimer timer("map");
+        cout << "\rMapping compiled table..." << endl;
+        openCompiledTable(fileLoc, engine);
+        return;
+    }
+
+    vector<TableEntry> tableEntries;
+    {
+        PhaseTimer timer("parse");
+        loadIOTable(fileLoc, tableEntries);
+    }
+    PhaseTimer timer("build");
+    buildPriceEngine(tableEntries, engine);
+}
@@ -1,158 +1,452 @@
 // This is the main driver for the project
 
 #include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include "compiledTable.hpp"
+#include "accelerator.hpp"
+#include "krylovSolver.hpp"
+#include "sccSolver.hpp"
+#include "whatIf.hpp"
+#include "sellKernel.hpp"
+#include "resourceSolver.hpp"
+#include "runProfile.hpp"
+#include "priceServer.hpp"
+#include "outOfCore.hpp"
+#include "mixedPrecision.hpp"
+#include "reorder.hpp"
+#include "activeSet.hpp"
+#include "multilevelSolver.hpp"
+#include "quantitySolver.hpp"
+#include "scenarioBatch.hpp"
 using namespace std;
 
 
-// This function checks whether two numbers are equal within the given precision
-// (number of decimal points)
-bool precisionReached(unordered_map<long int, double>& prevIterPrices,
-                      unordered_map<long int, double>& currIterPrices,
-                      const int precision)
-{
-    if (currIterPrices.empty()) return false;
-
-    double precisionUnit = pow(10, -precision); 
-    for (const auto &[productKey, price] : currIterPrices)
-    {
-        if (abs(price - prevIterPrices.at(productKey)) > precisionUnit) return false;
-    }
-
-    return true;
-}
-
-
 // These functions, calcPricesConstIter (1) and calcPricesPrec (2) calculate prices, 
-// and return a reference to the prices unordered_map.
+// starting from and returning through the dense prices vector (indexed like engine.upcs).
 // They follow Cockshott and Cottrell's algorithm as laid out in Chapter 3 of
 // Toward a New Socialism (1993), but have different stopping points.
+// Jacobi sweeps follow the book exactly; Gauss-Seidel/SOR sweeps update the
+// prices in place and report how far they moved, so no copy is kept at all.
 
 // (1) This implementation stops after a given number of iterations has bee reached
-void calcPricesConstIter(unordered_map<ProdInputPair,double>& ioTable,
-                         unordered_map<long, double>& prices,
-                         const int iterations)
+void calcPricesConstIter(const PriceEngine& engine,
+                         vector<double>& prices,
+                         const RunOptions& options)
 {
-    // initialize previous (in this case, initial) iteration prices list,
-    // using only direct labor
-    unordered_map<long int, double> laborOnlyPrices;
-    unordered_map<long int, double> prevIterPrices;
-    ProdInputPair PIpair{0,0};
-    long int currentProduct{0};
+    // prices comes in holding the starting point (see startingPrices):
+    // direct labor only, unless warm-started from an earlier solve
+    const int iterations = options.iterations;
+
+    // constant-iteration algorithm
+    cout << "\nNow running iterations." << endl;
 
-    for (auto iter = ioTable.begin(); iter != ioTable.end(); ++iter)
-    {   
-        if (iter->first.product != currentProduct)                    // to prevent redundant statements
+    if (options.sweepMode == SweepMode::JACOBI)
+    {
+        SellMatrix sell;
+        buildSellMatrix(engine, {0, engine.productCount()}, options.kernel, sell);
+        printSellMatrix(sell, engine);
+
+        vector<double> prevIterPrices(prices);
+        for (int i = 0; i < iterations; i++)
         {
-            currentProduct = iter->first.product;
-            PIpair.product = currentProduct;
-            PIpair.input = 0;
+            {
+                SweepTimer timer;
+                kernelSweep(engine, sell, prevIterPrices, prices, 0);
+            }
+            prevIterPrices.swap(prices);      // save this iteration's prices for the next one
 
-            laborOnlyPrices[currentProduct] = ioTable.at(PIpair);  // start with the labor value...
+            cout << "iteration " << i+1 << " of " << iterations << " complete" << endl;
+        }
+        prices.swap(prevIterPrices);          // the last sweep's result
+        return;
+    }
 
-            // ...and divide it by quantity produced of that product
-            PIpair.input = 1;
-            laborOnlyPrices[currentProduct] /= ioTable.at(PIpair);
+    vector<double> selfCoeffs = selfCoefficients(engine);
+    for (int i = 0; i < iterations; i++)
+    {
+        {
+            SweepTimer timer;
+            sorSweep(engine, selfCoeffs, prices, prices, 0, engine.productCount(), options.omega);
         }
+        cout << "iteration " << i+1 << " of " << iterations << " complete" << endl;
     }
+}
 
 
-    // constant-iteration algorithm
-    // if iterations==0, this loop and following conditional will be 
-    // skipped and will go to the precision-based iterations.
-    cout << "\nNow running iterations." << endl;
+// (2) This implementation stops after a certain precision has been reached
+// (or the relative and residual tolerances, when given). Each sweep measures
+// its own change as it goes, so there is no separate pass to check it.
+void calcPricesPrec(const PriceEngine& engine,
+                    vector<double>& prices,
+                    const RunOptions& options)
+{
+    // prices comes in holding the starting point (see startingPrices):
+    // direct labor only, unless warm-started from an earlier solve
 
-    prevIterPrices = laborOnlyPrices;
-    prices = laborOnlyPrices;
-    for (int i = 0; i < iterations; i++)
+    // precision-based algorithm
+    cout << "Now iterating until " << describeTolerances(options) << endl;
+    int iterCounter{1};
+    SweepChange change;
+
+    if (options.sweepMode == SweepMode::JACOBI)
+    {
+        SellMatrix sell;
+        buildSellMatrix(engine, {0, engine.productCount()}, options.kernel, sell);
+        printSellMatrix(sell, engine);
+
+        vector<double> prevIterPrices(prices.size());
+        do 
+        {
+            prevIterPrices.swap(prices);     // save last iteration's prices...
+            {
+                SweepTimer timer;
+                change = kernelSweep(engine, sell, prevIterPrices, prices, 0);
+            }
+
+            cout << "iteration " << iterCounter << " complete" << endl;
+            iterCounter++;
+        }
+        while(!profiledToleranceMet(change, options));
+        return;
+    }
+
+    vector<double> selfCoeffs = selfCoefficients(engine);
+    do
     {
-        for (auto iter = ioTable.begin(); iter != ioTable.end(); ++iter)
         {
-            PIpair = iter->first;               // key loaded into local variable for speed
+            SweepTimer timer;
+            change = sorSweep(engine, selfCoeffs, prices, prices, 0, engine.productCount(), options.omega);
+        }
+
+        cout << "iteration " << iterCounter << " complete" << endl;
+        iterCounter++;
+    }
+    while(!profiledToleranceMet(change, options));
+}
 
-            // no need to consider the output quantity column (irrelevant)
-            // or labor column (already accounted for)
-            if(PIpair.input == 1 || PIpair.input == 0) continue;     
-            
-            // add prevIterPrices cost of the input to the current product's total cost, 
-            // and divide by total units produced to get the per-unit cost of that input
-            double priceAddition = ioTable.at(PIpair) * prevIterPrices.at(PIpair.input);
-            PIpair.input = 1;
-            priceAddition       /= ioTable.at(PIpair);
 
-            prices.at(PIpair.product) += priceAddition;
+// Runs the solve through Anderson or Aitken acceleration, with one sweep
+// in the chosen mode as the fixed-point map. With -i the iteration count
+// is the number of sweeps; with -p the stopping test is the same as usual.
+void calcPricesAccelerated(const PriceEngine& engine,
+                           vector<double>& prices,
+                           const RunOptions& options)
+{
+    vector<double> selfCoeffs;
+    SellMatrix     sell;
+    if (options.sweepMode != SweepMode::JACOBI) selfCoeffs = selfCoefficients(engine);
+    else
+    {
+        buildSellMatrix(engine, {0, engine.productCount()}, options.kernel, sell);
+        printSellMatrix(sell, engine);
+    }
+
+    FixedPointMap sweep = [&](const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        if (options.sweepMode == SweepMode::JACOBI)
+        {
+            kernelSweep(engine, sell, in, out, 0);
+            return;
         }
+        out = in;
+        sorSweep(engine, selfCoeffs, out, out, 0, engine.productCount(), options.omega);
+    };
 
-        prevIterPrices = prices;          // save last iteration's prices...
-        prices = laborOnlyPrices;         // ...and start fresh for current iteration
+    cout << "\nNow running accelerated iterations." << endl;
 
-        cout << "iteration " << i+1 << " of " << iterations << " complete" << endl;
+    if (options.acceleration == Acceleration::ANDERSON)
+    {
+        andersonSolve(sweep, prices, options.andersonDepth, options);
+    }
+    else
+    {
+        aitkenSolve(sweep, prices, options);
     }
 }
 
 
-// (2) This implementation stops after a certain precision has been reached
-void calcPricesPrec(unordered_map<ProdInputPair,double>& ioTable,
-                    unordered_map<long, double>& prices,
-                    const int precision)
+// Solves (I - A) p = l directly with BiCGSTAB or GMRES instead of sweeping
+void calcPricesKrylov(const PriceEngine& engine,
+                      vector<double>& prices,
+                      const RunOptions& options)
 {
-    // initialize previous (in this case, initial) iteration prices list,
-    // using only direct labor
-    unordered_map<long int, double> laborOnlyPrices;
-    unordered_map<long int, double> prevIterPrices;
-    ProdInputPair PIpair{0,0};
-    long int currentProduct{0};
+    SystemMatrix M;
+    buildSystemMatrix(engine, M);
 
-    for (auto iter = ioTable.begin(); iter != ioTable.end(); ++iter)
-    {   
-        if (iter->first.product != currentProduct)                    // to prevent redundant statements
+    MatrixProduct multiply = [&](const vector<double>& x, vector<double>& y)
+    {
+        systemMultiply(M, x, y, 0, M.size());
+    };
+
+    solvePricesKrylov(engine, M, multiply, prices, options);
+}
+
+
+// Sweeps with coarse corrections from the aggregated table (-s multilevel,
+// see multilevelSolver.hpp); the smoothing sweeps are in the -m mode
+void calcPricesMultilevel(const PriceEngine& engine,
+                          vector<double>& prices,
+                          const RunOptions& options)
+{
+    vector<double> selfCoeffs;
+    if (options.sweepMode != SweepMode::JACOBI) selfCoeffs = selfCoefficients(engine);
+
+    LevelSweep residualSweep = [&](const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        return jacobiSweep(engine, in, out, 0, engine.productCount());
+    };
+    LevelSweep smoothingSweep = [&](const vector<double>& in, vector<double>& out)
+    {
+        if (options.sweepMode == SweepMode::JACOBI) return residualSweep(in, out);
+        SweepTimer timer;
+        out = in;
+        return sorSweep(engine, selfCoeffs, out, out, 0, engine.productCount(), options.omega);
+    };
+
+    cout << "\nNow running multilevel cycles." << endl;
+    printMultilevelResult(multilevelSolve(engine, residualSweep, smoothingSweep, prices, options));
+}
+
+
+// Prices the table one strongly connected component at a time, in
+// topological order, sweeping only inside the cycles
+void calcPricesComponents(const PriceEngine& engine,
+                          vector<double>& prices,
+                          const RunOptions& options)
+{
+    ComponentPlan plan;
+    buildComponentPlan(engine, plan);
+    printComponentPlan(plan);
+
+    vector<double> selfCoeffs = selfCoefficients(engine);
+    vector<double> scratch;
+
+    long int cycleSweeps{0};
+    for (size_t c = 0; c < plan.componentCount(); c++)
+    {
+        int sweeps = solveComponent(engine, plan, selfCoeffs, c, prices, options, scratch);
+        if (plan.componentSize(c) > 1) cycleSweeps += sweeps;
+    }
+
+    cout << "Cycles took " << cycleSweeps << " sweeps in total" << endl;
+}
+
+
+// Solves for labor and every other primary resource at once (--resources):
+// Jacobi sweeps over a block of 1 + resourceCount() values per product,
+// until the tolerances are met or -i sweeps are done. block receives the result.
+void calcPricesResources(const PriceEngine&    engine,
+                         const vector<double>& laborPrices,
+                         vector<double>&       block,
+                         const RunOptions&     options)
+{
+    vector<double> direct;
+    directResourceBlock(engine, direct);
+    startingResourceBlock(engine, laborPrices, block);
+    vector<double> prevBlock(block.size());
+
+    cout << "\nNow running iterations for labor and " << engine.resourceCount() << " other resources." << endl;
+    int sweeps{0};
+    while (true)
+    {
+        prevBlock.swap(block);
+        SweepChange change;
         {
-            currentProduct = iter->first.product;
-            PIpair.product = currentProduct;
-            PIpair.input = 0;
+            SweepTimer timer;
+            change = jacobiSweepBlock(engine, direct, prevBlock, block, 0, engine.productCount());
+        }
+        sweeps++;
+
+        cout << "iteration " << sweeps << " complete" << endl;
+        if (profiledToleranceMet(change, options))              break;
+        if (options.iterations && sweeps >= options.iterations) break;
+    }
+}
+
 
-            laborOnlyPrices[currentProduct] = ioTable.at(PIpair);  // start with the labor value...
+// Jacobi sweeps with the table's inputs streamed from the file instead of
+// held in memory (--out-of-core), until the tolerances are met or -i sweeps
+// are done
+void calcPricesOutOfCore(const PriceEngine& engine,
+                         vector<double>& prices,
+                         const RunOptions& options)
+{
+    TableStream stream(options.fileLocation, engine, options.outOfCoreMB);
+    printTableStream(stream, engine);
+
+    BlockSweep sweepBlock = [&](const StreamBlock& block, const vector<double>& in, vector<double>& out)
+    {
+        return streamedSweep(engine, block, in, out, block.firstRow, block.lastRow);
+    };
 
-            // ...and divide it by quantity produced of that product
-            PIpair.input = 1;
-            laborOnlyPrices[currentProduct] /= ioTable.at(PIpair);
+    cout << "\nNow running out-of-core iterations." << endl;
+    vector<double> prevIterPrices(prices.size());
+    int sweeps{0};
+    while (true)
+    {
+        prevIterPrices.swap(prices);
+        SweepChange change;
+        {
+            SweepTimer timer;
+            change = stream.sweep(prevIterPrices, prices, sweepBlock);
         }
+        sweeps++;
+
+        cout << "iteration " << sweeps << " complete" << endl;
+        if (options.stopsOnTolerance() ? profiledToleranceMet(change, options) : sweeps >= options.iterations) break;
     }
+}
 
 
-    // precision-based algorithm
-    cout << "Now iterating until precision == " << precision << endl;
-    int iterCounter{1};
+// Jacobi sweeps with float coefficients, refined in double until the
+// tolerances are met (--float, see mixedPrecision.hpp)
+void calcPricesFloat(const PriceEngine& engine,
+                     vector<double>& prices,
+                     const RunOptions& options)
+{
+    vector<float> floatCoeffs;
+    buildFloatCoefficients(engine, floatCoeffs);
+    vector<double> labor(engine.laborOnly.begin(), engine.laborOnly.end());
 
-    prices = laborOnlyPrices;
-    do 
+    FloatSweep sweep = [&](const vector<double>& base, const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        return floatSweep(engine, floatCoeffs, base, in, out, 0, engine.productCount());
+    };
+    ExactSweep exactSweep = [&](const vector<double>& in, vector<double>& out)
     {
-        prevIterPrices = prices;     // save last iteration's prices...
-        prices = laborOnlyPrices;    // ...and start fresh for current iteration
+        SweepTimer timer;
+        return jacobiSweep(engine, in, out, 0, engine.productCount());
+    };
 
+    cout << "\nNow running iterations with float coefficients." << endl;
+    printRefinement(refinedSolve(sweep, exactSweep, labor, prices, options));
+}
 
-        for (auto iter = ioTable.begin(); iter != ioTable.end(); ++iter)
-        {
-            PIpair = iter->first;               // key loaded into local variable for speed
 
-            // no need to consider the output quantity column (irrelevant)
-            // or labor column (already accounted for)
-            if(PIpair.input == 1 || PIpair.input == 0) continue;     
-            
-            // add prevIterPrices cost of the input to the current product's total cost, 
-            // and divide by total units produced to get the per-unit cost of that input
-            double priceAddition = ioTable.at(PIpair) * prevIterPrices.at(PIpair.input);
-            PIpair.input = 1;
-            priceAddition       /= ioTable.at(PIpair);
+// Jacobi sweeps that only recompute the products whose inputs are still
+// moving, with full sweeps to check the tolerances (--active-set, see activeSet.hpp)
+void calcPricesActiveSet(const PriceEngine& engine,
+                         vector<double>& prices,
+                         const RunOptions& options)
+{
+    FullSweep fullSweep = [&](const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        return jacobiSweep(engine, in, out, 0, engine.productCount());
+    };
+    ActiveSweep activeSweep = [&](const vector<uint32_t>& rows, const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        activeRowsSweep(engine, rows, 0, rows.size(), in, out);
+    };
+
+    cout << "Now iterating on the active set until " << describeTolerances(options) << endl;
+    printActiveSet(activeSetSolve(engine, fullSweep, activeSweep, prices, options), engine.productCount());
+}
+
 
-            prices.at(PIpair.product) += priceAddition;
+// Prices the table and every scenario of --scenarios together (see
+// scenarioBatch.hpp): Jacobi sweeps over a block of 1 + scenarios prices per
+// product, until the tolerances are met or -i sweeps are done. block receives the result.
+void calcPricesScenarios(const PriceEngine&    engine,
+                         const vector<double>& startPrices,
+                         ScenarioSet&          scenarios,
+                         vector<double>&       block,
+                         const RunOptions&     options)
+{
+    loadScenarios(engine, options, scenarios);
+    printScenarioSet(scenarios);
+    startingScenarioBlock(scenarios, startPrices, block);
+    vector<double> prevBlock(block.size());
+
+    cout << "\nNow running iterations for the table and " << scenarios.names.size() << " scenarios." << endl;
+    int sweeps{0};
+    while (true)
+    {
+        prevBlock.swap(block);
+        SweepChange change;
+        {
+            SweepTimer timer;
+            change = scenarioSweep(engine, scenarios, prevBlock, block, 0, engine.productCount());
         }
+        sweeps++;
 
-        //printPrices(currIterPrices);
-        cout << "iteration " << iterCounter << " complete" << endl;
-        iterCounter++;
+        cout << "iteration " << sweeps << " complete" << endl;
+        if (profiledToleranceMet(change, options))              break;
+        if (options.iterations && sweeps >= options.iterations) break;
     }
-    while(!precisionReached(prevIterPrices, prices, precision));
+}
+
 
+// The quantity side of the plan (--quantity, see quantitySolver.hpp): the
+// gross output for the final demand, swept down the table's columns
+void calcGrossOutput(const PriceEngine& engine,
+                     vector<double>& block,
+                     const RunOptions& options)
+{
+    auto sweepOf = [](const TransposedTable& transposed, const vector<double>& demand)
+    {
+        return QuantitySweep([&transposed, &demand](const vector<double>& in, vector<double>& out)
+        {
+            SweepTimer timer;
+            return quantitySweep(transposed, demand, in, out, 0, demand.size());
+        });
+    };
+    printQuantityResult(calcQuantities(engine, sweepOf, block, options));
+}
+
+
+// Runs the solve the options ask for, starting from densePrices (or, for
+// --resources, into resourcePrices)
+void calcPrices(PriceEngine&      engine,
+                vector<double>&   densePrices,
+                vector<double>&   resourcePrices,
+                const RunOptions& options)
+{
+    if (options.resources)
+    {
+        calcPricesResources(engine, densePrices, resourcePrices, options);
+    }
+    else if (options.whatIfFile)
+    {
+        calcPricesWhatIf(engine, densePrices, options);
+    }
+    else if (options.outOfCoreMB)
+    {
+        calcPricesOutOfCore(engine, densePrices, options);
+    }
+    else if (options.floatCoeffs)
+    {
+        calcPricesFloat(engine, densePrices, options);
+    }
+    else if (options.activeSet)
+    {
+        calcPricesActiveSet(engine, densePrices, options);
+    }
+    else if (options.solver == SolverKind::COMPONENTS)
+    {
+        calcPricesComponents(engine, densePrices, options);
+    }
+    else if (options.solver == SolverKind::MULTILEVEL)
+    {
+        calcPricesMultilevel(engine, densePrices, options);
+    }
+    else if (options.solver != SolverKind::ITERATE)
+    {
+        calcPricesKrylov(engine, densePrices, options);
+    }
+    else if (options.acceleration != Acceleration::NONE) 
+    {
+        calcPricesAccelerated(engine, densePrices, options);
+    }
+    else
+    {
+        if (options.stopsOnTolerance()) calcPricesPrec(engine, densePrices, options);
+        if (options.iterations)         calcPricesConstIter(engine, densePrices, options);
+    }
 }
 
 
@@ -161,15 +455,14 @@ int main(int argc, char* argv[])
 {
     auto start = chrono::high_resolution_clock::now();
 
-    char* fileLoc{nullptr};
-    int precision{0};
-    int iterations{0};
-    char* outputFile{nullptr};
+    RunOptions options;
 
     // crash if there were CLI errors
     try
     {
-        bool helpPrinted = parseCmdOptions(argc, argv, fileLoc, precision, iterations, outputFile);
+        bool helpPrinted = parseCmdOptions(argc, argv, options);
+        if (helpPrinted) return 0;
+        if (options.asyncRelaxation) throw bad_option("--async needs several threads; run it with plecpr-mt.");
     }
     catch (const exception& e)
     {
@@ -177,27 +470,132 @@ int main(int argc, char* argv[])
         cerr << e.what() << endl;
         return 0;
     }
+    reserveStdoutForReplies(options);
+    if (options.profileFile) runProfile.start("plecpr", 1);
     
 
-    // load table
-    unordered_map<ProdInputPair,double> ioTable;
+    // load table (text or compiled), indexed so the iterations don't need any hashing
+    PriceEngine engine;
     try
     {
-        bool ioTableLoaded = loadIOTable(fileLoc, ioTable);
+        if (options.outOfCoreMB) checkStreamable(options.fileLocation);
+        loadPriceEngine(options.fileLocation, engine);
+        if (options.compiledFile) 
+        {
+            saveCompiledTable(engine, options.compiledFile);
+            return 0;
+        }
+        runProfile.describeTable(engine, options.fileLocation, options.resources ? resourceColumns(engine) : 1);
     }
     catch (const bad_file& bf)
     {
         cerr << bf.what() << endl;
         return 0;
     }
+    catch (const malformed_table& mt)
+    {
+        cerr << mt.what() << endl;
+        return 0;
+    }
+
+    vector<double> densePrices;
+    vector<double> resourcePrices;      // --resources: 1 + resourceCount() values per product
+    vector<double> quantities;          // --quantity: gross output and labor per product
+    vector<double> scenarioPrices;      // --scenarios: 1 + scenarios prices per product
+    ScenarioSet    scenarios;
+    ReorderedTable reordered;           // --reorder: solved in this order, then put back
+    try
+    {
+        {
+            PhaseTimer timer("start");
+            startingPrices(engine, options, densePrices);
+        }
+        if (options.reorder != Reordering::NONE)
+        {
+            PhaseTimer timer("reorder");
+            reorderTable(engine, options.reorder, reordered);
+            toReorderedOrder(reordered, densePrices);
+        }
+
+        {
+            PhaseTimer timer("solve");
+            if      (options.demandFile)   calcGrossOutput(engine, quantities, options);
+            else if (options.scenarioFile) calcPricesScenarios(engine, densePrices, scenarios, scenarioPrices, options);
+            else calcPrices(options.reorder != Reordering::NONE ? reordered.engine : engine, densePrices, resourcePrices, options);
+        }
+        if (options.reorder != Reordering::NONE)
+        {
+            toTableOrder(reordered, densePrices);
+            if (options.resources) toTableOrder(reordered, resourcePrices, resourceColumns(engine));
+        }
+        checkFinitePrices(options.demandFile   ? quantities
+                        : options.scenarioFile ? scenarioPrices
+                        : options.resources    ? resourcePrices
+                                               : densePrices);
+    }
+    catch (const malformed_table& mt)
+    {
+        cerr << mt.what() << endl;
+        return 0;
+    }
+    catch (const bad_file& bf)
+    {
+        cerr << bf.what() << endl;
+        return 0;
+    }
+    catch (const diverged& dv)
+    {
+        cerr << dv.what() << endl;
+        return 1;       // no prices to write
+    }
 
+    if (options.serveSocket)
+    {
+        PriceSolve solve = [&resourcePrices](PriceEngine& engine, vector<double>& prices, const RunOptions& options)
+        {
+            calcPrices(engine, prices, resourcePrices, options);
+        };
+        try
+        {
+            servePrices(engine, densePrices, options, solve);
+        }
+        catch (const exception& e)
+        {
+            cerr << e.what() << endl;
+            return 0;
+        }
+    }
 
-    unordered_map<long int, double> prices;
-    if (precision)  calcPricesPrec(ioTable, prices, precision);
-    if (iterations) calcPricesConstIter(ioTable, prices, iterations);
+    {
+        PhaseTimer timer("write");
+        PriceTable table = options.demandFile   ? quantityTable(engine, quantities)
+                         : options.scenarioFile ? scenarioTable(engine, scenarios, scenarioPrices)
+                         : options.resources    ? resourcePriceTable(engine, resourcePrices)
+                                                : priceTable(engine, densePrices);
+        try
+        {
+            if (options.outputFile) savePricesToFile(table, options.outputFile, options.binaryOutput);
+            else if (!options.serveSocket) printPrices(table);
+        }
+        catch (const bad_file& bf)
+        {
+            cerr << bf.what() << endl;
+            return 0;
+        }
+    }
 
-    if (outputFile) savePricesToFile(prices, outputFile);
-    else printPrices(prices);
+    if (options.profileFile)
+    {
+        try
+        {
+            runProfile.saveToFile(options.profileFile);
+        }
+        catch (const bad_file& bf)
+        {
+            cerr << bf.what() << endl;
+            return 0;
+        }
+    }
 
 
     auto stop     = chrono::high_resolution_clock::now();
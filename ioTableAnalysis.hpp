@@ -1,10 +1,22 @@
 // header file with class definitions, utility functions, and other #includes
 
+#pragma once
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <unordered_map>
 #include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 using namespace std;
 
 const int PRECISION_MAX = 15;   // long type chosen to avoid error on cast to char*
@@ -52,6 +64,17 @@ class ProdInputPair
 };
 
 
+// One line of the input-output table file, kept as a plain triplet
+// so that it can be handed to the compiled engine (see priceEngine.hpp)
+// without going through a hash map first
+struct TableEntry
+{
+    long int product;
+    long int input;
+    double   quantity;
+};
+
+
 class bad_file: public exception
 {
     public:
@@ -70,6 +93,170 @@ class ambiguous_halting_point: public exception
         }
 };
 
+// thrown for an option value that can't be used, e.g. an unknown mode name
+class bad_option: public exception
+{
+    public:
+        bad_option(const string& problem)
+            : message("OPTION ERROR: " + problem + "\n") {}
+
+        virtual const char* what() const throw()
+        {
+            return message.c_str();
+        }
+
+    private:
+        string message;
+};
+
+// thrown when the table can't be turned into a solvable system,
+// e.g. a product with no output quantity, or an input nobody produces
+class malformed_table: public exception
+{
+    public:
+        malformed_table(const string& problem)
+            : message("TABLE ERROR: " + problem + "\n") {}
+
+        virtual const char* what() const throw()
+        {
+            return message.c_str();
+        }
+
+    private:
+        string message;
+};
+
+
+// thrown when the prices stop being finite numbers, e.g. for a table that
+// isn't productive or an over-relaxation that diverges
+class diverged: public exception
+{
+    public:
+        diverged(const string& problem)
+            : message("SOLVE ERROR: " + problem + "\n") {}
+
+        virtual const char* what() const throw()
+        {
+            return message.c_str();
+        }
+
+    private:
+        string message;
+};
+
+
+// Memory map of a whole file, unmapped when it goes out of scope.
+// With copyOnWrite the mapping can be written to, but the changes stay
+// private to this process and never reach the file.
+// Throws bad_file if the file can't be opened.
+class MappedFile
+{
+    public:
+        char*  data{nullptr};
+        size_t size{0};
+
+        MappedFile(const char* fileLoc, bool copyOnWrite = false)
+        {
+            int fd = open(fileLoc, O_RDONLY);
+            if (fd < 0) throw bad_file();
+
+            struct stat fileStat;
+            if (fstat(fd, &fileStat) != 0)
+            {
+                close(fd);
+                throw bad_file();
+            }
+
+            size = fileStat.st_size;
+            if (size > 0)
+            {
+                int protection = copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ;
+                void* mapped   = mmap(nullptr, size, protection, MAP_PRIVATE, fd, 0);
+                if (mapped == MAP_FAILED)
+                {
+                    close(fd);
+                    throw bad_file();
+                }
+                data = (char*) mapped;
+                madvise(mapped, size, MADV_SEQUENTIAL);
+            }
+            close(fd);       // the mapping stays valid without the descriptor
+        }
+
+        ~MappedFile()
+        {
+            if (data) munmap(data, size);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+};
+
+
+// How each sweep updates the prices (-m):
+// JACOBI computes every price from the previous sweep's prices,
+// GAUSS_SEIDEL updates prices in place so later rows already see them, and
+// SOR does the same but over-relaxes each update by a factor omega.
+enum class SweepMode { JACOBI, GAUSS_SEIDEL, SOR };
+
+// Optional extrapolation wrapped around the sweeps (-a), see accelerator.hpp
+enum class Acceleration { NONE, ANDERSON, AITKEN };
+
+// What solves the price system (-s): the sweeps of the original algorithm,
+// a Krylov method on (I - A) p = l (see krylovSolver.hpp), the sweeps run
+// one strongly connected component at a time (see sccSolver.hpp), or the
+// sweeps with coarse corrections from an aggregated table (see multilevelSolver.hpp)
+enum class SolverKind { ITERATE, BICGSTAB, GMRES, COMPONENTS, MULTILEVEL };
+
+// preconditioner for the Krylov solvers (--precond)
+enum class Preconditioner { NONE, JACOBI, ILU0 };
+
+// how products are renumbered before solving (--reorder), see reorder.hpp
+enum class Reordering { NONE, RCM, COMMUNITIES };
+
+// kernel for Jacobi sweeps (--kernel): the engine's CSR rows, or a SELL-C-sigma
+// copy swept with scalar, AVX2 or AVX-512 code (see sellKernel.hpp).
+// AUTO picks the widest SIMD kernel the CPU supports.
+enum class SweepKernel { AUTO, CSR, SCALAR, AVX2, AVX512 };
+
+// everything the command line can set, filled in by parseCmdOptions
+class RunOptions
+{
+    public:
+        char*     fileLocation{nullptr};        // -f, text table or compiled table
+        int       precision{0};                 // -p
+        int       iterations{0};                // -i
+        char*     outputFile{nullptr};          // -o
+        char*     compiledFile{nullptr};        // -c, compile the table to this file and stop
+        SweepMode sweepMode{SweepMode::JACOBI}; // -m
+        double    omega{1.0};                   // -w, relaxation factor for SOR
+        Acceleration acceleration{Acceleration::NONE};  // -a
+        int       andersonDepth{5};             // -k, sweeps of history Anderson mixing uses
+        SolverKind     solver{SolverKind::ITERATE};             // -s
+        Preconditioner preconditioner{Preconditioner::ILU0};    // --precond
+        char*     whatIfFile{nullptr};          // --what-if, delta table to apply
+        char*     basePricesFile{nullptr};      // --base, solved prices the delta starts from
+        char*     warmStartFile{nullptr};       // --warm-start, prices to start iterating from
+        SweepKernel kernel{SweepKernel::CSR};   // --kernel
+        bool      resources{false};             // --resources, solve for every primary resource at once
+        double    relativeTolerance{0};         // --tol-rel, on max |change| / |price|
+        double    residualTolerance{0};         // --tol-res, on the L2 norm of a sweep's change
+        char*     profileFile{nullptr};         // --profile, write per-phase timings and counters as JSON
+        bool      binaryOutput{false};          // --binary, -o writes a binary price file instead of CSV
+        char*     serveSocket{nullptr};         // --serve, socket path to answer requests on ("-" for stdio)
+        uint64_t  outOfCoreMB{0};               // --out-of-core, stream the table from disk in blocks of this many MB
+        bool      floatCoeffs{false};           // --float, sweep with float coefficients and refine in double
+        Reordering reorder{Reordering::NONE};   // --reorder, renumber products for locality before solving
+        bool      activeSet{false};             // --active-set, only recompute products whose inputs still move
+        bool      asyncRelaxation{false};       // --async, plecpr-mt threads relax their rows without barriers
+        char*     sectorMapFile{nullptr};       // --sectors, UPC prefixes to sectors, for -s multilevel
+        char*     demandFile{nullptr};          // --quantity, final demand to solve the gross output for
+        char*     scenarioFile{nullptr};        // --scenarios, changes to the table to price side by side
+
+        // whether sweeps stop on a tolerance rather than after -i of them
+        bool stopsOnTolerance() const { return precision || relativeTolerance > 0 || residualTolerance > 0; }
+};
+
 
 // this defines hashing for the ProductInputPair class,
 // simply hashing the sum of the product and input attributes
@@ -100,7 +287,8 @@ namespace std
 
 void printHelp(char* executableName)
 {
-    cout << "\nUsage: " << executableName << " -f input_file_path {-i iterations | -p precision} [-o output_file]" << endl << endl;
+    cout << "\nUsage: " << executableName << " -f input_file_path {-i iterations | -p precision} [-o output_file]" << endl;
+    cout << "       " << executableName << " -f input_file_path -c compiled_file" << endl << endl;
     cout << "Options:" << endl << endl;
     cout << "    -f file_path         <required> Path to a .txt file containing the input-output table, " << endl;
     cout << "                         with each line containing the UPC of the output, a comma" << endl;
@@ -115,24 +303,224 @@ void printHelp(char* executableName)
     cout << "                         is 0 or 1: when it's 0, the rightmost number is the person-hours" << endl;
     cout << "                         used in the production of the product whose UPC is first, and" << endl;
     cout << "                         when it's 1, the right-most number is the number of units" << endl;
-    cout << "                         produced over the production period. " << endl << endl;
+    cout << "                         produced over the production period. " << endl;
+    cout << "                         Codes 2 to 9 are reserved for other primary resources (energy," << endl;
+    cout << "                         emissions, materials...), used by --resources. " << endl;
+    cout << "                         A table compiled with -c can be given here instead, and is" << endl;
+    cout << "                         memory-mapped and solved without any parsing." << endl << endl;
     cout << "    -i iterations        [optional if -p given] The number of iterations the alogorithm will run. " << endl << endl;
     cout << "    -p precision         [optional if -i given] The precision at which the algorithm is to stop" << endl; 
     cout << "                         iterating, given as the number of decimal digits to the right of the" << endl;
     cout << "                         decimal point. " << endl << endl;
+    cout << "    --tol-rel tolerance  [optional, like -p] Stop once no price changes by more than this" << endl;
+    cout << "                         fraction of itself in a sweep (e.g. 1e-9). " << endl << endl;
+    cout << "    --tol-res tolerance  [optional, like -p] Stop once the L2 norm of a sweep's changes (the" << endl;
+    cout << "                         residual l + Ap - p) is at most this. Tolerances given together" << endl;
+    cout << "                         must all be met. " << endl << endl;
     cout << "    -o output_file       [optional] Path to a .csv file where the calculated prices are to be " << endl;
-    cout << "                         saved to. " << endl << endl;
+    cout << "                         saved to, in UPC order. " << endl << endl;
+    cout << "    --binary             [optional] Make -o a binary price file instead, which can be memory-" << endl;
+    cout << "                         mapped and is read by --warm-start and --base like a .csv. " << endl << endl;
+    cout << "    -m mode              [optional] How each sweep updates the prices: jacobi (the default)" << endl;
+    cout << "                         computes every price from the last sweep's prices; gs (Gauss-Seidel)" << endl;
+    cout << "                         updates prices in place, so later products already use them; sor" << endl;
+    cout << "                         does the same with over-relaxation. " << endl << endl;
+    cout << "    -w omega             [optional] Relaxation factor for -m sor, between 0 and 2" << endl;
+    cout << "                         (defaults to 1.2; giving -w alone selects sor). plecpr-mt on more" << endl;
+    cout << "                         than one core caps it at 1, as over-relaxing each thread's rows" << endl;
+    cout << "                         against the others' old prices can diverge. " << endl << endl;
+    cout << "    -a acceleration      [optional] Extrapolate from recent sweeps to converge in fewer of" << endl;
+    cout << "                         them: anderson (Anderson mixing) or aitken (Aitken delta-squared)." << endl;
+    cout << "                         Extrapolations that increase the residual are dropped. " << endl << endl;
+    cout << "    -k depth             [optional] Number of past sweeps Anderson mixing uses (defaults to 5). " << endl << endl;
+    cout << "    -s solver            [optional] iterate (the default) runs the sweeps of the original" << endl;
+    cout << "                         algorithm; krylov (or bicgstab) and gmres instead solve the linear" << endl;
+    cout << "                         system (I - A) p = l with a preconditioned Krylov method, reporting" << endl;
+    cout << "                         the iterations used and the true residual. -p is then the residual" << endl;
+    cout << "                         tolerance and -i the iteration limit; both can be given, and a -p" << endl;
+    cout << "                         solve stops after 10000 iterations anyway. scc splits the table into" << endl;
+    cout << "                         strongly connected components: products on no cycle are priced" << endl;
+    cout << "                         exactly in one pass, and only cycles are swept (to -p, or -i times" << endl;
+    cout << "                         each). multilevel corrects the prices every few sweeps from an" << endl;
+    cout << "                         aggregated table of at most a few thousand sectors, solved" << endl;
+    cout << "                         exactly; -i is then the number of such cycles. Its sweeps are" << endl;
+    cout << "                         Gauss-Seidel unless -m says otherwise. " << endl << endl;
+    cout << "    --sectors file       [optional] Sectors for -s multilevel to aggregate the products into:" << endl;
+    cout << "                         one UPC prefix and one sector number per line, such as \"1010 3\"." << endl;
+    cout << "                         Without it, products are aggregated by how strongly they're linked. " << endl << endl;
+    cout << "    --precond kind       [optional] Preconditioner for the Krylov solvers: ilu0 (the default)," << endl;
+    cout << "                         jacobi or none. " << endl << endl;
+    cout << "    --kernel kernel      [optional] How Jacobi sweeps run: csr (the default) sweeps the" << endl;
+    cout << "                         table's own rows; auto builds a SELL-C-sigma copy of the table and" << endl;
+    cout << "                         sweeps it with the widest SIMD kernel the CPU supports, and avx512," << endl;
+    cout << "                         avx2 or scalar pick one. The copy takes as much memory again and" << endl;
+    cout << "                         pays for itself over solves of many sweeps. All give the same prices. " << endl << endl;
+    cout << "    --resources          [optional] Also solve for the other primary resources the table" << endl;
+    cout << "                         records (input codes 2 to 9, e.g. energy or CO2), all in the same" << endl;
+    cout << "                         Jacobi sweeps as labor. The output gets one column per resource. " << endl << endl;
+    cout << "    --warm-start file    [optional] Start iterating from the prices in a .csv written by -o" << endl;
+    cout << "                         (e.g. last period's solve) instead of from direct labor alone." << endl;
+    cout << "                         Products not in the file start from direct labor. " << endl << endl;
+    cout << "    --what-if delta_file [optional] Apply a delta table (same format as -f, new absolute" << endl;
+    cout << "                         quantities) to the table and reprice only the products downstream" << endl;
+    cout << "                         of the changes, starting from the prices given with --base. " << endl << endl;
+    cout << "    --base prices_file   Prices already solved for the -f table, as a .csv written by -o. " << endl << endl;
+    cout << "    --profile file       [optional] Write a JSON profile of the run to this file: the time of" << endl;
+    cout << "                         each phase (load, build, solve, write...), of every sweep and of the" << endl;
+    cout << "                         convergence checks, the throughput of parsing and sweeping, and," << endl;
+    cout << "                         where the kernel allows it, CPU cycles, cache and branch misses" << endl;
+    cout << "                         during the sweeps. " << endl << endl;
+    cout << "    --serve socket       [optional] After solving, stay up and answer requests (price lookups," << endl;
+    cout << "                         re-solves, deltas) on this Unix domain socket, or on stdin and" << endl;
+    cout << "                         stdout for \"-\". See priceServer.hpp for the requests. " << endl << endl;
+    cout << "    --float              [optional] Sweep with the coefficients rounded to float, which moves" << endl;
+    cout << "                         a third fewer bytes per nonzero, then correct the prices with" << endl;
+    cout << "                         double-precision residuals until -p (or the tolerances) is met." << endl;
+    cout << "                         Reports the precision reached. Runs plain Jacobi sweeps. " << endl << endl;
+    cout << "    --active-set         [optional] Once a sweep has been made, only recompute the products" << endl;
+    cout << "                         whose inputs are still moving, with a full sweep whenever none are" << endl;
+    cout << "                         left to check the tolerances. Needs -p, --tol-rel or --tol-res." << endl;
+    cout << "                         Only helps tables whose products converge unevenly: sweeps stay" << endl;
+    cout << "                         full while half the products are moving, so on a table that" << endl;
+    cout << "                         converges evenly it's plain Jacobi plus the cost of the consumer" << endl;
+    cout << "                         index. " << endl << endl;
+    cout << "    --async              [optional, plecpr-mt only] Let every thread relax its own products" << endl;
+    cout << "                         over and over, using whatever prices the others have reached," << endl;
+    cout << "                         without waiting for one another between sweeps. A Jacobi sweep" << endl;
+    cout << "                         checks the tolerances once every thread has settled. " << endl << endl;
+    cout << "    --quantity demand    [optional] Solve the quantity side of the plan instead of the prices:" << endl;
+    cout << "                         the gross output x = Ax + d of every product for the final demand d" << endl;
+    cout << "                         in this file, one \"UPC,quantity\" line per product, such as" << endl;
+    cout << "                         \"101010282293,5000\". Stops like the price sweeps do; -o gets each" << endl;
+    cout << "                         product's gross output and the labor it takes. " << endl << endl;
+    cout << "    --scenarios file     [optional] Price a batch of scenarios alongside the table: each is" << endl;
+    cout << "                         a \"[name]\" line followed by changes in the format of -f (new" << endl;
+    cout << "                         absolute labor, output or input quantities the table already has)." << endl;
+    cout << "                         Every sweep reads the table once for all of them, and the output" << endl;
+    cout << "                         gets one price column per scenario. " << endl << endl;
+    cout << "    --reorder ordering   [optional] Renumber the products before solving, so that products" << endl;
+    cout << "                         used together sit close together in memory: communities groups" << endl;
+    cout << "                         products that trade mostly among themselves and orders each group" << endl;
+    cout << "                         by reverse Cuthill-McKee; rcm uses reverse Cuthill-McKee alone." << endl;
+    cout << "                         The prices are put back in UPC order afterwards. " << endl << endl;
+    cout << "    --out-of-core MB     [optional] For tables bigger than memory: stream the compiled table's" << endl;
+    cout << "                         inputs from disk every sweep, in blocks of about this many MB (e.g." << endl;
+    cout << "                         64), reading the next block while the last one is swept. Only the" << endl;
+    cout << "                         prices and per-product arrays stay in memory. Needs -f to be a" << endl;
+    cout << "                         compiled table, and runs plain Jacobi sweeps (--kernel is unused). " << endl << endl;
+    cout << "    -c compiled_file     [optional] Compile the table into a binary file that loads instantly" << endl;
+    cout << "                         when given to -f, then exit without solving. " << endl << endl;
     cout << "    -h                   Print this list of options. " << endl << endl;
 }
 
 
+// Throws bad_option for modes and options that can't be used together.
+// parseCmdOptions runs it on the command line, and a server (--serve) on
+// the halting points each request gives.
+void checkModeOptions(const RunOptions& options)
+{
+    if (options.omega <= 0 || options.omega >= 2)
+    {
+        throw bad_option("The SOR relaxation factor (-w) must be between 0 and 2.");
+    }
+    if (options.whatIfFile && !options.basePricesFile)
+    {
+        throw bad_option("--what-if needs the solved prices to start from (--base).");
+    }
+    if (options.resources && (options.sweepMode != SweepMode::JACOBI || options.acceleration != Acceleration::NONE
+                              || options.solver != SolverKind::ITERATE || options.whatIfFile))
+    {
+        throw bad_option("--resources runs plain Jacobi sweeps, without -m, -w, -a, -s or --what-if.");
+    }
+    if ((options.relativeTolerance || options.residualTolerance) && options.solver != SolverKind::ITERATE
+        && options.solver != SolverKind::COMPONENTS && options.solver != SolverKind::MULTILEVEL)
+    {
+        throw bad_option("--tol-rel and --tol-res stop sweeps; the Krylov solvers stop on -p.");
+    }
+    if (options.relativeTolerance < 0 || options.residualTolerance < 0)
+    {
+        throw bad_option("Tolerances (--tol-rel, --tol-res) can't be negative.");
+    }
+    if (options.serveSocket && options.resources)
+    {
+        throw bad_option("--serve answers labor price requests, without --resources.");
+    }
+    if (options.outOfCoreMB && (options.sweepMode != SweepMode::JACOBI || options.acceleration != Acceleration::NONE
+                                || options.solver != SolverKind::ITERATE || options.whatIfFile || options.resources
+                                || options.serveSocket))
+    {
+        throw bad_option("--out-of-core runs plain Jacobi sweeps, without -m, -w, -a, -s, --what-if, --resources or --serve.");
+    }
+    if (options.floatCoeffs && (options.sweepMode != SweepMode::JACOBI || options.acceleration != Acceleration::NONE
+                                || options.solver != SolverKind::ITERATE || options.whatIfFile || options.resources
+                                || options.outOfCoreMB))
+    {
+        throw bad_option("--float runs plain Jacobi sweeps, without -m, -w, -a, -s, --what-if, --resources or --out-of-core.");
+    }
+    if (options.activeSet && (options.sweepMode != SweepMode::JACOBI || options.acceleration != Acceleration::NONE
+                              || options.solver != SolverKind::ITERATE || options.whatIfFile || options.resources
+                              || options.outOfCoreMB || options.floatCoeffs))
+    {
+        throw bad_option("--active-set runs plain Jacobi sweeps, without -m, -w, -a, -s, --what-if, --resources, --out-of-core or --float.");
+    }
+    if (options.activeSet && !options.stopsOnTolerance())
+    {
+        throw bad_option("--active-set needs a tolerance to tell settled products from moving ones (-p, --tol-rel or --tol-res).");
+    }
+    if (options.asyncRelaxation && (options.sweepMode != SweepMode::JACOBI || options.acceleration != Acceleration::NONE
+                                    || options.solver != SolverKind::ITERATE || options.whatIfFile || options.resources
+                                    || options.outOfCoreMB || options.floatCoeffs || options.activeSet))
+    {
+        throw bad_option("--async relaxes the products in place on its own, without -m, -w, -a, -s, --what-if, --resources, --out-of-core, --float or --active-set.");
+    }
+    if (options.sectorMapFile && options.solver != SolverKind::MULTILEVEL)
+    {
+        throw bad_option("--sectors gives the aggregation for -s multilevel.");
+    }
+    if (options.demandFile && (options.sweepMode != SweepMode::JACOBI || options.acceleration != Acceleration::NONE
+                               || options.solver != SolverKind::ITERATE || options.whatIfFile || options.resources
+                               || options.outOfCoreMB || options.floatCoeffs || options.activeSet || options.asyncRelaxation
+                               || options.reorder != Reordering::NONE || options.warmStartFile || options.serveSocket
+                               || options.binaryOutput))
+    {
+        throw bad_option("--quantity runs plain Jacobi sweeps over the table's columns, without -m, -w, -a, -s, --what-if,"
+                         " --resources, --out-of-core, --float, --active-set, --async, --reorder, --warm-start, --serve or --binary.");
+    }
+    if (options.scenarioFile && (options.sweepMode != SweepMode::JACOBI || options.acceleration != Acceleration::NONE
+                                 || options.solver != SolverKind::ITERATE || options.whatIfFile || options.resources
+                                 || options.outOfCoreMB || options.floatCoeffs || options.activeSet || options.asyncRelaxation
+                                 || options.reorder != Reordering::NONE || options.serveSocket || options.binaryOutput
+                                 || options.demandFile))
+    {
+        throw bad_option("--scenarios runs plain Jacobi sweeps, without -m, -w, -a, -s, --what-if, --resources, --out-of-core,"
+                         " --float, --active-set, --async, --reorder, --serve, --binary or --quantity.");
+    }
+    if (options.reorder != Reordering::NONE && (options.whatIfFile || options.serveSocket || options.outOfCoreMB))
+    {
+        throw bad_option("--reorder can't be combined with --what-if, --serve or --out-of-core, which work in UPC order.");
+    }
+    if (options.andersonDepth < 1)
+    {
+        throw bad_option("The Anderson history depth (-k) must be at least 1.");
+    }
+}
+
+
+// Throws ambiguous_halting_point unless exactly one of -i and the
+// tolerances (-p, --tol-rel, --tol-res) says when to stop
+void checkHaltingPoints(const RunOptions& options)
+{
+    // except that -i caps a Krylov solve to -p
+    const bool krylov = options.solver == SolverKind::BICGSTAB || options.solver == SolverKind::GMRES;
+    if (!options.stopsOnTolerance() && !options.iterations)           throw ambiguous_halting_point();
+    if (options.stopsOnTolerance() && options.iterations && !krylov) throw ambiguous_halting_point();
+}
+
+
 // bool indicates if help was printed
-bool parseCmdOptions(const int argc, 
-                     char**    argv,
-                     char*    &fileLocation,
-                     int      &precision,
-                     int      &iterations,
-                     char*    &outputFile)
+bool parseCmdOptions(const int   argc, 
+                     char**      argv,
+                     RunOptions& options)
 {
     // so that .compare() can be against string objects, not literals
     string helpOption("-h");
@@ -140,6 +528,32 @@ bool parseCmdOptions(const int argc,
     string precOption("-p");
     string iterOption("-i");
     string outpOption("-o");
+    string compOption("-c");
+    string modeOption("-m");
+    string omegOption("-w");
+    string accelOption("-a");
+    string deptOption("-k");
+    string solvOption("-s");
+    string precOption2("--precond");
+    string whatOption("--what-if");
+    string baseOption("--base");
+    string warmOption("--warm-start");
+    string kernOption("--kernel");
+    string resoOption("--resources");
+    string relTOption("--tol-rel");
+    string resTOption("--tol-res");
+    string profOption("--profile");
+    string binOption("--binary");
+    string servOption("--serve");
+    string oocOption("--out-of-core");
+    string floatOption("--float");
+    string reorOption("--reorder");
+    string actvOption("--active-set");
+    string asynOption("--async");
+    string sectOption("--sectors");
+    string qntyOption("--quantity");
+    string scenOption("--scenarios");
+    bool   modeGiven{false};
 
     for (int i = 1; i < argc; i++)
     {
@@ -149,93 +563,247 @@ bool parseCmdOptions(const int argc,
             return true;
         }
         
-        if (!fileOption.compare(argv[i])) fileLocation =      argv[i+1] ;
-        if (!precOption.compare(argv[i])) precision    = atoi(argv[i+1]);
-        if (!iterOption.compare(argv[i])) iterations   = atoi(argv[i+1]);
-        if (!outpOption.compare(argv[i])) outputFile   =      argv[i+1] ;
+        if (!fileOption.compare(argv[i])) options.fileLocation =      argv[i+1] ;
+        if (!precOption.compare(argv[i])) options.precision    = atoi(argv[i+1]);
+        if (!iterOption.compare(argv[i])) options.iterations   = atoi(argv[i+1]);
+        if (!outpOption.compare(argv[i])) options.outputFile   =      argv[i+1] ;
+        if (!compOption.compare(argv[i])) options.compiledFile =      argv[i+1] ;
+        if (!omegOption.compare(argv[i])) options.omega        = atof(argv[i+1]);
+
+        if (!modeOption.compare(argv[i]))
+        {
+            string mode(argv[i+1]);
+            if      (mode == "jacobi") options.sweepMode = SweepMode::JACOBI;
+            else if (mode == "gs")     options.sweepMode = SweepMode::GAUSS_SEIDEL;
+            else if (mode == "sor")    options.sweepMode = SweepMode::SOR;
+            else throw bad_option("Unknown sweep mode \"" + mode + "\" (use jacobi, gs or sor).");
+            modeGiven = true;
+        }
+
+        if (!accelOption.compare(argv[i]))
+        {
+            string accel(argv[i+1]);
+            if      (accel == "none")     options.acceleration = Acceleration::NONE;
+            else if (accel == "anderson") options.acceleration = Acceleration::ANDERSON;
+            else if (accel == "aitken")   options.acceleration = Acceleration::AITKEN;
+            else throw bad_option("Unknown acceleration \"" + accel + "\" (use none, anderson or aitken).");
+        }
+        if (!deptOption.compare(argv[i])) options.andersonDepth = atoi(argv[i+1]);
+
+        if (!solvOption.compare(argv[i]))
+        {
+            string solver(argv[i+1]);
+            if      (solver == "iterate")                        options.solver = SolverKind::ITERATE;
+            else if (solver == "krylov" || solver == "bicgstab") options.solver = SolverKind::BICGSTAB;
+            else if (solver == "gmres")                          options.solver = SolverKind::GMRES;
+            else if (solver == "scc")                            options.solver = SolverKind::COMPONENTS;
+            else if (solver == "multilevel")                     options.solver = SolverKind::MULTILEVEL;
+            else throw bad_option("Unknown solver \"" + solver + "\" (use iterate, krylov, bicgstab, gmres, scc or multilevel).");
+        }
+        if (!whatOption.compare(argv[i])) options.whatIfFile     = argv[i+1];
+        if (!baseOption.compare(argv[i])) options.basePricesFile = argv[i+1];
+        if (!warmOption.compare(argv[i])) options.warmStartFile  = argv[i+1];
+        if (!resoOption.compare(argv[i])) options.resources      = true;
+        if (!relTOption.compare(argv[i])) options.relativeTolerance = atof(argv[i+1]);
+        if (!resTOption.compare(argv[i])) options.residualTolerance = atof(argv[i+1]);
+        if (!profOption.compare(argv[i])) options.profileFile       = argv[i+1];
+        if (!binOption.compare(argv[i]))  options.binaryOutput      = true;
+        if (!servOption.compare(argv[i])) options.serveSocket       = argv[i+1];
+        if (!floatOption.compare(argv[i])) options.floatCoeffs      = true;
+        if (!actvOption.compare(argv[i]))  options.activeSet        = true;
+        if (!asynOption.compare(argv[i]))  options.asyncRelaxation  = true;
+        if (!sectOption.compare(argv[i]))  options.sectorMapFile    = argv[i+1];
+        if (!qntyOption.compare(argv[i]))  options.demandFile       = argv[i+1];
+        if (!scenOption.compare(argv[i]))  options.scenarioFile     = argv[i+1];
+        if (!reorOption.compare(argv[i]))
+        {
+            string reordering(argv[i+1]);
+            if      (reordering == "none")        options.reorder = Reordering::NONE;
+            else if (reordering == "rcm")         options.reorder = Reordering::RCM;
+            else if (reordering == "communities") options.reorder = Reordering::COMMUNITIES;
+            else throw bad_option("Unknown reordering \"" + reordering + "\" (use none, rcm or communities).");
+        }
+        if (!oocOption.compare(argv[i]))
+        {
+            long int blockMB = atol(argv[i+1]);
+            if (blockMB < 1) throw bad_option("--out-of-core needs a block size of at least 1 MB.");
+            options.outOfCoreMB = blockMB;
+        }
+        if (!kernOption.compare(argv[i]))
+        {
+            string kernel(argv[i+1]);
+            if      (kernel == "auto")   options.kernel = SweepKernel::AUTO;
+            else if (kernel == "csr")    options.kernel = SweepKernel::CSR;
+            else if (kernel == "scalar") options.kernel = SweepKernel::SCALAR;
+            else if (kernel == "avx2")   options.kernel = SweepKernel::AVX2;
+            else if (kernel == "avx512") options.kernel = SweepKernel::AVX512;
+            else throw bad_option("Unknown sweep kernel \"" + kernel + "\" (use auto, csr, scalar, avx2 or avx512).");
+        }
+        if (!precOption2.compare(argv[i]))
+        {
+            string preconditioner(argv[i+1]);
+            if      (preconditioner == "none")   options.preconditioner = Preconditioner::NONE;
+            else if (preconditioner == "jacobi") options.preconditioner = Preconditioner::JACOBI;
+            else if (preconditioner == "ilu0")   options.preconditioner = Preconditioner::ILU0;
+            else throw bad_option("Unknown preconditioner \"" + preconditioner + "\" (use none, jacobi or ilu0).");
+        }
     }
 
+    // a relaxation factor on its own means SOR
+    if (options.omega != 1.0 && !modeGiven) options.sweepMode = SweepMode::SOR;
+    // and the multilevel solver smooths with Gauss-Seidel unless told otherwise
+    else if (options.solver == SolverKind::MULTILEVEL && !modeGiven) options.sweepMode = SweepMode::GAUSS_SEIDEL;
+    if (options.sweepMode == SweepMode::SOR && options.omega == 1.0) options.omega = 1.2;
+    checkModeOptions(options);
+
     // check for errors
-    if (!fileLocation)
+    if (!options.fileLocation)
     {
         printHelp(argv[0]);
         throw bad_file();
     }
-    if (!precision && !iterations) 
-    {
-        printHelp(argv[0]);
-        throw ambiguous_halting_point();
-    }
-    if (precision && iterations) 
-    {
-        printHelp(argv[0]);
-        throw ambiguous_halting_point();
-    }
+    if (options.compiledFile) return false;      // compiling doesn't need a halting point
+
+    checkHaltingPoints(options);      // main prints the help for it
 
     return false;
 };
 
 
-// TODO: implement threading for file loading
-// load the input-output table into an instance of std::unordered_map
-bool loadIOTable(const char* fileLoc, 
-                 unordered_map<ProdInputPair,double>& ioTable)
+// parses the lines of one newline-aligned chunk of the table file into entries,
+// without allocating anything besides the output vector
+void parseTableChunk(const char* chunkBegin, 
+                     const char* chunkEnd, 
+                     vector<TableEntry>& entries)
 {
-    ifstream fin(fileLoc, ios::in);
-    ProdInputPair PIpair{0,0};
-    string file_line(""); 
-    double ioQuant{0};               // the actual input or output value
-
-    if (!fin.good()) throw bad_file();
-
-    cout << "\rLoading data..." << endl;
-    while (!fin.eof())
+    const char* cursor = chunkBegin;
+    while (cursor < chunkEnd)
     {
-        getline(fin, file_line, '\n');
+        const char* lineEnd = (const char*) memchr(cursor, '\n', chunkEnd - cursor);
+        if (!lineEnd) lineEnd = chunkEnd;
 
-        if (file_line != "")
+        // skip blank lines (and leading whitespace, as stol/stod used to)
+        while (cursor < lineEnd && isspace((unsigned char) *cursor)) cursor++;
+        if (cursor == lineEnd)
         {
-            PIpair.product = stol(file_line.substr(0, file_line.find(",")));
-            PIpair.input = stol(file_line.substr(file_line.find(",")+1, file_line.find(" ")));
+            cursor = lineEnd + 1;
+            continue;
+        }
 
-            ioQuant = stod(file_line.substr(file_line.find(" "), file_line.back()));
-            
-            ioTable[PIpair] = ioQuant;
+        TableEntry entry{0, 0, 0};
+        const char* parsePoint = cursor;
+        auto product = from_chars(parsePoint, lineEnd, entry.product);
+        bool parsed  = product.ec == errc() && product.ptr < lineEnd && *product.ptr == ',';
+
+        if (parsed)
+        {
+            auto input = from_chars(product.ptr + 1, lineEnd, entry.input);
+            parsePoint = input.ptr;
+            parsed     = input.ec == errc();
+        }
+        if (parsed)
+        {
+            while (parsePoint < lineEnd && isspace((unsigned char) *parsePoint)) parsePoint++;
+            auto quantity = from_chars(parsePoint, lineEnd, entry.quantity);
+            parsed        = quantity.ec == errc();
+        }
+        if (!parsed)
+        {
+            throw malformed_table("Unreadable line in table file: \"" 
+                                  + string(cursor, lineEnd) + "\"");
         }
-    }
 
-    fin.close();
-    return true;
+        entries.push_back(entry);
+        cursor = lineEnd + 1;
+    }
 }
 
 
-// writes for CSV format (with header)
-void savePricesToFile(unordered_map<long int, double>& prices, const char* outputFile)
+// Load the input-output table as a list of entries, in file order.
+// The file is memory-mapped and split into newline-aligned chunks,
+// which are parsed on separate threads and then joined back together.
+bool loadIOTable(const char* fileLoc, 
+                 vector<TableEntry>& entries)
 {
-    ofstream fout(outputFile, ios::out);
-    cout << "\nSaving data..." << endl;
+    const size_t MIN_CHUNK_BYTES = 1 << 20;   // not worth a thread below this
+
+    MappedFile tableFile(fileLoc);
+    entries.clear();
 
-    try
+    cout << "\rLoading data..." << endl;
+    if (tableFile.size == 0) return true;
+
+    size_t threadCount = max(1u, thread::hardware_concurrency());
+    threadCount = min(threadCount, tableFile.size / MIN_CHUNK_BYTES + 1);
+
+    // chunk boundaries, each moved forward to just past a newline
+    const char* fileEnd = tableFile.data + tableFile.size;
+    vector<const char*> bounds{tableFile.data};
+    for (size_t t = 1; t < threadCount; t++)
     {
-        if (!fout.good()) 
+        const char* bound = tableFile.data + t * (tableFile.size / threadCount);
+        if (bound < bounds.back()) bound = bounds.back();
+
+        const char* newline = (const char*) memchr(bound, '\n', fileEnd - bound);
+        bounds.push_back(newline ? newline + 1 : fileEnd);
+    }
+    bounds.push_back(fileEnd);
+
+    vector<vector<TableEntry>> chunkEntries(threadCount);
+    vector<exception_ptr>      chunkErrors(threadCount);
+    vector<thread>             loaders;
+    for (size_t t = 0; t < threadCount; t++)
+    {
+        loaders.emplace_back([&, t]()
         {
-            fout.close();
-            throw std::invalid_argument("File cannot be written to.");
-        }
+            try
+            {
+                // rough guess of ~24 bytes per line, to avoid most regrowth
+                chunkEntries[t].reserve((bounds[t+1] - bounds[t]) / 24);
+                parseTableChunk(bounds[t], bounds[t+1], chunkEntries[t]);
+            }
+            catch (...)
+            {
+                chunkErrors[t] = current_exception();
+            }
+        });
+    }
+    for (thread& loader : loaders) loader.join();
+
+    for (const exception_ptr& error : chunkErrors)
+    {
+        if (error) rethrow_exception(error);
     }
-    catch (const std::invalid_argument& ia) 
+
+    // merge, keeping file order so that repeated entries still resolve the same way
+    size_t total{0};
+    for (const auto& chunk : chunkEntries) total += chunk.size();
+    entries.reserve(total);
+    for (auto& chunk : chunkEntries)
     {
-        cerr << ia.what() << endl << endl;
+        entries.insert(entries.end(), chunk.begin(), chunk.end());
+        vector<TableEntry>().swap(chunk);
     }
 
-    fout << "ProductUPC,Price" << endl;
-    for (auto itr = prices.begin(); itr != prices.end(); ++itr)
+    return true;
+}
+
+
+// load the input-output table into an instance of std::unordered_map
+bool loadIOTable(const char* fileLoc, 
+                 unordered_map<ProdInputPair,double>& ioTable)
+{
+    vector<TableEntry> entries;
+    loadIOTable(fileLoc, entries);
+
+    ioTable.reserve(entries.size());
+    for (const TableEntry& entry : entries)
     {
-        fout << itr->first << "," << itr->second << endl;
+        ioTable[{entry.product, entry.input}] = entry.quantity;
     }
-    
-    cout << "Prices data saved to: " << outputFile << endl << endl;
-}   
+
+    return true;
+}
 
 
 // for programmer validation that the data was properly retrieved 
@@ -282,12 +850,3 @@ void printKeys(unordered_map<ProdInputPair,double>* ioTable)
         keyCount++;
     }
 }
-
-
-void printPrices(unordered_map<long int,double>& prices)
-{
-    for (auto iter = prices.begin(); iter != prices.end(); ++iter)
-    {
-        cout << iter->first << ": " << iter->second << " lh/unit" << endl;
-    }
-}
\ No newline at end of file
@@ -2,192 +2,633 @@
 // adapted to the number of the cores on the machine running it
 
 #include "ioTableAnalysis.hpp"
-#include <thread>
+#include "priceEngine.hpp"
+#include "compiledTable.hpp"
+#include "accelerator.hpp"
+#include "krylovSolver.hpp"
+#include "sccSolver.hpp"
+#include "whatIf.hpp"
+#include "sweepPool.hpp"
+#include "sellKernel.hpp"
+#include "resourceSolver.hpp"
+#include "runProfile.hpp"
+#include "priceServer.hpp"
+#include "outOfCore.hpp"
+#include "mixedPrecision.hpp"
+#include "reorder.hpp"
+#include "activeSet.hpp"
+#include "asyncRelaxation.hpp"
+#include "multilevelSolver.hpp"
+#include "quantitySolver.hpp"
+#include "scenarioBatch.hpp"
 using namespace std;
 
-mutex theMutex;
-const unsigned int CORE_COUNT = thread::hardware_concurrency();
+const unsigned int CORE_COUNT = max(1u, thread::hardware_concurrency());
+
+// Block Gauss-Seidel/SOR sweep: each thread updates its own rows in place,
+// in order, but reads every other thread's rows from the previous sweep.
+// The two buffers trade roles every sweep: readPrices is only read during
+// the sweep, and each thread first copies its own slice of it into
+// writePrices and then relaxes that slice in place, so threads never touch
+// a price another thread is writing. Returns the change of the whole sweep.
+// Between threads this is a Jacobi sweep, which over-relaxation inside
+// each thread's rows can make diverge, so main caps omega at 1 whenever
+// there's more than one core.
+SweepChange parallelSorSweep(SweepPool&            pool,
+                             const PriceEngine&    engine,
+                             const vector<double>& selfCoeffs,
+                             const vector<double>& readPrices,
+                             vector<double>&       writePrices,
+                             double                omega)
+{
+    vector<ThreadChange> changes(pool.size());
+
+    pool.run([&](size_t t, size_t firstRow, size_t lastRow)
+    {
+        copy(readPrices.begin() + firstRow, readPrices.begin() + lastRow, writePrices.begin() + firstRow);
+        changes[t].value = sorSweep(engine, selfCoeffs, writePrices, readPrices, firstRow, lastRow, omega);
+    });
 
-// This function checks whether two numbers are equal within the given precision
-// (number of decimal points)
-bool precisionReached(unordered_map<long int, double>& prevIterPrices,
-                      unordered_map<long int, double>& currIterPrices,
-                      const int precision)
+    return mergeChanges(changes);
+}
+
+
+// These functions, calcPricesConstIter (1) and calcPricesPrec (2) calculate prices, 
+// starting from and returning through the dense prices vector (indexed like engine.upcs).
+// They follow Cockshott and Cottrell's algorithm as laid out in Chapter 3 of
+// Toward a New Socialism (1993), but have different stopping points.
+// In Gauss-Seidel/SOR mode each thread relaxes its own rows in place (see
+// parallelSorSweep), which is plain Gauss-Seidel/SOR when there's one core.
+
+// (1) This implementation stops after a given number of iterations has bee reached
+void calcPricesConstIter(const PriceEngine& engine,
+                         vector<double>& prices,
+                         const RunOptions& options)
 {
-    if (currIterPrices.empty()) return false;
+    // prices comes in holding the starting point (see startingPrices):
+    // direct labor only, unless warm-started from an earlier solve
+    const int iterations = options.iterations;
+    vector<double> prevIterPrices(prices);
+
+    vector<double> selfCoeffs;
+    if (options.sweepMode != SweepMode::JACOBI) selfCoeffs = selfCoefficients(engine);
+
+    // constant-iteration algorithm
+    SweepPool pool(engine, CORE_COUNT);
+    cout << "\n\nNow running iterations." << endl;
+    cout << "Working on " << pool.size() << " cores" << endl << endl;
 
-    double precisionUnit = pow(10, -precision); 
-    for (const auto &[productKey, price] : currIterPrices)
+    SellMatrix sell;
+    if (options.sweepMode == SweepMode::JACOBI)
     {
-        if (abs(price - prevIterPrices.at(productKey)) > precisionUnit) return false;
+        buildSellMatrix(engine, pool.partition(), options.kernel, sell);
+        printSellMatrix(sell, engine);
     }
 
-    return true;
+    for (int i = 0; i < iterations; i++)
+    {
+        {
+            SweepTimer timer;
+            if (options.sweepMode == SweepMode::JACOBI) 
+            {
+                parallelSweep(pool, engine, sell, prevIterPrices, prices);
+            }
+            else
+            {
+                parallelSorSweep(pool, engine, selfCoeffs, prevIterPrices, prices, options.omega);
+            }
+        }
+        prevIterPrices.swap(prices);      // save this iteration's prices for the next one
+
+        cout << "iteration " << i+1 << " of " << iterations << " complete" << endl;
+    }
+
+    prices.swap(prevIterPrices);          // the last sweep's result
 }
 
 
-// function for threads
-void calcPriceWorker(unordered_map<ProdInputPair,double>& ioTable,
-                     unordered_map<long, double>& prevIterPrices,
-                     unordered_map<long, double>& prices,
-                     // to make sure each thread shares the same iterator
-                     unordered_map<ProdInputPair,double>::iterator& ioTableIterator)
+// (2) This implementation stops after a certain precision has been reached
+// (or the relative and residual tolerances, when given). Each thread
+// measures its rows' change as it sweeps them, so there is no separate pass.
+void calcPricesPrec(const PriceEngine& engine,
+                    vector<double>& prices,
+                    const RunOptions& options)
 {
-    while (true)
+    // prices comes in holding the starting point (see startingPrices):
+    // direct labor only, unless warm-started from an earlier solve
+    vector<double> prevIterPrices(engine.productCount());
+
+    vector<double> selfCoeffs;
+    if (options.sweepMode != SweepMode::JACOBI) selfCoeffs = selfCoefficients(engine);
+
+    // precision-based algorithm
+    SweepPool pool(engine, CORE_COUNT);
+    cout << "Now iterating until " << describeTolerances(options) << endl;
+    cout << "Working on " << pool.size() << " cores" << endl;
+
+    SellMatrix sell;
+    if (options.sweepMode == SweepMode::JACOBI)
     {
-        if (ioTableIterator != ioTable.end()) break;
-
-        ProdInputPair PIpair = ioTableIterator->first;
-
-        // no need to consider the output quantity column (irrelevant)
-        // or labor column (already accounted for)
-        if(PIpair.input == 1 || PIpair.input == 0) continue;     
-        
-        // add prevIterPrices cost of the input to the current product's total cost, 
-        // and divide by total units produced to get the per-unit cost of that input
-        double priceAdd = ioTable.at(PIpair) * prevIterPrices.at(PIpair.input);
-        PIpair.input    = 1;
-        priceAdd       /= ioTable.at(PIpair);
-        
-        theMutex.lock();
-        prices.at(PIpair.product) += priceAdd;
-        ++ioTableIterator;
-        theMutex.unlock();
+        buildSellMatrix(engine, pool.partition(), options.kernel, sell);
+        printSellMatrix(sell, engine);
+    }
+    int iterCounter{1};
+    SweepChange change;
+
+    do 
+    {
+        prevIterPrices.swap(prices);     // save last iteration's prices...
+
+        {
+            SweepTimer timer;
+            if (options.sweepMode == SweepMode::JACOBI)
+            {
+                change = parallelSweep(pool, engine, sell, prevIterPrices, prices);
+            }
+            else
+            {
+                change = parallelSorSweep(pool, engine, selfCoeffs, prevIterPrices, prices, options.omega);
+            }
+        }
+
+        cout << "iteration " << iterCounter << " complete" << endl;
+        iterCounter++;
     }
+    while(!profiledToleranceMet(change, options));
+
 }
 
 
-// These functions, calcPricesConstIter (1) and calcPricesPrec (2) calculate prices, 
-// and return a reference to the prices unordered_map.
-// They follow Cockshott and Cottrell's algorithm as laid out in Chapter 3 of
-// Toward a New Socialism (1993), but have different stopping points.
+// Runs the solve through Anderson or Aitken acceleration, with one sweep
+// in the chosen mode as the fixed-point map. With -i the iteration count
+// is the number of sweeps; with -p the stopping test is the same as usual.
+void calcPricesAccelerated(const PriceEngine& engine,
+                           vector<double>& prices,
+                           const RunOptions& options)
+{
+    vector<double> selfCoeffs;
+    if (options.sweepMode != SweepMode::JACOBI) selfCoeffs = selfCoefficients(engine);
 
-// (1) This implementation stops after a given number of iterations has bee reached
-void calcPricesConstIter(unordered_map<ProdInputPair,double>& ioTable,
-                         unordered_map<long, double>& prices,
-                         const int iterations)
+    SweepPool  pool(engine, CORE_COUNT);
+    SellMatrix sell;
+    if (options.sweepMode == SweepMode::JACOBI)
+    {
+        buildSellMatrix(engine, pool.partition(), options.kernel, sell);
+        printSellMatrix(sell, engine);
+    }
+
+    FixedPointMap sweep = [&](const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        if (options.sweepMode == SweepMode::JACOBI) parallelSweep(pool, engine, sell, in, out);
+        else parallelSorSweep(pool, engine, selfCoeffs, in, out, options.omega);
+    };
+
+    cout << "\nNow running accelerated iterations." << endl;
+    cout << "Working on " << pool.size() << " cores" << endl;
+
+    if (options.acceleration == Acceleration::ANDERSON)
+    {
+        andersonSolve(sweep, prices, options.andersonDepth, options);
+    }
+    else
+    {
+        aitkenSolve(sweep, prices, options);
+    }
+}
+
+
+// Solves (I - A) p = l directly with BiCGSTAB or GMRES instead of sweeping.
+// The matrix products run on the pool; the preconditioner and the vector
+// updates stay on the calling thread.
+void calcPricesKrylov(const PriceEngine& engine,
+                      vector<double>& prices,
+                      const RunOptions& options)
 {
-    // initialize previous (in this case, initial) iteration prices list,
-    // using only direct labor
-    unordered_map<long int, double> laborOnlyPrices;
-    unordered_map<long int, double> prevIterPrices;
-    ProdInputPair PIpair{0,0};
-    long int currentProduct{0};
+    SystemMatrix M;
+    buildSystemMatrix(engine, M);
 
-    for (auto iter = ioTable.begin(); iter != ioTable.end(); ++iter)
-    {   
-        if (iter->first.product != currentProduct)                    // to prevent redundant statements
+    SweepPool pool(engine, CORE_COUNT);
+    cout << "Working on " << pool.size() << " cores" << endl;
+    MatrixProduct multiply = [&](const vector<double>& x, vector<double>& y)
+    {
+        pool.run([&](size_t, size_t firstRow, size_t lastRow)
         {
-            currentProduct = iter->first.product;
-            PIpair.product = currentProduct;
-            PIpair.input = 0;
+            systemMultiply(M, x, y, firstRow, lastRow);
+        });
+    };
 
-            laborOnlyPrices[currentProduct] = ioTable.at(PIpair);  // start with the labor value...
+    solvePricesKrylov(engine, M, multiply, prices, options);
+}
 
-            // ...and divide it by quantity produced of that product
-            PIpair.input = 1;
-            laborOnlyPrices[currentProduct] /= ioTable.at(PIpair);
-        }
-    }
 
+// Sweeps with coarse corrections from the aggregated table (-s multilevel,
+// see multilevelSolver.hpp). The sweeps run on the pool, the smoothing ones
+// in the -m mode; the coarse solve stays on the calling thread.
+void calcPricesMultilevel(const PriceEngine& engine,
+                          vector<double>& prices,
+                          const RunOptions& options)
+{
+    vector<double> selfCoeffs;
+    if (options.sweepMode != SweepMode::JACOBI) selfCoeffs = selfCoefficients(engine);
 
-    // constant-iteration algorithm
-    // if iterations==0, this loop and following conditional will be 
-    // skipped and will go to the precision-based iterations.
-    cout << "\n\nNow running iterations." << endl;
-    cout << "Working on " << CORE_COUNT << " cores" << endl << endl;
+    SweepPool  pool(engine, CORE_COUNT);
+    SellMatrix sell;
+    buildSellMatrix(engine, pool.partition(), options.kernel, sell);
+    printSellMatrix(sell, engine);
 
-    prevIterPrices = laborOnlyPrices;
-    prices = laborOnlyPrices;
+    LevelSweep residualSweep = [&](const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        return parallelSweep(pool, engine, sell, in, out);
+    };
+    LevelSweep smoothingSweep = [&](const vector<double>& in, vector<double>& out)
+    {
+        if (options.sweepMode == SweepMode::JACOBI) return residualSweep(in, out);
+        SweepTimer timer;
+        return parallelSorSweep(pool, engine, selfCoeffs, in, out, options.omega);
+    };
+
+    cout << "\nNow running multilevel cycles." << endl;
+    cout << "Working on " << pool.size() << " cores" << endl;
+    printMultilevelResult(multilevelSolve(engine, residualSweep, smoothingSweep, prices, options));
+}
 
-    for (int i = 0; i < iterations; i++)
+
+// components at least this big are swept by the whole pool, not one thread
+const size_t LARGE_COMPONENT_ROWS = 4096;
+
+// Prices the table one strongly connected component at a time, level by
+// level. Small components in a level are independent, so pool threads take
+// them one at a time; a large cycle is instead swept by all threads together,
+// Jacobi-style (each thread computes its share of the new prices, then all
+// of them are written back).
+void calcPricesComponents(const PriceEngine& engine,
+                          vector<double>& prices,
+                          const RunOptions& options)
+{
+    ComponentPlan plan;
+    buildComponentPlan(engine, plan);
+    printComponentPlan(plan);
+
+    vector<double> selfCoeffs = selfCoefficients(engine);
+
+    SweepPool pool(engine, CORE_COUNT);
+    cout << "Working on " << pool.size() << " cores" << endl;
+    vector<vector<double>> scratch(pool.size());
+    vector<double>         blockPrices;
+    vector<ThreadChange>   changes(pool.size());
+    long int cycleSweeps{0};
+
+    for (size_t L = 0; L < plan.levelCount(); L++)
     {
-        thread thread_tracker[CORE_COUNT];
-        auto ioTableIterator = ioTable.begin();
-        for (int i = 0; i < CORE_COUNT; i++)
+        atomic<size_t> nextComponent{plan.levelStart[L]};
+        const size_t   levelEnd = plan.levelStart[L+1];
+
+        pool.run([&](size_t t, size_t, size_t)
+        {
+            for (size_t c = nextComponent++; c < levelEnd; c = nextComponent++)
+            {
+                if (plan.componentSize(c) >= LARGE_COMPONENT_ROWS) continue;
+                solveComponent(engine, plan, selfCoeffs, c, prices, options, scratch[t]);
+            }
+        });
+
+        for (size_t c = plan.levelStart[L]; c < levelEnd; c++)
         {
-            thread_tracker[i] = thread(calcPriceWorker, 
-                                       ref(ioTable), 
-                                       ref(prevIterPrices), 
-                                       ref(prices), 
-                                       ref(ioTableIterator));
+            const size_t rowCount = plan.componentSize(c);
+            if (rowCount < LARGE_COMPONENT_ROWS) continue;
+
+            const uint32_t* rows = plan.rows.data() + plan.componentStart[c];
+            blockPrices.resize(rowCount);
+            int sweeps{0};
+            while (true)
+            {
+                pool.run([&](size_t t, size_t, size_t)
+                {
+                    size_t first = rowCount * t / pool.size(), last = rowCount * (t+1) / pool.size();
+                    SweepChange change;
+                    for (size_t i = first; i < last; i++)
+                    {
+                        uint32_t r = rows[i];
+                        double price = engine.laborOnly[r];
+                        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+                        {
+                            price += engine.coeffs[k] * prices[engine.inputIndex[k]];
+                        }
+                        blockPrices[i] = price;
+                        change.add(prices[r], price);
+                    }
+                    changes[t].value = change;
+                });
+                pool.run([&](size_t t, size_t, size_t)
+                {
+                    size_t first = rowCount * t / pool.size(), last = rowCount * (t+1) / pool.size();
+                    for (size_t i = first; i < last; i++) prices[rows[i]] = blockPrices[i];
+                });
+                sweeps++;
+
+                if (toleranceMet(mergeChanges(changes), options))       break;
+                if (options.iterations && sweeps >= options.iterations) break;
+            }
+            cycleSweeps += sweeps;
         }
+    }
+
+    cout << "Large cycles took " << cycleSweeps << " pool sweeps in total" << endl;
+}
+
+
+// Solves for labor and every other primary resource at once (--resources):
+// Jacobi sweeps over a block of 1 + resourceCount() values per product,
+// each pool thread sweeping its own rows, until -p is met or -i sweeps are
+// done. block receives the result.
+void calcPricesResources(const PriceEngine&    engine,
+                         const vector<double>& laborPrices,
+                         vector<double>&       block,
+                         const RunOptions&     options)
+{
+    vector<double> direct;
+    directResourceBlock(engine, direct);
+    startingResourceBlock(engine, laborPrices, block);
+    vector<double> prevBlock(block.size());
+
+    SweepPool pool(engine, CORE_COUNT);
+    vector<ThreadChange> changes(pool.size());
+    cout << "\nNow running iterations for labor and " << engine.resourceCount() << " other resources." << endl;
+    cout << "Working on " << pool.size() << " cores" << endl;
 
-        for (int i = 0; i < CORE_COUNT; i++)
+    int sweeps{0};
+    while (true)
+    {
+        prevBlock.swap(block);
         {
-            thread_tracker[i].join();
+            SweepTimer timer;
+            pool.run([&](size_t t, size_t firstRow, size_t lastRow)
+            {
+                changes[t].value = jacobiSweepBlock(engine, direct, prevBlock, block, firstRow, lastRow);
+            });
         }
+        sweeps++;
 
-        prevIterPrices = prices;          // save last iteration's prices...
-        prices = laborOnlyPrices;         // ...and start fresh for current iteration
-
-        cout << "iteration " << i+1 << " of " << iterations << " complete" << endl;
+        cout << "iteration " << sweeps << " complete" << endl;
+        if (profiledToleranceMet(mergeChanges(changes), options)) break;
+        if (options.iterations && sweeps >= options.iterations)   break;
     }
 }
 
 
-// (2) This implementation stops after a certain precision has been reached
-void calcPricesPrec(unordered_map<ProdInputPair,double>& ioTable,
-                    unordered_map<long, double>& prices,
-                    const int precision)
+// Jacobi sweeps with the table's inputs streamed from the file instead of
+// held in memory (--out-of-core), until the tolerances are met or -i sweeps
+// are done. The pool splits every block between its threads, by nonzeros,
+// while the next block is being read.
+void calcPricesOutOfCore(const PriceEngine& engine,
+                         vector<double>& prices,
+                         const RunOptions& options)
 {
-    // initialize previous (in this case, initial) iteration prices list,
-    // using only direct labor
-    unordered_map<long int, double> laborOnlyPrices;
-    unordered_map<long int, double> prevIterPrices;
-    ProdInputPair PIpair{0,0};
-    long int currentProduct{0};
+    TableStream stream(options.fileLocation, engine, options.outOfCoreMB);
+    printTableStream(stream, engine);
 
-    for (auto iter = ioTable.begin(); iter != ioTable.end(); ++iter)
-    {   
-        if (iter->first.product != currentProduct)                    // to prevent redundant statements
+    SweepPool pool(engine, CORE_COUNT);
+    vector<ThreadChange> changes(pool.size());
+    BlockSweep sweepBlock = [&](const StreamBlock& block, const vector<double>& in, vector<double>& out)
+    {
+        pool.run([&](size_t t, size_t, size_t)
         {
-            currentProduct = iter->first.product;
-            PIpair.product = currentProduct;
-            PIpair.input = 0;
-
-            laborOnlyPrices[currentProduct] = ioTable.at(PIpair);  // start with the labor value...
-
-            // ...and divide it by quantity produced of that product
-            PIpair.input = 1;
-            laborOnlyPrices[currentProduct] /= ioTable.at(PIpair);
+            changes[t].value = streamedSweep(engine, block, in, out, blockSplit(engine, block, t, pool.size()),
+                                             blockSplit(engine, block, t + 1, pool.size()));
+        });
+        return mergeChanges(changes);
+    };
+
+    cout << "\nNow running out-of-core iterations." << endl;
+    cout << "Working on " << pool.size() << " cores" << endl;
+    vector<double> prevIterPrices(prices.size());
+    int sweeps{0};
+    while (true)
+    {
+        prevIterPrices.swap(prices);
+        SweepChange change;
+        {
+            SweepTimer timer;
+            change = stream.sweep(prevIterPrices, prices, sweepBlock);
         }
+        sweeps++;
+
+        cout << "iteration " << sweeps << " complete" << endl;
+        if (options.stopsOnTolerance() ? profiledToleranceMet(change, options) : sweeps >= options.iterations) break;
     }
+}
 
 
-    // precision-based algorithm
-    cout << "Now iterating until precision == " << precision << endl;
-    cout << "Working on " << CORE_COUNT << " cores" << endl;
-    int iterCounter{1};
+// Jacobi sweeps with float coefficients, refined in double until the
+// tolerances are met (--float, see mixedPrecision.hpp), each thread
+// sweeping its own rows
+void calcPricesFloat(const PriceEngine& engine,
+                     vector<double>& prices,
+                     const RunOptions& options)
+{
+    vector<float> floatCoeffs;
+    buildFloatCoefficients(engine, floatCoeffs);
+    vector<double> labor(engine.laborOnly.begin(), engine.laborOnly.end());
 
-    prices = laborOnlyPrices;
-    do 
+    SweepPool pool(engine, CORE_COUNT);
+    vector<ThreadChange> changes(pool.size());
+
+    FloatSweep sweep = [&](const vector<double>& base, const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        pool.run([&](size_t t, size_t firstRow, size_t lastRow)
+        {
+            changes[t].value = floatSweep(engine, floatCoeffs, base, in, out, firstRow, lastRow);
+        });
+        return mergeChanges(changes);
+    };
+    ExactSweep exactSweep = [&](const vector<double>& in, vector<double>& out)
     {
-        prevIterPrices = prices;     // save last iteration's prices...
-        prices = laborOnlyPrices;    // ...and start fresh for current iteration
+        SweepTimer timer;
+        pool.run([&](size_t t, size_t firstRow, size_t lastRow)
+        {
+            changes[t].value = jacobiSweep(engine, in, out, firstRow, lastRow);
+        });
+        return mergeChanges(changes);
+    };
+
+    cout << "\nNow running iterations with float coefficients." << endl;
+    cout << "Working on " << pool.size() << " cores" << endl;
+    printRefinement(refinedSolve(sweep, exactSweep, labor, prices, options));
+}
+
 
-        thread thread_tracker[CORE_COUNT];
-        auto ioTableIterator = ioTable.begin();
-        for (int i = 0; i < CORE_COUNT; i++)
+// Jacobi sweeps that only recompute the products whose inputs are still
+// moving, with full sweeps to check the tolerances (--active-set, see
+// activeSet.hpp). Full sweeps split the rows as usual; partial sweeps split
+// the active rows evenly between the threads.
+void calcPricesActiveSet(const PriceEngine& engine,
+                         vector<double>& prices,
+                         const RunOptions& options)
+{
+    SweepPool pool(engine, CORE_COUNT);
+    vector<ThreadChange> changes(pool.size());
+
+    FullSweep fullSweep = [&](const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        pool.run([&](size_t t, size_t firstRow, size_t lastRow)
         {
-            thread_tracker[i] = thread(calcPriceWorker, 
-                                       ref(ioTable), 
-                                       ref(prevIterPrices), 
-                                       ref(prices), 
-                                       ref(ioTableIterator));
-        }
+            changes[t].value = jacobiSweep(engine, in, out, firstRow, lastRow);
+        });
+        return mergeChanges(changes);
+    };
+    ActiveSweep activeSweep = [&](const vector<uint32_t>& rows, const vector<double>& in, vector<double>& out)
+    {
+        SweepTimer timer;
+        pool.run([&](size_t t, size_t, size_t)
+        {
+            activeRowsSweep(engine, rows, rows.size() * t / pool.size(), rows.size() * (t+1) / pool.size(), in, out);
+        });
+    };
+
+    cout << "Now iterating on the active set until " << describeTolerances(options) << endl;
+    cout << "Working on " << pool.size() << " cores" << endl;
+    printActiveSet(activeSetSolve(engine, fullSweep, activeSweep, prices, options), engine.productCount());
+}
+
 
-        for (int i = 0; i < CORE_COUNT; i++)
+// Asynchronous relaxation (--async, see asyncRelaxation.hpp): each thread
+// relaxes its own rows without waiting for the others, and a Jacobi sweep
+// checks the tolerances whenever all of them have settled
+void calcPricesAsync(const PriceEngine& engine,
+                     vector<double>& prices,
+                     const RunOptions& options)
+{
+    SweepPool pool(engine, CORE_COUNT);
+    cout << "\nNow relaxing asynchronously." << endl;
+    cout << "Working on " << pool.size() << " cores" << endl;
+    printAsyncResult(asyncSolve(pool, engine, prices, options));
+}
+
+
+// Prices the table and every scenario of --scenarios together (see
+// scenarioBatch.hpp): Jacobi sweeps over a block of 1 + scenarios prices per
+// product, until the tolerances are met or -i sweeps are done. block receives the result.
+void calcPricesScenarios(const PriceEngine&    engine,
+                         const vector<double>& startPrices,
+                         ScenarioSet&          scenarios,
+                         vector<double>&       block,
+                         const RunOptions&     options)
+{
+    loadScenarios(engine, options, scenarios);
+    printScenarioSet(scenarios);
+    startingScenarioBlock(scenarios, startPrices, block);
+    vector<double> prevBlock(block.size());
+
+    SweepPool pool(engine, CORE_COUNT);
+    vector<ThreadChange> changes(pool.size());
+    cout << "\nNow running iterations for the table and " << scenarios.names.size() << " scenarios." << endl;
+    cout << "Working on " << pool.size() << " cores" << endl;
+    int sweeps{0};
+    while (true)
+    {
+        prevBlock.swap(block);
         {
-            thread_tracker[i].join();
+            SweepTimer timer;
+            pool.run([&](size_t t, size_t firstRow, size_t lastRow)
+            {
+                changes[t].value = scenarioSweep(engine, scenarios, prevBlock, block, firstRow, lastRow);
+            });
         }
+        sweeps++;
 
-        //printPrices(currIterPrices);
-        cout << "iteration " << iterCounter << " complete" << endl;
-        iterCounter++;
+        cout << "iteration " << sweeps << " complete" << endl;
+        if (profiledToleranceMet(mergeChanges(changes), options)) break;
+        if (options.iterations && sweeps >= options.iterations)   break;
     }
-    while(!precisionReached(prevIterPrices, prices, precision));
+}
+
+
+// The quantity side of the plan (--quantity, see quantitySolver.hpp): the
+// gross output for the final demand, swept down the table's columns. The
+// pool's row ranges are balanced for the rows, so each thread sweeps a range
+// of columns balanced for the columns instead.
+void calcGrossOutput(const PriceEngine& engine,
+                     vector<double>& block,
+                     const RunOptions& options)
+{
+    SweepPool pool(engine, CORE_COUNT);
+    vector<ThreadChange> changes(pool.size());
+    vector<size_t>       bounds;
 
+    auto sweepOf = [&](const TransposedTable& transposed, const vector<double>& demand)
+    {
+        bounds = partitionColumns(transposed, pool.size());
+        return QuantitySweep([&](const vector<double>& in, vector<double>& out)
+        {
+            SweepTimer timer;
+            pool.run([&](size_t t, size_t, size_t)
+            {
+                changes[t].value = quantitySweep(transposed, demand, in, out, bounds[t], bounds[t+1]);
+            });
+            return mergeChanges(changes);
+        });
+    };
+    cout << "Working on " << pool.size() << " cores" << endl;
+    printQuantityResult(calcQuantities(engine, sweepOf, block, options));
+}
+
+
+// Runs the solve the options ask for, starting from densePrices (or, for
+// --resources, into resourcePrices)
+void calcPrices(PriceEngine&      engine,
+                vector<double>&   densePrices,
+                vector<double>&   resourcePrices,
+                const RunOptions& options)
+{
+    if (options.resources)
+    {
+        calcPricesResources(engine, densePrices, resourcePrices, options);
+    }
+    else if (options.whatIfFile)
+    {
+        calcPricesWhatIf(engine, densePrices, options);
+    }
+    else if (options.outOfCoreMB)
+    {
+        calcPricesOutOfCore(engine, densePrices, options);
+    }
+    else if (options.floatCoeffs)
+    {
+        calcPricesFloat(engine, densePrices, options);
+    }
+    else if (options.activeSet)
+    {
+        calcPricesActiveSet(engine, densePrices, options);
+    }
+    else if (options.asyncRelaxation)
+    {
+        calcPricesAsync(engine, densePrices, options);
+    }
+    else if (options.solver == SolverKind::COMPONENTS)
+    {
+        calcPricesComponents(engine, densePrices, options);
+    }
+    else if (options.solver == SolverKind::MULTILEVEL)
+    {
+        calcPricesMultilevel(engine, densePrices, options);
+    }
+    else if (options.solver != SolverKind::ITERATE)
+    {
+        calcPricesKrylov(engine, densePrices, options);
+    }
+    else if (options.acceleration != Acceleration::NONE) 
+    {
+        calcPricesAccelerated(engine, densePrices, options);
+    }
+    else
+    {
+        if (options.stopsOnTolerance()) calcPricesPrec(engine, densePrices, options);
+        if (options.iterations)         calcPricesConstIter(engine, densePrices, options);
+    }
 }
 
 
@@ -196,15 +637,13 @@ int main(int argc, char* argv[])
 {
     auto start = chrono::high_resolution_clock::now();
 
-    char* fileLoc{nullptr};
-    int precision{0};
-    int iterations{0};
-    char* outputFile{nullptr};
+    RunOptions options;
 
     // crash if there were CLI errors
     try
     {
-        bool helpPrinted = parseCmdOptions(argc, argv, fileLoc, precision, iterations, outputFile);
+        bool helpPrinted = parseCmdOptions(argc, argv, options);
+        if (helpPrinted) return 0;
     }
     catch (const exception& e)
     {
@@ -212,27 +651,141 @@ int main(int argc, char* argv[])
         cerr << e.what() << endl;
         return 0;
     }
+    reserveStdoutForReplies(options);
+    if (options.profileFile) runProfile.start("plecpr-mt", CORE_COUNT);
+
+    // each thread over-relaxes its own rows against the others' old prices,
+    // which can diverge for omega > 1 (see parallelSorSweep)
+    if (CORE_COUNT > 1 && options.omega > 1)
+    {
+        cout << "SOR over-relaxation can diverge across threads; running Gauss-Seidel (omega 1) on "
+             << CORE_COUNT << " cores instead." << endl;
+        options.omega = 1;
+    }
     
 
-    // load table
-    unordered_map<ProdInputPair,double> ioTable;
+    // load table (text or compiled), indexed so the iterations don't need any hashing
+    PriceEngine engine;
+    try
+    {
+        if (options.outOfCoreMB) checkStreamable(options.fileLocation);
+        loadPriceEngine(options.fileLocation, engine);
+        if (options.compiledFile) 
+        {
+            saveCompiledTable(engine, options.compiledFile);
+            return 0;
+        }
+        runProfile.describeTable(engine, options.fileLocation, options.resources ? resourceColumns(engine) : 1);
+    }
+    catch (const bad_file& bf)
+    {
+        cerr << bf.what() << endl;
+        return 0;
+    }
+    catch (const malformed_table& mt)
+    {
+        cerr << mt.what() << endl;
+        return 0;
+    }
+
+    vector<double> densePrices;
+    vector<double> resourcePrices;      // --resources: 1 + resourceCount() values per product
+    vector<double> quantities;          // --quantity: gross output and labor per product
+    vector<double> scenarioPrices;      // --scenarios: 1 + scenarios prices per product
+    ScenarioSet    scenarios;
+    ReorderedTable reordered;           // --reorder: solved in this order, then put back
     try
     {
-        bool ioTableLoaded = loadIOTable(fileLoc, ioTable);
+        {
+            PhaseTimer timer("start");
+            startingPrices(engine, options, densePrices);
+        }
+        if (options.reorder != Reordering::NONE)
+        {
+            PhaseTimer timer("reorder");
+            reorderTable(engine, options.reorder, reordered);
+            toReorderedOrder(reordered, densePrices);
+        }
+
+        {
+            PhaseTimer timer("solve");
+            if      (options.demandFile)   calcGrossOutput(engine, quantities, options);
+            else if (options.scenarioFile) calcPricesScenarios(engine, densePrices, scenarios, scenarioPrices, options);
+            else calcPrices(options.reorder != Reordering::NONE ? reordered.engine : engine, densePrices, resourcePrices, options);
+        }
+        if (options.reorder != Reordering::NONE)
+        {
+            toTableOrder(reordered, densePrices);
+            if (options.resources) toTableOrder(reordered, resourcePrices, resourceColumns(engine));
+        }
+        checkFinitePrices(options.demandFile   ? quantities
+                        : options.scenarioFile ? scenarioPrices
+                        : options.resources    ? resourcePrices
+                                               : densePrices);
+    }
+    catch (const malformed_table& mt)
+    {
+        cerr << mt.what() << endl;
+        return 0;
     }
     catch (const bad_file& bf)
     {
         cerr << bf.what() << endl;
         return 0;
     }
+    catch (const diverged& dv)
+    {
+        cerr << dv.what() << endl;
+        return 1;       // no prices to write
+    }
 
+    if (options.serveSocket)
+    {
+        PriceSolve solve = [&resourcePrices](PriceEngine& engine, vector<double>& prices, const RunOptions& options)
+        {
+            calcPrices(engine, prices, resourcePrices, options);
+        };
+        try
+        {
+            servePrices(engine, densePrices, options, solve);
+        }
+        catch (const exception& e)
+        {
+            cerr << e.what() << endl;
+            return 0;
+        }
+    }
 
-    unordered_map<long int, double> prices;
-    if (precision)  calcPricesPrec(ioTable, prices, precision);
-    if (iterations) calcPricesConstIter(ioTable, prices, iterations);
+    {
+        PhaseTimer timer("write");
+        PriceTable table = options.demandFile   ? quantityTable(engine, quantities)
+                         : options.scenarioFile ? scenarioTable(engine, scenarios, scenarioPrices)
+                         : options.resources    ? resourcePriceTable(engine, resourcePrices)
+                                                : priceTable(engine, densePrices);
+        try
+        {
+            if (options.outputFile) savePricesToFile(table, options.outputFile, options.binaryOutput);
+            else if (!options.serveSocket) printPrices(table);
+        }
+        catch (const bad_file& bf)
+        {
+            cerr << bf.what() << endl;
+            return 0;
+        }
+    }
 
-    if (outputFile) savePricesToFile(prices, outputFile);
-    else printPrices(prices);
+    if (options.profileFile)
+    {
+        try
+        {
+            runProfile.saveToFile(options.profileFile);
+        }
+        catch (const bad_file& bf)
+        {
+            cerr << bf.what() << endl;
+            return 0;
+        }
+    }
 
     auto stop     = chrono::high_resolution_clock::now();
     auto duration = chrono::duration_cast<chrono::milliseconds>(stop-start);
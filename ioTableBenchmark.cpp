@@ -0,0 +1,338 @@
+// This is the driver for benchmarking plecpr and plecpr-mt.
+//
+// For every table size and density asked for, a table is generated (see
+// tableGenerator.hpp) and each phase of a solve is timed on it, running the
+// same functions the two executables do: parsing the text table, building
+// the engine, compiling and mapping it, one Jacobi sweep on a single thread
+// (plecpr) and on the sweep pool (plecpr-mt), and writing the prices. The
+// results are written as JSON, one object per table.
+
+#include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include "compiledTable.hpp"
+#include "sweepPool.hpp"
+#include "sellKernel.hpp"
+#include "tableGenerator.hpp"
+#include <filesystem>
+using namespace std;
+
+
+class BenchmarkOptions
+{
+    public:
+        vector<uint64_t> sizes{1000, 10000, 100000};
+        vector<double>   inputs{5, 20};
+        int              iterations{20};     // sweeps timed per executable
+        unsigned int     threads{max(1u, thread::hardware_concurrency())};
+        SweepKernel      kernel{SweepKernel::CSR};
+        GeneratorOptions table;              // everything but size and density
+        string           outputFile{"benchmark.json"};
+        string           tableDirectory{filesystem::temp_directory_path().string()};
+};
+
+// the timings of one table, in milliseconds (sweeps are per sweep)
+class BenchmarkResult
+{
+    public:
+        uint64_t products{0};
+        double   inputsPerProduct{0};
+        size_t   nonzeros{0};
+        double   generateMs{0};
+        double   loadMs{0};
+        double   buildMs{0};
+        double   compileMs{0};
+        double   mapMs{0};
+        double   sweepMs{0};
+        double   sweepMtMs{0};
+        double   writeMs{0};
+};
+
+
+void printBenchmarkHelp(char* executableName)
+{
+    cout << "\nUsage: " << executableName << " [--sizes n,n,...] [--inputs k,k,...] [-i iterations] [-o output_file]" << endl << endl;
+    cout << "Options:" << endl << endl;
+    cout << "    --sizes n,n,...      Table sizes to benchmark, in products (defaults to 1000,10000,100000). " << endl << endl;
+    cout << "    --inputs k,k,...     Average inputs per product to benchmark each size at (defaults to 5,20). " << endl << endl;
+    cout << "    -i iterations        Jacobi sweeps timed per executable and table (defaults to 20). " << endl << endl;
+    cout << "    -t threads           Threads of the plecpr-mt sweeps (defaults to the core count). " << endl << endl;
+    cout << "    --kernel kernel      Sweep kernel, as for plecpr (defaults to csr). " << endl << endl;
+    cout << "    --seed, --alpha, --sectors, --intra, --radius" << endl;
+    cout << "                         Shape of the generated tables, as for plecpr-gen. " << endl << endl;
+    cout << "    --dir directory      Where the tables and prices are written while they are timed" << endl;
+    cout << "                         (defaults to the temporary directory; they are deleted after). " << endl << endl;
+    cout << "    -o output_file       Path of the JSON results (defaults to benchmark.json). " << endl << endl;
+    cout << "    -h                   Prints this help message. " << endl << endl;
+}
+
+
+// "1000,10000" -> {1000, 10000}
+template <typename Number>
+vector<Number> parseList(const char* list)
+{
+    vector<Number> values;
+    stringstream   stream(list);
+    string         item;
+    while (getline(stream, item, ','))
+    {
+        if (!item.empty()) values.push_back((Number) atof(item.c_str()));
+    }
+    return values;
+}
+
+
+// returns whether the help message was printed
+bool parseBenchmarkOptions(const int         argc,
+                           char**            argv,
+                           BenchmarkOptions& options)
+{
+    string helpOption("-h");
+    string sizeOption("--sizes");
+    string inptOption("--inputs");
+    string iterOption("-i");
+    string thrdOption("-t");
+    string kernOption("--kernel");
+    string seedOption("--seed");
+    string alphOption("--alpha");
+    string sectOption("--sectors");
+    string intrOption("--intra");
+    string radiOption("--radius");
+    string dirOption("--dir");
+    string outpOption("-o");
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!helpOption.compare(argv[i]))
+        {
+            printBenchmarkHelp(argv[0]);
+            return true;
+        }
+        if (i + 1 == argc) break;
+
+        if (!sizeOption.compare(argv[i])) options.sizes                = parseList<uint64_t>(argv[i+1]);
+        if (!inptOption.compare(argv[i])) options.inputs               = parseList<double>(argv[i+1]);
+        if (!iterOption.compare(argv[i])) options.iterations           = atoi(argv[i+1]);
+        if (!thrdOption.compare(argv[i])) options.threads              = atoi(argv[i+1]);
+        if (!seedOption.compare(argv[i])) options.table.seed           = strtoull(argv[i+1], nullptr, 10);
+        if (!alphOption.compare(argv[i])) options.table.powerLaw       = atof(argv[i+1]);
+        if (!sectOption.compare(argv[i])) options.table.sectors        = strtoull(argv[i+1], nullptr, 10);
+        if (!intrOption.compare(argv[i])) options.table.withinSector   = atof(argv[i+1]);
+        if (!radiOption.compare(argv[i])) options.table.spectralRadius = atof(argv[i+1]);
+        if (!dirOption.compare(argv[i]))  options.tableDirectory       = argv[i+1];
+        if (!outpOption.compare(argv[i])) options.outputFile           = argv[i+1];
+        if (!kernOption.compare(argv[i]))
+        {
+            string kernel(argv[i+1]);
+            if      (kernel == "auto")   options.kernel = SweepKernel::AUTO;
+            else if (kernel == "csr")    options.kernel = SweepKernel::CSR;
+            else if (kernel == "scalar") options.kernel = SweepKernel::SCALAR;
+            else if (kernel == "avx2")   options.kernel = SweepKernel::AVX2;
+            else if (kernel == "avx512") options.kernel = SweepKernel::AVX512;
+            else throw bad_option("Unknown sweep kernel \"" + kernel + "\" (use auto, csr, scalar, avx2 or avx512).");
+        }
+    }
+
+    if (options.sizes.empty() || options.inputs.empty()) throw bad_option("--sizes and --inputs need at least one value each.");
+    if (options.iterations < 1) throw bad_option("-i must be at least 1.");
+    if (options.threads < 1)    throw bad_option("-t must be at least 1.");
+
+    // every table has to be valid with the shape options given
+    for (uint64_t size : options.sizes)
+    {
+        for (double inputs : options.inputs)
+        {
+            GeneratorOptions table = options.table;
+            table.products         = size;
+            table.inputsPerProduct = inputs;
+            table.sectors          = min(table.sectors, size);
+            checkGeneratorOptions(table);
+        }
+    }
+    return false;
+}
+
+
+
+
+/*///////////////////////
+   BENCHMARK FUNCTIONS
+///////////////////////*/
+
+
+// milliseconds since start
+double millisecondsSince(chrono::high_resolution_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+
+BenchmarkResult benchmarkTable(const BenchmarkOptions& options, uint64_t products, double inputs)
+{
+    const string tableFile    = options.tableDirectory + "/plecpr-bench-" + to_string(products) + ".txt";
+    const string compiledFile = options.tableDirectory + "/plecpr-bench-" + to_string(products) + ".bin";
+    const string pricesFile   = options.tableDirectory + "/plecpr-bench-" + to_string(products) + ".csv";
+
+    BenchmarkResult result;
+    result.products         = products;
+    result.inputsPerProduct = inputs;
+
+    GeneratorOptions table = options.table;
+    table.products         = products;
+    table.inputsPerProduct = inputs;
+    table.sectors          = min(table.sectors, products);
+
+    auto start = chrono::high_resolution_clock::now();
+    generateIOTable(table, tableFile.c_str());
+    result.generateMs = millisecondsSince(start);
+
+    vector<TableEntry> entries;
+    start = chrono::high_resolution_clock::now();
+    loadIOTable(tableFile.c_str(), entries);
+    result.loadMs = millisecondsSince(start);
+
+    PriceEngine built;
+    start = chrono::high_resolution_clock::now();
+    buildPriceEngine(entries, built);
+    result.buildMs  = millisecondsSince(start);
+    result.nonzeros = built.nonzeroCount();
+    entries = vector<TableEntry>();
+
+    start = chrono::high_resolution_clock::now();
+    saveCompiledTable(built, compiledFile.c_str());
+    result.compileMs = millisecondsSince(start);
+    built = PriceEngine();
+
+    // the sweeps run on the mapped table, as plecpr does with a compiled one
+    PriceEngine engine;
+    start = chrono::high_resolution_clock::now();
+    openCompiledTable(compiledFile.c_str(), engine);
+    result.mapMs = millisecondsSince(start);
+
+    vector<double> prices(engine.laborOnly.begin(), engine.laborOnly.end());
+    vector<double> prevIterPrices(prices);
+
+    // plecpr
+    {
+        SellMatrix sell;
+        buildSellMatrix(engine, {0, engine.productCount()}, options.kernel, sell);
+
+        start = chrono::high_resolution_clock::now();
+        for (int i = 0; i < options.iterations; i++)
+        {
+            kernelSweep(engine, sell, prevIterPrices, prices, 0);
+            prevIterPrices.swap(prices);
+        }
+        result.sweepMs = millisecondsSince(start) / options.iterations;
+    }
+
+    // plecpr-mt
+    {
+        SweepPool  pool(engine, options.threads);
+        SellMatrix sell;
+        buildSellMatrix(engine, pool.partition(), options.kernel, sell);
+
+        start = chrono::high_resolution_clock::now();
+        for (int i = 0; i < options.iterations; i++)
+        {
+            parallelSweep(pool, engine, sell, prevIterPrices, prices);
+            prevIterPrices.swap(prices);
+        }
+        result.sweepMtMs = millisecondsSince(start) / options.iterations;
+    }
+
+    start = chrono::high_resolution_clock::now();
+    savePricesToFile(priceTable(engine, prevIterPrices), pricesFile.c_str());
+    result.writeMs = millisecondsSince(start);
+
+    engine = PriceEngine();
+    filesystem::remove(tableFile);
+    filesystem::remove(compiledFile);
+    filesystem::remove(pricesFile);
+    return result;
+}
+
+
+void saveBenchmarkResults(const BenchmarkOptions&        options,
+                          const vector<BenchmarkResult>& results)
+{
+    ofstream fout(options.outputFile, ios::out);
+    if (!fout.good()) throw bad_file();
+
+    fout << "{" << endl;
+    fout << "  \"threads\": " << options.threads << "," << endl;
+    fout << "  \"kernel\": \"" << kernelName(chooseKernel(options.kernel)) << "\"," << endl;
+    fout << "  \"iterations\": " << options.iterations << "," << endl;
+    fout << "  \"seed\": " << options.table.seed << "," << endl;
+    fout << "  \"alpha\": " << options.table.powerLaw << "," << endl;
+    fout << "  \"sectors\": " << options.table.sectors << "," << endl;
+    fout << "  \"radius\": " << options.table.spectralRadius << "," << endl;
+    fout << "  \"results\": [" << endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult& result = results[i];
+        fout << "    {\"products\": " << result.products
+             << ", \"inputs_per_product\": " << result.inputsPerProduct
+             << ", \"nonzeros\": " << result.nonzeros
+             << ", \"generate_ms\": " << result.generateMs
+             << ", \"load_ms\": " << result.loadMs
+             << ", \"build_ms\": " << result.buildMs
+             << ", \"compile_ms\": " << result.compileMs
+             << ", \"map_ms\": " << result.mapMs
+             << ", \"sweep_ms\": {\"plecpr\": " << result.sweepMs << ", \"plecpr-mt\": " << result.sweepMtMs << "}"
+             << ", \"write_ms\": " << result.writeMs
+             << "}" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    fout << "  ]" << endl;
+    fout << "}" << endl;
+
+    cout << "Benchmark results saved to: " << options.outputFile << endl << endl;
+}
+
+
+void printBenchmarkResult(const BenchmarkResult& result)
+{
+    cout << setprecision(4)
+         << result.products << " products, " << result.nonzeros << " inputs: "
+         << "generate " << result.generateMs << " ms, load " << result.loadMs << " ms, build " << result.buildMs
+         << " ms, compile " << result.compileMs << " ms, map " << result.mapMs << " ms, sweep " << result.sweepMs
+         << " ms (plecpr) / " << result.sweepMtMs << " ms (plecpr-mt), write " << result.writeMs << " ms" << endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+    try
+    {
+        bool helpPrinted = parseBenchmarkOptions(argc, argv, options);
+        if (helpPrinted) return 0;
+    }
+    catch (const exception& e)
+    {
+        printBenchmarkHelp(argv[0]);
+        cerr << e.what() << endl;
+        return 0;
+    }
+
+    vector<BenchmarkResult> results;
+    try
+    {
+        for (uint64_t size : options.sizes)
+        {
+            for (double inputs : options.inputs)
+            {
+                cout << "\nBenchmarking " << size << " products, " << inputs << " inputs each..." << endl;
+                results.push_back(benchmarkTable(options, size, inputs));
+                printBenchmarkResult(results.back());
+            }
+        }
+        saveBenchmarkResults(options, results);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        return 0;
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+// This is the driver for generating synthetic input-output tables
+// (see tableGenerator.hpp for the shape of the tables)
+
+#include "ioTableAnalysis.hpp"
+#include "tableGenerator.hpp"
+using namespace std;
+
+
+void printGeneratorHelp(char* executableName)
+{
+    cout << "\nUsage: " << executableName << " -n products [-d density | --inputs count] [-o output_file]" << endl << endl;
+    cout << "Options:" << endl << endl;
+    cout << "    -n products          The number of products in the table (defaults to 1000). " << endl << endl;
+    cout << "    --inputs count       [optional] The average number of inputs per product (defaults to 10)." << endl;
+    cout << "                         Every product has at least one. " << endl << endl;
+    cout << "    -d density           [optional] Instead of --inputs, the fraction of the full n x n matrix" << endl;
+    cout << "                         that is nonzero, as with iotable_generator.py. " << endl << endl;
+    cout << "    --seed seed          [optional] Seed for the random numbers (defaults to 1); the same" << endl;
+    cout << "                         seed and options always give the same table. " << endl << endl;
+    cout << "    --alpha exponent     [optional] How unevenly products are used as inputs: the k-th most" << endl;
+    cout << "                         used product of a sector is used k^-alpha times as often as the" << endl;
+    cout << "                         first (defaults to 1; 0 uses every product equally). " << endl << endl;
+    cout << "    --sectors count      [optional] Splits the products into this many sectors (defaults" << endl;
+    cout << "                         to 1). " << endl << endl;
+    cout << "    --intra fraction     [optional] Fraction of each product's inputs bought from its own" << endl;
+    cout << "                         sector when there are several (defaults to 0.8). " << endl << endl;
+    cout << "    --radius radius      [optional] Spectral radius of the coefficient matrix, between 0 and" << endl;
+    cout << "                         1 (defaults to 0.9). Each sweep shrinks the error by about this" << endl;
+    cout << "                         factor, so it sets how many sweeps a given precision takes. " << endl << endl;
+    cout << "    -o output_file       [optional] Path of the table to write (defaults to iotable-<n>.txt). " << endl << endl;
+    cout << "    -h                   Prints this help message. " << endl << endl;
+}
+
+
+// returns whether the help message was printed
+bool parseGeneratorOptions(const int         argc,
+                           char**            argv,
+                           GeneratorOptions& options,
+                           string&           outputFile)
+{
+    string helpOption("-h");
+    string prodOption("-n");
+    string densOption("-d");
+    string inptOption("--inputs");
+    string seedOption("--seed");
+    string alphOption("--alpha");
+    string sectOption("--sectors");
+    string intrOption("--intra");
+    string radiOption("--radius");
+    string outpOption("-o");
+    double density{0};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!helpOption.compare(argv[i]))
+        {
+            printGeneratorHelp(argv[0]);
+            return true;
+        }
+        if (i + 1 == argc) break;
+
+        if (!prodOption.compare(argv[i])) options.products         = strtoull(argv[i+1], nullptr, 10);
+        if (!densOption.compare(argv[i])) density                  = atof(argv[i+1]);
+        if (!inptOption.compare(argv[i])) options.inputsPerProduct = atof(argv[i+1]);
+        if (!seedOption.compare(argv[i])) options.seed             = strtoull(argv[i+1], nullptr, 10);
+        if (!alphOption.compare(argv[i])) options.powerLaw         = atof(argv[i+1]);
+        if (!sectOption.compare(argv[i])) options.sectors          = strtoull(argv[i+1], nullptr, 10);
+        if (!intrOption.compare(argv[i])) options.withinSector     = atof(argv[i+1]);
+        if (!radiOption.compare(argv[i])) options.spectralRadius   = atof(argv[i+1]);
+        if (!outpOption.compare(argv[i])) outputFile               = argv[i+1];
+    }
+
+    if (density < 0 || density > 1) throw bad_option("-d must be between 0 and 1.");
+    if (density > 0) options.inputsPerProduct = density * options.products;
+    checkGeneratorOptions(options);
+
+    if (outputFile.empty()) outputFile = "iotable-" + to_string(options.products) + ".txt";
+    return false;
+}
+
+
+int main(int argc, char* argv[])
+{
+    auto start = chrono::high_resolution_clock::now();
+
+    GeneratorOptions options;
+    string           outputFile;
+    try
+    {
+        bool helpPrinted = parseGeneratorOptions(argc, argv, options, outputFile);
+        if (helpPrinted) return 0;
+    }
+    catch (const exception& e)
+    {
+        printGeneratorHelp(argv[0]);
+        cerr << e.what() << endl;
+        return 0;
+    }
+
+    cout << "\nGenerating " << options.products << " products..." << endl;
+    uint64_t inputLines;
+    try
+    {
+        inputLines = generateIOTable(options, outputFile.c_str());
+    }
+    catch (const bad_file& bf)
+    {
+        cerr << bf.what() << endl;
+        return 0;
+    }
+
+    cout << "Table with " << inputLines << " inputs (" << (double) inputLines / options.products
+         << " per product) saved to: " << outputFile << endl;
+
+    auto stop     = chrono::high_resolution_clock::now();
+    auto duration = chrono::duration_cast<chrono::milliseconds>(stop-start);
+
+    cout << setprecision(5) << "\nTime taken (seconds): " << duration.count()/1000.0 << endl << endl;
+
+    return 0;
+}
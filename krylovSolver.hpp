@@ -0,0 +1,436 @@
+// header file for solving the price system directly with a Krylov method.
+//
+// The fixed point the iteration converges to is the solution of the linear
+// system (I - A) p = l, where A holds the normalized input coefficients and
+// l the direct labor per unit. Instead of sweeping until the prices settle,
+// these solvers attack that system with a preconditioned Krylov method:
+// BiCGSTAB, or restarted GMRES. Both work over the same sparse rows as the
+// sweeps do, so the cost per iteration is about one or two sweeps.
+
+#pragma once
+#include "priceEngine.hpp"
+#include "accelerator.hpp"
+#include <algorithm>
+#include <functional>
+using namespace std;
+
+const size_t GMRES_RESTART = 30;
+
+// the most Krylov iterations a -p solve takes when -i gives no cap, so a
+// solve that stalls still ends (reporting that it didn't converge)
+const int KRYLOV_MAX_ITERATIONS = 10000;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// M = I - A in CSR form, with an explicit diagonal entry in every row
+// (A's own coefficient folded in), which ILU(0) needs
+class SystemMatrix
+{
+    public:
+        vector<uint64_t> rowStart;
+        vector<uint32_t> column;
+        vector<double>   value;
+        vector<uint64_t> diagonal;      // position of each row's diagonal entry
+
+        size_t size() const { return diagonal.size(); }
+};
+
+
+// y = M x on rows [firstRow, lastRow) (threads can split the rows)
+typedef function<void(const vector<double>&, vector<double>&)> MatrixProduct;
+
+// z = K^-1 r for the preconditioner K
+typedef function<void(const vector<double>&, vector<double>&)> PreconditionerSolve;
+
+// what a Krylov solve reports back
+class KrylovResult
+{
+    public:
+        int    iterations{0};
+        double trueResidual{0};     // max |l - (I - A) p| for the returned prices
+        bool   converged{false};
+};
+
+
+
+
+/*///////////////////////
+    MATRIX FUNCTIONS
+///////////////////////*/
+
+
+// Builds M = I - A with each row sorted by column, which the ILU(0)
+// factorization relies on. The engine's rows are usually sorted already,
+// but not once --reorder has renumbered the products.
+void buildSystemMatrix(const PriceEngine& engine, SystemMatrix& M)
+{
+    const size_t n = engine.productCount();
+    M.rowStart.assign(1, 0);
+    M.column.clear();
+    M.value.clear();
+    M.column.reserve(engine.nonzeroCount() + n);
+    M.value.reserve(engine.nonzeroCount() + n);
+    M.diagonal.resize(n);
+
+    vector<pair<uint32_t,double>> row;
+    for (size_t r = 0; r < n; r++)
+    {
+        row.assign(1, {(uint32_t) r, 1.0});
+        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+        {
+            if (engine.inputIndex[k] == r) row[0].second -= engine.coeffs[k];
+            else                           row.push_back({engine.inputIndex[k], -engine.coeffs[k]});
+        }
+        sort(row.begin(), row.end(), [](const pair<uint32_t,double>& a, const pair<uint32_t,double>& b)
+                                     { return a.first < b.first; });
+
+        for (const auto& [column, value] : row)
+        {
+            if (column == r) M.diagonal[r] = M.column.size();
+            M.column.push_back(column);
+            M.value.push_back(value);
+        }
+        M.rowStart.push_back(M.column.size());
+    }
+}
+
+
+void systemMultiply(const SystemMatrix&   M,
+                    const vector<double>& x,
+                    vector<double>&       y,
+                    size_t                firstRow,
+                    size_t                lastRow)
+{
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double sum{0};
+        for (uint64_t k = M.rowStart[r]; k < M.rowStart[r+1]; k++) sum += M.value[k] * x[M.column[k]];
+        y[r] = sum;
+    }
+}
+
+
+// Incomplete LU factorization with no fill-in: L (unit lower) and U share
+// M's sparsity pattern and are stored together in factors.
+void incompleteLU(const SystemMatrix& M, vector<double>& factors)
+{
+    const size_t n = M.size();
+    factors = M.value;
+    vector<int64_t> position(n, -1);      // where column c sits in the current row
+
+    for (size_t r = 0; r < n; r++)
+    {
+        for (uint64_t k = M.rowStart[r]; k < M.rowStart[r+1]; k++) position[M.column[k]] = k;
+
+        for (uint64_t k = M.rowStart[r]; k < M.diagonal[r]; k++)
+        {
+            size_t pivotRow = M.column[k];
+            factors[k] /= factors[M.diagonal[pivotRow]];
+
+            for (uint64_t j = M.diagonal[pivotRow] + 1; j < M.rowStart[pivotRow+1]; j++)
+            {
+                int64_t target = position[M.column[j]];
+                if (target >= 0) factors[target] -= factors[k] * factors[j];
+            }
+        }
+
+        if (factors[M.diagonal[r]] == 0) throw malformed_table("ILU(0) broke down on a zero pivot.");
+        for (uint64_t k = M.rowStart[r]; k < M.rowStart[r+1]; k++) position[M.column[k]] = -1;
+    }
+}
+
+
+// z = (LU)^-1 r by a forward and a backward triangular solve
+void incompleteLUSolve(const SystemMatrix&   M,
+                       const vector<double>& factors,
+                       const vector<double>& r,
+                       vector<double>&       z)
+{
+    const size_t n = M.size();
+    for (size_t row = 0; row < n; row++)
+    {
+        double sum = r[row];
+        for (uint64_t k = M.rowStart[row]; k < M.diagonal[row]; k++) sum -= factors[k] * z[M.column[k]];
+        z[row] = sum;
+    }
+    for (size_t row = n; row-- > 0; )
+    {
+        double sum = z[row];
+        for (uint64_t k = M.diagonal[row] + 1; k < M.rowStart[row+1]; k++) sum -= factors[k] * z[M.column[k]];
+        z[row] = sum / factors[M.diagonal[row]];
+    }
+}
+
+
+// sets up the chosen preconditioner; the returned function keeps what it needs
+PreconditionerSolve makePreconditioner(const SystemMatrix& M, Preconditioner kind)
+{
+    if (kind == Preconditioner::JACOBI)
+    {
+        auto inverseDiagonal = make_shared<vector<double>>(M.size());
+        for (size_t r = 0; r < M.size(); r++) (*inverseDiagonal)[r] = 1.0 / M.value[M.diagonal[r]];
+
+        return [inverseDiagonal](const vector<double>& r, vector<double>& z)
+        {
+            for (size_t i = 0; i < r.size(); i++) z[i] = (*inverseDiagonal)[i] * r[i];
+        };
+    }
+
+    if (kind == Preconditioner::ILU0)
+    {
+        auto factors = make_shared<vector<double>>();
+        incompleteLU(M, *factors);
+
+        return [&M, factors](const vector<double>& r, vector<double>& z)
+        {
+            incompleteLUSolve(M, *factors, r, z);
+        };
+    }
+
+    return [](const vector<double>& r, vector<double>& z) { z = r; };
+}
+
+
+double maxNorm(const vector<double>& v)
+{
+    double norm{0};
+    for (double x : v) norm = max(norm, abs(x));
+    return norm;
+}
+
+
+// residual = b - M x, returning its max norm
+double systemResidual(const MatrixProduct& multiply,
+                      const vector<double>& b,
+                      const vector<double>& x,
+                      vector<double>& residual)
+{
+    multiply(x, residual);
+    for (size_t i = 0; i < b.size(); i++) residual[i] = b[i] - residual[i];
+    return maxNorm(residual);
+}
+
+
+
+
+/*///////////////////////
+      KRYLOV SOLVERS
+///////////////////////*/
+
+
+// Preconditioned BiCGSTAB (van der Vorst, 1992) for M x = b. x holds the
+// starting guess and receives the solution. Stops once the max norm of the
+// residual is at most tolerance, or after maxIterations (if > 0).
+KrylovResult bicgstabSolve(const MatrixProduct&       multiply,
+                           const PreconditionerSolve& precondition,
+                           const vector<double>&      b,
+                           vector<double>&            x,
+                           double                     tolerance,
+                           int                        maxIterations)
+{
+    const size_t n = b.size();
+    KrylovResult result;
+    vector<double> r(n), shadow(n), p(n, 0.0), v(n, 0.0), y(n), s(n), z(n), t(n);
+
+    double residualNorm = systemResidual(multiply, b, x, r);
+    shadow = r;
+    double rho{1}, alpha{1}, omega{1};
+
+    // when the shadow residual goes orthogonal to r or to v, the step can't
+    // be taken: start again from the true residual. Breaking down again
+    // straight after that is a failure.
+    bool restarted{false};
+    auto restart = [&]()
+    {
+        residualNorm = systemResidual(multiply, b, x, r);
+        shadow = r;
+        rho = alpha = omega = 1;
+        fill(p.begin(), p.end(), 0.0);
+        fill(v.begin(), v.end(), 0.0);
+        restarted = true;
+    };
+
+    while (residualNorm > tolerance && (maxIterations <= 0 || result.iterations < maxIterations))
+    {
+        double rhoNext = dotProduct(shadow, r);
+        if (rhoNext == 0)
+        {
+            if (restarted) break;
+            restart();
+            continue;
+        }
+
+        double beta = (rhoNext / rho) * (alpha / omega);
+        rho = rhoNext;
+        for (size_t i = 0; i < n; i++) p[i] = r[i] + beta * (p[i] - omega * v[i]);
+
+        precondition(p, y);
+        multiply(y, v);
+        double shadowV = dotProduct(shadow, v);
+        if (shadowV == 0 || !isfinite(shadowV))
+        {
+            if (restarted) break;
+            restart();
+            continue;
+        }
+        restarted = false;
+
+        alpha = rho / shadowV;
+        for (size_t i = 0; i < n; i++)
+        {
+            x[i] += alpha * y[i];
+            s[i]  = r[i] - alpha * v[i];
+        }
+        result.iterations++;
+
+        if (maxNorm(s) <= tolerance)
+        {
+            r.swap(s);
+            residualNorm = maxNorm(r);
+            cout << "iteration " << result.iterations << " complete (residual " << residualNorm << ")" << endl;
+            break;
+        }
+
+        precondition(s, z);
+        multiply(z, t);
+        double tt = dotProduct(t, t);
+        omega = (tt == 0) ? 0 : dotProduct(t, s) / tt;
+        for (size_t i = 0; i < n; i++)
+        {
+            x[i] += omega * z[i];
+            r[i]  = s[i] - omega * t[i];
+        }
+        residualNorm = maxNorm(r);
+        cout << "iteration " << result.iterations << " complete (residual " << residualNorm << ")" << endl;
+
+        if (omega == 0) break;
+    }
+
+    result.trueResidual = systemResidual(multiply, b, x, r);
+    result.converged    = result.trueResidual <= tolerance;
+    return result;
+}
+
+
+// Right-preconditioned GMRES, restarted every GMRES_RESTART iterations.
+// Same arguments and stopping rules as bicgstabSolve.
+KrylovResult gmresSolve(const MatrixProduct&       multiply,
+                        const PreconditionerSolve& precondition,
+                        const vector<double>&      b,
+                        vector<double>&            x,
+                        double                     tolerance,
+                        int                        maxIterations)
+{
+    const size_t n = b.size();
+    const size_t m = GMRES_RESTART;
+    KrylovResult result;
+
+    vector<vector<double>> basis(m + 1, vector<double>(n));
+    vector<double> hessenberg((m + 1) * m), cosines(m), sines(m), g(m + 1);
+    vector<double> r(n), w(n), z(n);
+
+    while (true)
+    {
+        double residualNorm = systemResidual(multiply, b, x, r);
+        if (residualNorm <= tolerance || (maxIterations > 0 && result.iterations >= maxIterations)) break;
+
+        double beta = sqrt(dotProduct(r, r));
+        for (size_t i = 0; i < n; i++) basis[0][i] = r[i] / beta;
+        fill(g.begin(), g.end(), 0.0);
+        g[0] = beta;
+
+        size_t steps{0};
+        for (size_t j = 0; j < m; j++)
+        {
+            precondition(basis[j], z);
+            multiply(z, w);
+
+            // modified Gram-Schmidt against the basis so far
+            for (size_t i = 0; i <= j; i++)
+            {
+                double h = dotProduct(w, basis[i]);
+                hessenberg[i*m + j] = h;
+                for (size_t k = 0; k < n; k++) w[k] -= h * basis[i][k];
+            }
+            double wNorm = sqrt(dotProduct(w, w));
+            hessenberg[(j+1)*m + j] = wNorm;
+            if (wNorm > 0) for (size_t k = 0; k < n; k++) basis[j+1][k] = w[k] / wNorm;
+
+            // keep the Hessenberg matrix triangular with Givens rotations
+            for (size_t i = 0; i < j; i++)
+            {
+                double upper = hessenberg[i*m + j], lower = hessenberg[(i+1)*m + j];
+                hessenberg[i*m + j]     =  cosines[i] * upper + sines[i] * lower;
+                hessenberg[(i+1)*m + j] = -sines[i]   * upper + cosines[i] * lower;
+            }
+            double diag = hessenberg[j*m + j], below = hessenberg[(j+1)*m + j];
+            double radius = hypot(diag, below);
+            cosines[j] = radius == 0 ? 1 : diag / radius;
+            sines[j]   = radius == 0 ? 0 : below / radius;
+            hessenberg[j*m + j]     = radius;
+            hessenberg[(j+1)*m + j] = 0;
+            g[j+1] = -sines[j] * g[j];
+            g[j]   =  cosines[j] * g[j];
+
+            steps = j + 1;
+            result.iterations++;
+            cout << "iteration " << result.iterations << " complete (residual estimate " << abs(g[j+1]) << ")" << endl;
+
+            // |r|_max <= |r|_2, so this is enough for the max-norm tolerance
+            if (abs(g[j+1]) <= tolerance || wNorm == 0) break;
+            if (maxIterations > 0 && result.iterations >= maxIterations) break;
+        }
+
+        // solve the triangular system and update x through the preconditioner
+        vector<double> weights(steps);
+        for (size_t i = steps; i-- > 0; )
+        {
+            double sum = g[i];
+            for (size_t k = i + 1; k < steps; k++) sum -= hessenberg[i*m + k] * weights[k];
+            weights[i] = sum / hessenberg[i*m + i];
+        }
+        fill(w.begin(), w.end(), 0.0);
+        for (size_t i = 0; i < steps; i++)
+        {
+            for (size_t k = 0; k < n; k++) w[k] += weights[i] * basis[i][k];
+        }
+        precondition(w, z);
+        for (size_t k = 0; k < n; k++) x[k] += z[k];
+    }
+
+    result.trueResidual = systemResidual(multiply, b, x, r);
+    result.converged    = result.trueResidual <= tolerance;
+    return result;
+}
+
+
+// Solves (I - A) p = l with the Krylov method in options, starting from
+// whatever prices holds. With -p the tolerance is on the residual's largest
+// entry; -i caps the Krylov iterations, at KRYLOV_MAX_ITERATIONS if not given.
+// multiply must compute y = M x for the whole vector.
+KrylovResult solvePricesKrylov(const PriceEngine&   engine,
+                               const SystemMatrix&  M,
+                               const MatrixProduct& multiply,
+                               vector<double>&      prices,
+                               const RunOptions&    options)
+{
+    vector<double> labor(engine.laborOnly.begin(), engine.laborOnly.end());
+
+    PreconditionerSolve precondition = makePreconditioner(M, options.preconditioner);
+    double tolerance     = options.precision ? pow(10, -options.precision) : 0;
+    int    maxIterations = options.iterations ? options.iterations : KRYLOV_MAX_ITERATIONS;
+
+    cout << "\nNow running " << (options.solver == SolverKind::GMRES ? "GMRES" : "BiCGSTAB") << " iterations." << endl;
+    KrylovResult result = (options.solver == SolverKind::GMRES)
+                          ? gmresSolve(multiply, precondition, labor, prices, tolerance, maxIterations)
+                          : bicgstabSolve(multiply, precondition, labor, prices, tolerance, maxIterations);
+
+    cout << "\nKrylov solve " << (result.converged || !options.precision ? "finished" : "did NOT converge")
+         << " after " << result.iterations << " iterations, true residual max|l - (I - A)p| = "
+         << result.trueResidual << endl;
+    return result;
+}
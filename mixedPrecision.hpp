@@ -0,0 +1,206 @@
+// header file for sweeping with single-precision coefficients (--float).
+//
+// A Jacobi sweep reads every nonzero's coefficient and input index once,
+// and little else, so its time is set by how many bytes those take. With
+// --float the sweeps read a float copy of the coefficients instead: 8 bytes
+// per nonzero rather than 12. Prices are still added up in double, so the
+// only error is in the coefficients themselves, about 6e-8 of each, which
+// moves the fixed point by about 6e-8 / (1 - rho) of the prices.
+//
+// To still meet -p (or --tol-rel, --tol-res), the float solve is refined:
+//
+//   1. sweep p <- l + A_f p with the float coefficients until the change
+//      meets the tolerances, or is down to float's precision (sweeping on
+//      only gets closer to the float coefficients' fixed point);
+//   2. sweep once with the double coefficients; its change is the true
+//      residual r = l + Ap - p. If that meets the tolerances, its result
+//      is the answer, exactly as a double Jacobi solve would stop;
+//   3. otherwise solve the correction e = r + A_f e with float sweeps,
+//      from e = r, until its changes are down to float's precision of r
+//      (or to -p), add it to the prices, and go back to 2.
+//
+// Each correction gains about as many digits as float has, so a step or
+// two is enough, and the double coefficients are read once per step.
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include "runProfile.hpp"
+#include <cmath>
+#include <functional>
+using namespace std;
+
+// most correction steps before giving up on the tolerances
+const int    MAX_REFINEMENT_STEPS = 8;
+
+// relative changes below this are lost in the float coefficients' rounding
+const double FLOAT_PRECISION = 1e-7;
+
+// out = base + A_f in, with the float coefficients; returns the change from in
+typedef function<SweepChange(const vector<double>&, const vector<double>&, vector<double>&)> FloatSweep;
+
+// out = l + A in, with the double coefficients; returns the change from in
+typedef function<SweepChange(const vector<double>&, vector<double>&)> ExactSweep;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// how a refined solve went
+class RefinementResult
+{
+    public:
+        int         floatSweeps{0};
+        int         exactSweeps{0};
+        int         corrections{0};
+        SweepChange residual;           // change of the last double sweep
+};
+
+
+
+
+/*///////////////////////
+     SWEEP FUNCTIONS
+///////////////////////*/
+
+
+// the engine's coefficients, rounded to float (same rows and input indices)
+void buildFloatCoefficients(const PriceEngine& engine, vector<float>& floatCoeffs)
+{
+    floatCoeffs.resize(engine.nonzeroCount());
+    for (size_t k = 0; k < engine.nonzeroCount(); k++) floatCoeffs[k] = (float) engine.coeffs[k];
+}
+
+
+// Jacobi sweep over rows [firstRow, lastRow) with the float coefficients,
+// from base (direct labor, or a residual) rather than the engine's labor.
+// Products are added up in double.
+SweepChange floatSweep(const PriceEngine&    engine,
+                       const vector<float>&  floatCoeffs,
+                       const vector<double>& base,
+                       const vector<double>& prevIterPrices,
+                       vector<double>&       prices,
+                       size_t                firstRow,
+                       size_t                lastRow)
+{
+    const uint64_t* rowStart   = engine.rowStart.data();
+    const uint32_t* inputIndex = engine.inputIndex.data();
+    const float*    coeffs     = floatCoeffs.data();
+    const double*   prevPrices = prevIterPrices.data();
+    SweepChange     change;
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double price = base[r];
+        for (uint64_t k = rowStart[r]; k < rowStart[r+1]; k++)
+        {
+            price += (double) coeffs[k] * prevPrices[inputIndex[k]];
+        }
+        change.add(prevPrices[r], price);
+        prices[r] = price;
+    }
+    return change;
+}
+
+
+
+
+/*///////////////////////
+     SOLVER FUNCTIONS
+///////////////////////*/
+
+
+// Sweeps x <- base + A_f x from the x given until stop says so, given each
+// sweep's change and the sweeps so far. Returns the number of sweeps.
+int floatSolve(const FloatSweep&                                sweep,
+               const vector<double>&                            base,
+               vector<double>&                                  x,
+               const function<bool(const SweepChange&, int)>&   stop)
+{
+    vector<double> prev(x.size());
+    SweepChange    change;
+    int sweeps{0};
+    do
+    {
+        prev.swap(x);
+        change = sweep(base, prev, x);
+        sweeps++;
+    }
+    while (!stop(change, sweeps));
+    return sweeps;
+}
+
+
+// Solves for the prices with float sweeps and double-precision correction
+// steps, as laid out at the top of this file. prices comes in holding the
+// starting point. With -i alone there is no tolerance to refine to: the
+// float sweeps run -i times and the result is measured once.
+RefinementResult refinedSolve(const FloatSweep&     sweep,
+                              const ExactSweep&     exactSweep,
+                              const vector<double>& labor,
+                              vector<double>&       prices,
+                              const RunOptions&     options)
+{
+    RefinementResult result;
+    vector<double>   exact(prices.size());
+    vector<double>   correction(prices.size());
+
+    result.floatSweeps += floatSolve(sweep, labor, prices, [&](const SweepChange& change, int sweeps)
+    {
+        if (!options.stopsOnTolerance()) return sweeps >= options.iterations;
+        return profiledToleranceMet(change, options) || change.maxRelative <= FLOAT_PRECISION;
+    });
+
+    while (true)
+    {
+        result.residual = exactSweep(prices, exact);
+        result.exactSweeps++;
+
+        if (!options.stopsOnTolerance()) break;
+        if (toleranceMet(result.residual, options))
+        {
+            prices.swap(exact);
+            break;
+        }
+        if (result.corrections == MAX_REFINEMENT_STEPS)
+        {
+            cout << "Gave up refining after " << MAX_REFINEMENT_STEPS << " corrections" << endl;
+            break;
+        }
+
+        // The residual r = l + Ap - p, which the correction starts from.
+        // The correction is only solved to about float's precision, which
+        // is all the float coefficients can give it anyway, or to -p.
+        double precision = options.precision ? pow(10, -options.precision) : 0;
+        double largest{0};
+        for (size_t r = 0; r < prices.size(); r++)
+        {
+            exact[r] -= prices[r];
+            largest   = max(largest, abs(exact[r]));
+        }
+        correction = exact;
+        result.floatSweeps += floatSolve(sweep, exact, correction, [&](const SweepChange& change, int)
+        {
+            return change.maxAbsolute <= max(FLOAT_PRECISION * largest, precision / 2);
+        });
+        for (size_t r = 0; r < prices.size(); r++) prices[r] += correction[r];
+        result.corrections++;
+
+        cout << "correction " << result.corrections << " complete" << endl;
+    }
+    return result;
+}
+
+
+// reports how close the refined prices are to the fixed point
+void printRefinement(const RefinementResult& result)
+{
+    double reached = result.residual.maxAbsolute;
+    cout << result.floatSweeps << " float sweeps, " << result.exactSweeps << " double sweeps and "
+         << result.corrections << " corrections" << endl;
+    cout << "Precision reached: max |l + Ap - p| = " << reached;
+    if (reached > 0) cout << " (" << (int) floor(-log10(reached)) << " decimal digits)";
+    cout << ", max relative " << result.residual.maxRelative << ", L2 " << result.residual.residualNorm() << endl;
+}
@@ -0,0 +1,487 @@
+// header file for the sector-aggregation multilevel solver (-s multilevel).
+//
+// Each sweep shrinks the error in the prices by one application of A, so the
+// error modes A barely shrinks, those spread smoothly over whole sectors of
+// the economy, take up most of the sweeps. Such modes are nearly constant
+// over groups of closely linked products, so they also show up in a much
+// smaller table, the one whose products are those groups. The multilevel
+// solver (a two-level aggregation method, as in algebraic multigrid) works
+// on both tables:
+//
+//   1. the products are put into at most MAX_COARSE_PRODUCTS groups, by a
+//      sector map (--sectors) or else automatically, by repeatedly pairing
+//      each group with the input group it's most strongly coupled to;
+//   2. the aggregated table B, where B[g][h] is the mean over the products
+//      of g of their coefficients on products of h, gives the coarse system
+//      (I - B) e = r, which is small enough to be factored once, densely;
+//   3. each cycle makes a Jacobi sweep, whose change is the residual
+//      l + Ap - p, takes the mean of the residual over each group, solves
+//      the coarse system for every group's correction, adds it to the
+//      prices of the group's products, and smooths with a few ordinary
+//      sweeps (Gauss-Seidel, unless -m says otherwise).
+//
+// Aggregates can only correct error that is about even over each of them.
+// A Jacobi sweep leaves error that alternates between neighbours (around
+// short cycles of single-input products, say) about as slowly as the
+// smooth kind, which Gauss-Seidel doesn't, so it is the default smoother.
+//
+// The tolerances are checked on every sweep's change, as in a plain solve;
+// with -i alone, -i is the number of cycles.
+//
+// A sector map is a text file with one UPC prefix and one sector number per
+// line, separated by a space, such as "1010 3". Each product goes to the
+// sector of the longest prefix its UPC starts with; products whose UPCs
+// match no prefix are grouped together in one more sector.
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include "runProfile.hpp"
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+using namespace std;
+
+// the most groups the coarse system can have, since it's solved densely
+const size_t MAX_COARSE_PRODUCTS = 2000;
+
+// how many groups automatic aggregation stops at
+const size_t COARSE_PRODUCTS     = 500;
+
+// ordinary sweeps after each coarse correction
+const int    SMOOTHING_SWEEPS    = 2;
+
+// out = one sweep from in; returns the change from in
+typedef function<SweepChange(const vector<double>&, vector<double>&)> LevelSweep;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// which group each product is in, with groupOf[r] < groupCount
+class Aggregation
+{
+    public:
+        vector<uint32_t> groupOf;
+        size_t           groupCount{0};
+};
+
+
+// The weighted graph of groups, each linked to the groups it takes inputs
+// from: group g's links are target[start[g] .. start[g+1]), with the
+// coefficients between them summed into weight
+class CouplingGraph
+{
+    public:
+        vector<uint64_t> start;
+        vector<uint32_t> target;
+        vector<double>   weight;
+};
+
+
+// The coarse system I - B, LU-factored with partial pivoting: lu holds L
+// (unit diagonal, below) and U, row-major, and row i of the factors is row
+// pivot[i] of the system
+class CoarseSystem
+{
+    public:
+        size_t           size{0};
+        vector<double>   lu;
+        vector<uint32_t> pivot;
+        vector<double>   groupSize;
+};
+
+
+class MultilevelResult
+{
+    public:
+        int  cycles{0};
+        int  sweeps{0};
+        bool corrected{true};       // false if the coarse system was singular
+};
+
+
+
+
+/*///////////////////////
+   AGGREGATION FUNCTIONS
+///////////////////////*/
+
+
+// Reads a sector map (see the top of this file) and puts each product in
+// its sector's group. Sectors no product falls in are left out.
+void aggregateBySectors(const PriceEngine& engine, const char* fileLoc, Aggregation& aggregation)
+{
+    MappedFile mapFile(fileLoc);
+
+    // prefixes by their number of digits, each mapped to its sector
+    vector<unordered_map<long int, long int>> prefixes(20);
+    const char* cursor = mapFile.data;
+    const char* fileEnd = mapFile.data + mapFile.size;
+    while (cursor < fileEnd)
+    {
+        const char* lineEnd = (const char*) memchr(cursor, '\n', fileEnd - cursor);
+        if (!lineEnd) lineEnd = fileEnd;
+        while (cursor < lineEnd && isspace((unsigned char) *cursor)) cursor++;
+        if (cursor == lineEnd)
+        {
+            cursor = lineEnd + 1;
+            continue;
+        }
+
+        long int prefix, sector;
+        auto parsedPrefix = from_chars(cursor, lineEnd, prefix);
+        const char* sectorStart = parsedPrefix.ptr;
+        while (sectorStart < lineEnd && isspace((unsigned char) *sectorStart)) sectorStart++;
+        auto parsedSector = from_chars(sectorStart, lineEnd, sector);
+        size_t digits = parsedPrefix.ptr - cursor;
+        if (parsedPrefix.ec != errc() || parsedSector.ec != errc() || sectorStart == parsedPrefix.ptr
+            || prefix < 0 || digits >= prefixes.size())
+        {
+            throw malformed_table("Unreadable line in sector map: \"" + string(cursor, lineEnd) + "\"");
+        }
+        prefixes[digits][prefix] = sector;
+        cursor = lineEnd + 1;
+    }
+
+    // groups are numbered in order of their first product, unmatched
+    // products sharing one of their own
+    const size_t n = engine.productCount();
+    unordered_map<long int, uint32_t> groupOfSector;
+    uint32_t unmatchedGroup = UINT32_MAX;
+    aggregation.groupOf.resize(n);
+    aggregation.groupCount = 0;
+
+    for (size_t r = 0; r < n; r++)
+    {
+        long int upc = engine.upcs[r];
+        size_t   digits{1};
+        for (long int rest = upc; rest >= 10; rest /= 10) digits++;
+
+        // longest prefix first: the whole UPC, then one digit fewer each time
+        bool     found{false};
+        long int sector{0};
+        long int divisor{1};
+        for (size_t length = digits; length > 0 && !found; length--, divisor *= 10)
+        {
+            if (length >= prefixes.size() || prefixes[length].empty()) continue;
+            auto match = prefixes[length].find(upc / divisor);
+            if (match != prefixes[length].end())
+            {
+                sector = match->second;
+                found  = true;
+            }
+        }
+
+        if (!found)
+        {
+            if (unmatchedGroup == UINT32_MAX) unmatchedGroup = aggregation.groupCount++;
+            aggregation.groupOf[r] = unmatchedGroup;
+            continue;
+        }
+        auto group = groupOfSector.find(sector);
+        if (group == groupOfSector.end()) group = groupOfSector.emplace(sector, aggregation.groupCount++).first;
+        aggregation.groupOf[r] = group->second;
+    }
+
+    if (aggregation.groupCount > MAX_COARSE_PRODUCTS)
+    {
+        throw malformed_table("The sector map makes " + to_string(aggregation.groupCount) + " sectors; -s multilevel takes at most "
+                              + to_string(MAX_COARSE_PRODUCTS) + ".");
+    }
+}
+
+
+// One aggregation pass over count groups, linked as in the arrays given
+// (see CouplingGraph). Each group not yet paired is paired with its most
+// strongly coupled input group that isn't either; one whose input groups
+// are all paired joins the strongest one's pair, and groups with no inputs
+// but themselves all go together. pairedInto[g] is g's new group. Returns
+// the number of new groups, at most half of count plus one.
+size_t pairGroups(size_t          count,
+                  const uint64_t* start,
+                  const uint32_t* target,
+                  const double*   weight,
+                  vector<uint32_t>& pairedInto)
+{
+    const uint32_t UNPAIRED = UINT32_MAX;
+    pairedInto.assign(count, UNPAIRED);
+    size_t   newCount{0};
+    uint32_t inputless = UNPAIRED;
+
+    for (size_t g = 0; g < count; g++)
+    {
+        if (pairedInto[g] != UNPAIRED) continue;
+
+        uint32_t strongest = UNPAIRED, strongestFree = UNPAIRED;
+        double   strongestWeight{-1}, strongestFreeWeight{-1};
+        for (uint64_t k = start[g]; k < start[g+1]; k++)
+        {
+            uint32_t input = target[k];
+            double   w     = abs(weight[k]);
+            if (input == g) continue;
+            if (w > strongestWeight) { strongest = input; strongestWeight = w; }
+            if (pairedInto[input] == UNPAIRED && w > strongestFreeWeight) { strongestFree = input; strongestFreeWeight = w; }
+        }
+
+        if (strongestFree != UNPAIRED)
+        {
+            pairedInto[g] = pairedInto[strongestFree] = newCount++;
+        }
+        else if (strongest != UNPAIRED)
+        {
+            pairedInto[g] = pairedInto[strongest];
+        }
+        else
+        {
+            if (inputless == UNPAIRED) inputless = newCount++;
+            pairedInto[g] = inputless;
+        }
+    }
+    return newCount;
+}
+
+
+// The graph of the new groups, summing the links of the groups in each
+void coarsenGraph(size_t                  count,
+                  const uint64_t*         start,
+                  const uint32_t*         target,
+                  const double*           weight,
+                  const vector<uint32_t>& pairedInto,
+                  size_t                  newCount,
+                  CouplingGraph&          coarse)
+{
+    // the old groups in each new one
+    vector<uint64_t> memberStart(newCount + 1, 0);
+    vector<uint32_t> members(count);
+    for (size_t g = 0; g < count; g++) memberStart[pairedInto[g] + 1]++;
+    for (size_t h = 0; h < newCount; h++) memberStart[h+1] += memberStart[h];
+    vector<uint64_t> next(memberStart.begin(), memberStart.end() - 1);
+    for (size_t g = 0; g < count; g++) members[next[pairedInto[g]]++] = g;
+
+    vector<double>   summed(newCount, 0);
+    vector<bool>     linked(newCount, false);
+    vector<uint32_t> targets;
+    coarse.start.assign(1, 0);
+    coarse.target.clear();
+    coarse.weight.clear();
+
+    for (size_t h = 0; h < newCount; h++)
+    {
+        targets.clear();
+        for (uint64_t m = memberStart[h]; m < memberStart[h+1]; m++)
+        {
+            uint32_t g = members[m];
+            for (uint64_t k = start[g]; k < start[g+1]; k++)
+            {
+                uint32_t input = pairedInto[target[k]];
+                if (!linked[input]) { linked[input] = true; targets.push_back(input); }
+                summed[input] += weight[k];
+            }
+        }
+        for (uint32_t input : targets)
+        {
+            coarse.target.push_back(input);
+            coarse.weight.push_back(summed[input]);
+            summed[input] = 0;
+            linked[input] = false;
+        }
+        coarse.start.push_back(coarse.target.size());
+    }
+}
+
+
+// Aggregates the products by coupling strength, a pairing pass at a time
+// (see pairGroups), until there are at most COARSE_PRODUCTS groups
+void aggregateByCoupling(const PriceEngine& engine, Aggregation& aggregation)
+{
+    const size_t n = engine.productCount();
+    aggregation.groupOf.resize(n);
+    for (size_t r = 0; r < n; r++) aggregation.groupOf[r] = r;
+    aggregation.groupCount = n;
+
+    // the first pass runs on the table itself
+    CouplingGraph    graph, coarse;
+    vector<uint32_t> pairedInto;
+    bool             onTable{true};
+
+    while (aggregation.groupCount > COARSE_PRODUCTS)
+    {
+        const uint64_t* start  = onTable ? engine.rowStart.data()   : graph.start.data();
+        const uint32_t* target = onTable ? engine.inputIndex.data() : graph.target.data();
+        const double*   weight = onTable ? engine.coeffs.data()     : graph.weight.data();
+
+        size_t newCount = pairGroups(aggregation.groupCount, start, target, weight, pairedInto);
+        if (newCount == aggregation.groupCount) break;
+
+        coarsenGraph(aggregation.groupCount, start, target, weight, pairedInto, newCount, coarse);
+        graph.start.swap(coarse.start);
+        graph.target.swap(coarse.target);
+        graph.weight.swap(coarse.weight);
+        onTable = false;
+
+        for (uint32_t& group : aggregation.groupOf) group = pairedInto[group];
+        aggregation.groupCount = newCount;
+    }
+}
+
+
+
+
+/*///////////////////////
+    COARSE FUNCTIONS
+///////////////////////*/
+
+
+// Builds I - B (see the top of this file) and factors it. Returns false if
+// it's numerically singular.
+bool factorCoarseSystem(const PriceEngine& engine, const Aggregation& aggregation, CoarseSystem& coarse)
+{
+    const size_t m = aggregation.groupCount;
+    coarse.size = m;
+    coarse.lu.assign(m * m, 0);
+    coarse.groupSize.assign(m, 0);
+    coarse.pivot.resize(m);
+    for (size_t g = 0; g < m; g++) coarse.pivot[g] = g;
+
+    for (size_t r = 0; r < engine.productCount(); r++)
+    {
+        uint32_t g = aggregation.groupOf[r];
+        coarse.groupSize[g]++;
+        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+        {
+            coarse.lu[g * m + aggregation.groupOf[engine.inputIndex[k]]] -= engine.coeffs[k];
+        }
+    }
+    for (size_t g = 0; g < m; g++)
+    {
+        for (size_t h = 0; h < m; h++) coarse.lu[g * m + h] /= max(coarse.groupSize[g], 1.0);
+        coarse.lu[g * m + g] += 1;
+    }
+
+    // Gaussian elimination with partial pivoting, as in solveSmallSystem,
+    // but keeping the multipliers so every cycle only has to substitute
+    double* M = coarse.lu.data();
+    for (size_t col = 0; col < m; col++)
+    {
+        size_t pivot = col;
+        for (size_t row = col + 1; row < m; row++)
+        {
+            if (abs(M[row*m + col]) > abs(M[pivot*m + col])) pivot = row;
+        }
+        if (abs(M[pivot*m + col]) < 1e-300) return false;
+
+        if (pivot != col)
+        {
+            for (size_t k = 0; k < m; k++) swap(M[col*m + k], M[pivot*m + k]);
+            swap(coarse.pivot[col], coarse.pivot[pivot]);
+        }
+
+        for (size_t row = col + 1; row < m; row++)
+        {
+            double factor = M[row*m + col] /= M[col*m + col];
+            for (size_t k = col + 1; k < m; k++) M[row*m + k] -= factor * M[col*m + k];
+        }
+    }
+    return true;
+}
+
+
+// solves (I - B) e = residual with the factors, into correction
+void solveCoarseSystem(const CoarseSystem& coarse, const vector<double>& residual, vector<double>& correction)
+{
+    const size_t  m = coarse.size;
+    const double* M = coarse.lu.data();
+    correction.resize(m);
+    for (size_t i = 0; i < m; i++) correction[i] = residual[coarse.pivot[i]];
+
+    for (size_t i = 0; i < m; i++)
+    {
+        for (size_t k = 0; k < i; k++) correction[i] -= M[i*m + k] * correction[k];
+    }
+    for (size_t i = m; i-- > 0; )
+    {
+        for (size_t k = i + 1; k < m; k++) correction[i] -= M[i*m + k] * correction[k];
+        correction[i] /= M[i*m + i];
+    }
+}
+
+
+
+
+/*///////////////////////
+     SOLVER FUNCTIONS
+///////////////////////*/
+
+
+// Solves as laid out at the top of this file, starting from and returning
+// through prices. residualSweep must be a Jacobi sweep; smoothingSweep is
+// the sweep -m asks for.
+MultilevelResult multilevelSolve(const PriceEngine& engine,
+                                 const LevelSweep&  residualSweep,
+                                 const LevelSweep&  smoothingSweep,
+                                 vector<double>&    prices,
+                                 const RunOptions&  options)
+{
+    Aggregation aggregation;
+    if (options.sectorMapFile) aggregateBySectors(engine, options.sectorMapFile, aggregation);
+    else                       aggregateByCoupling(engine, aggregation);
+    cout << "Aggregated " << engine.productCount() << " products into " << aggregation.groupCount
+         << (options.sectorMapFile ? " sectors" : " groups by coupling strength") << endl;
+
+    MultilevelResult result;
+    CoarseSystem     coarse;
+    if (!factorCoarseSystem(engine, aggregation, coarse))
+    {
+        cout << "The aggregated table is singular, so there will be no coarse corrections" << endl;
+        result.corrected = false;
+    }
+
+    const size_t   n = engine.productCount();
+    vector<double> next(n), groupResidual, correction;
+    auto done = [&](const SweepChange& change)
+    {
+        result.sweeps++;
+        return options.stopsOnTolerance() && profiledToleranceMet(change, options);
+    };
+
+    while (options.stopsOnTolerance() || result.cycles < options.iterations)
+    {
+        SweepChange change = residualSweep(prices, next);
+        if (done(change))
+        {
+            prices.swap(next);
+            break;
+        }
+
+        if (result.corrected)
+        {
+            groupResidual.assign(coarse.size, 0);
+            for (size_t r = 0; r < n; r++) groupResidual[aggregation.groupOf[r]] += next[r] - prices[r];
+            for (size_t g = 0; g < coarse.size; g++) groupResidual[g] /= max(coarse.groupSize[g], 1.0);
+
+            solveCoarseSystem(coarse, groupResidual, correction);
+            for (size_t r = 0; r < n; r++) prices[r] += correction[aggregation.groupOf[r]];
+        }
+        else prices.swap(next);
+
+        bool met{false};
+        for (int s = 0; s < SMOOTHING_SWEEPS && !met; s++)
+        {
+            met = done(smoothingSweep(prices, next));
+            prices.swap(next);
+        }
+        result.cycles++;
+        cout << "cycle " << result.cycles << " complete" << endl;
+        if (met) break;
+    }
+    return result;
+}
+
+
+void printMultilevelResult(const MultilevelResult& result)
+{
+    cout << result.cycles << " cycles took " << result.sweeps << " sweeps in all" << endl;
+}
@@ -0,0 +1,226 @@
+// header file for solving tables larger than memory (--out-of-core).
+//
+// A compiled table is mapped rather than read, so only the pages a sweep
+// touches are ever in memory; but every Jacobi sweep touches all of the
+// input indices and coefficients, in order, and once those no longer fit in
+// RAM the page cache evicts them just ahead of the next sweep, one page fault
+// at a time. Out of core, they aren't mapped at all: each sweep streams them
+// from the file in blocks of whole rows, with large sequential reads (and
+// the kernel told to read ahead), and while one block is being swept the
+// next one is already being read on another thread. What stays in memory is
+// two blocks, the two price vectors and the per-product arrays (UPCs, row
+// offsets, direct labor), which are read through the mapping as usual.
+//
+// The sweeps add up each row in the same order as the in-memory ones, so
+// they give exactly the same prices.
+
+#pragma once
+#include "compiledTable.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <future>
+#include <unistd.h>
+using namespace std;
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// only compiled tables have their inputs laid out to be streamed; a text
+// table would have to be parsed into memory first
+void checkStreamable(const char* fileLoc)
+{
+    if (!isCompiledTable(fileLoc))
+    {
+        throw malformed_table("--out-of-core streams a compiled table; compile the table with -c first.");
+    }
+}
+
+
+// The rows [firstRow, lastRow) of the table, with their inputs: the k-th
+// nonzero of the table is inputIndex[k - firstNonzero] here
+class StreamBlock
+{
+    public:
+        size_t           firstRow{0};
+        size_t           lastRow{0};
+        uint64_t         firstNonzero{0};
+        vector<uint32_t> inputIndex;
+        vector<double>   coeffs;
+};
+
+// sweeps the rows of one block, from prevPrices into prices
+typedef function<SweepChange(const StreamBlock&, const vector<double>&, vector<double>&)> BlockSweep;
+
+
+// Reads the input indices and coefficients of a compiled table in row
+// blocks, straight from the file, for an engine opened from that file
+class TableStream
+{
+    public:
+        TableStream(const char* fileLoc, const PriceEngine& engine, uint64_t blockMB)
+            : engine(engine)
+        {
+            checkStreamable(fileLoc);
+            layOutCompiledTable(header, engine.productCount(), engine.nonzeroCount(), engine.resourceCount());
+
+            fd = open(fileLoc, O_RDONLY);
+            if (fd < 0) throw bad_file();
+            posix_fadvise(fd, header.inputIndexOffset, header.laborOffset - header.inputIndexOffset, POSIX_FADV_SEQUENTIAL);
+
+            // cut the rows into blocks of about blockMB of inputs each
+            // (a single row bigger than that gets a block to itself)
+            const uint64_t bytesPerNonzero = sizeof(uint32_t) + sizeof(double);
+            const uint64_t blockNonzeros   = max<uint64_t>(1, (blockMB << 20) / bytesPerNonzero);
+
+            blockStart.push_back(0);
+            for (size_t r = 0; r < engine.productCount(); r++)
+            {
+                if (engine.rowStart[r+1] - engine.rowStart[blockStart.back()] > blockNonzeros && r > blockStart.back())
+                {
+                    blockStart.push_back(r);
+                }
+            }
+            blockStart.push_back(engine.productCount());
+        }
+
+        ~TableStream()
+        {
+            close(fd);
+        }
+
+        TableStream(const TableStream&) = delete;
+        TableStream& operator=(const TableStream&) = delete;
+
+        size_t blockCount() const { return blockStart.size() - 1; }
+
+        // the most nonzeros any block holds
+        uint64_t largestBlock() const
+        {
+            uint64_t largest{0};
+            for (size_t b = 0; b < blockCount(); b++)
+            {
+                largest = max(largest, engine.rowStart[blockStart[b+1]] - engine.rowStart[blockStart[b]]);
+            }
+            return largest;
+        }
+
+        // reads block b from the file into block
+        void read(size_t b, StreamBlock& block) const
+        {
+            block.firstRow     = blockStart[b];
+            block.lastRow      = blockStart[b+1];
+            block.firstNonzero = engine.rowStart[block.firstRow];
+            uint64_t nonzeros  = engine.rowStart[block.lastRow] - block.firstNonzero;
+
+            block.inputIndex.resize(nonzeros);
+            block.coeffs.resize(nonzeros);
+            readFully(block.inputIndex.data(), nonzeros * sizeof(uint32_t),
+                      header.inputIndexOffset + block.firstNonzero * sizeof(uint32_t));
+            readFully(block.coeffs.data(), nonzeros * sizeof(double),
+                      header.coeffsOffset + block.firstNonzero * sizeof(double));
+        }
+
+        // One Jacobi sweep over the whole table, a block at a time: block
+        // b+1 is read on another thread while sweepBlock works on block b.
+        // Returns the change of the whole sweep.
+        SweepChange sweep(const vector<double>& prevPrices, vector<double>& prices, const BlockSweep& sweepBlock)
+        {
+            SweepChange change;
+            read(0, blocks[0]);
+            for (size_t b = 0; b < blockCount(); b++)
+            {
+                future<void> next;
+                if (b + 1 < blockCount())
+                {
+                    next = async(launch::async, [this, b] { read(b + 1, blocks[(b + 1) % 2]); });
+                }
+                change.merge(sweepBlock(blocks[b % 2], prevPrices, prices));
+                if (next.valid()) next.get();
+            }
+            return change;
+        }
+
+    private:
+        const PriceEngine&  engine;
+        CompiledTableHeader header;
+        int                 fd{-1};
+        vector<size_t>      blockStart;     // block b is rows [blockStart[b], blockStart[b+1])
+        StreamBlock         blocks[2];      // the one being swept and the one being read
+
+        // pread until all the bytes are in; a single call may return fewer
+        void readFully(void* data, uint64_t bytes, uint64_t offset) const
+        {
+            char* cursor = (char*) data;
+            while (bytes > 0)
+            {
+                ssize_t got = pread(fd, cursor, bytes, offset);
+                if (got < 0 && errno == EINTR) continue;
+                if (got <= 0) throw malformed_table("Compiled table is truncated or unreadable.");
+                cursor += got;
+                offset += got;
+                bytes  -= got;
+            }
+        }
+};
+
+
+
+
+/*///////////////////////
+     SWEEP FUNCTIONS
+///////////////////////*/
+
+
+// Jacobi sweep over rows [firstRow, lastRow) of a streamed block, adding up
+// each row in the same order as jacobiSweep
+SweepChange streamedSweep(const PriceEngine&    engine,
+                          const StreamBlock&    block,
+                          const vector<double>& prevIterPrices,
+                          vector<double>&       prices,
+                          size_t                firstRow,
+                          size_t                lastRow)
+{
+    const uint64_t* rowStart   = engine.rowStart.data();
+    const uint32_t* inputIndex = block.inputIndex.data();
+    const double*   coeffs     = block.coeffs.data();
+    const double*   laborOnly  = engine.laborOnly.data();
+    const double*   prevPrices = prevIterPrices.data();
+    SweepChange     change;
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double price = laborOnly[r];
+        for (uint64_t k = rowStart[r] - block.firstNonzero; k < rowStart[r+1] - block.firstNonzero; k++)
+        {
+            price += coeffs[k] * prevPrices[inputIndex[k]];
+        }
+        change.add(prevPrices[r], price);
+        prices[r] = price;
+    }
+    return change;
+}
+
+
+// The first row of part t of the block, when it's split into parts with
+// about the same number of nonzeros each
+size_t blockSplit(const PriceEngine& engine, const StreamBlock& block, size_t t, size_t parts)
+{
+    if (t == 0)     return block.firstRow;
+    if (t >= parts) return block.lastRow;
+
+    uint64_t nonzeros = engine.rowStart[block.lastRow] - block.firstNonzero;
+    uint64_t target   = block.firstNonzero + nonzeros * t / parts;
+    auto     first    = engine.rowStart.data() + block.firstRow;
+    auto     last     = engine.rowStart.data() + block.lastRow;
+    return lower_bound(first, last, target) - engine.rowStart.data();
+}
+
+
+void printTableStream(const TableStream& stream, const PriceEngine& engine)
+{
+    const double bytesPerNonzero = sizeof(uint32_t) + sizeof(double);
+    cout << "Streaming " << engine.nonzeroCount() << " inputs in " << stream.blockCount() << " blocks of up to "
+         << setprecision(4) << stream.largestBlock() * bytesPerNonzero / (1 << 20) << " MB" << endl;
+}
@@ -0,0 +1,571 @@
+// header file for the compiled form of the input-output table.
+//
+// The hash map produced by loadIOTable is convenient for loading, but every
+// nonzero costs several hash lookups per iteration. buildPriceEngine turns
+// the table into a compressed sparse row (CSR) matrix once, with every UPC
+// mapped to a dense index, every input coefficient already divided by the
+// output quantity of its product, and the labor column split off into its
+// own vector. Each iteration is then a plain sparse matrix-vector product.
+// Any other primary inputs the table records (input codes 2 to 9, such as
+// energy or emissions) are split off next to labor in the same way.
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include "priceFiles.hpp"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+using namespace std;
+
+// input codes 2..9 are primary resources other than labor, like 0 is labor
+const long int FIRST_RESOURCE_CODE = 2;
+const long int LAST_RESOURCE_CODE  = 9;
+
+bool isResourceCode(long int input) { return input >= FIRST_RESOURCE_CODE && input <= LAST_RESOURCE_CODE; }
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// Non-owning view of a contiguous array, so that the engine's arrays can
+// live either in vectors or inside a memory-mapped compiled table file
+template <typename T>
+class ArrayView
+{
+    public:
+        ArrayView() {}
+        ArrayView(T* first, size_t count): first(first), count(count) {}
+
+        T*     data()  const { return first; }
+        size_t size()  const { return count; }
+        bool   empty() const { return count == 0; }
+        T*     begin() const { return first; }
+        T*     end()   const { return first + count; }
+
+        T& operator[](size_t i) const { return first[i]; }
+
+    private:
+        T*     first{nullptr};
+        size_t count{0};
+};
+
+
+// Row r of the matrix is the product upcs[r]; the entries of that row are
+// its inputs, stored in inputIndex[rowStart[r] .. rowStart[r+1]) together
+// with their normalized coefficients. One iteration of the algorithm is
+//
+//     price[r] = laborOnly[r] + sum_k coeffs[k] * prevPrice[inputIndex[k]]
+//
+// The engine owns whatever its views point into, so it can be moved but not copied.
+class PriceEngine
+{
+    public:
+        ArrayView<long int> upcs;          // dense index -> UPC, sorted ascending
+        ArrayView<uint64_t> rowStart;      // size productCount()+1
+        ArrayView<uint32_t> inputIndex;    // dense index of each input
+        ArrayView<double>   coeffs;        // input quantity / output quantity
+        ArrayView<double>   laborOnly;     // direct labor / output quantity
+        ArrayView<double>   output;        // output quantity, to renormalize edited rows
+
+        // other primary resources: the codes the table uses, ascending, and
+        // resourceOnly[r * resourceCount() + j] = direct use of resourceCodes[j] / output quantity
+        ArrayView<long int> resourceCodes;
+        ArrayView<double>   resourceOnly;
+
+        size_t productCount()  const { return upcs.size(); }
+        size_t nonzeroCount()  const { return coeffs.size(); }
+        size_t resourceCount() const { return resourceCodes.size(); }
+
+        // upcs is sorted, so no hash map is needed to go back from UPC to index.
+        // Returns productCount() if the UPC is not a product in the table.
+        size_t indexOf(long int upc) const
+        {
+            auto found = lower_bound(upcs.begin(), upcs.end(), upc);
+            if (found == upcs.end() || *found != upc) return productCount();
+            return found - upcs.begin();
+        }
+
+        // takes over arrays built in memory and points the views at them
+        void adoptArrays(vector<long int>&& upcArray,
+                         vector<uint64_t>&& rowStartArray,
+                         vector<uint32_t>&& inputIndexArray,
+                         vector<double>&&   coeffArray,
+                         vector<double>&&   laborArray,
+                         vector<double>&&   outputArray)
+        {
+            mappedTable.reset();
+            resourceCodeStorage.clear();
+            resourceStorage.clear();
+            resourceCodes = {};
+            resourceOnly  = {};
+            upcStorage        = move(upcArray);
+            rowStartStorage   = move(rowStartArray);
+            inputIndexStorage = move(inputIndexArray);
+            coeffStorage      = move(coeffArray);
+            laborStorage      = move(laborArray);
+            outputStorage     = move(outputArray);
+
+            upcs       = {upcStorage.data(),        upcStorage.size()};
+            rowStart   = {rowStartStorage.data(),   rowStartStorage.size()};
+            inputIndex = {inputIndexStorage.data(), inputIndexStorage.size()};
+            coeffs     = {coeffStorage.data(),      coeffStorage.size()};
+            laborOnly  = {laborStorage.data(),      laborStorage.size()};
+            output     = {outputStorage.data(),     outputStorage.size()};
+        }
+
+        // takes over the resource arrays (after adoptArrays, which drops them)
+        void adoptResources(vector<long int>&& codeArray, vector<double>&& resourceArray)
+        {
+            resourceCodeStorage = move(codeArray);
+            resourceStorage     = move(resourceArray);
+            resourceCodes = {resourceCodeStorage.data(), resourceCodeStorage.size()};
+            resourceOnly  = {resourceStorage.data(),     resourceStorage.size()};
+        }
+
+        // keeps a mapped file alive for as long as the views point into it
+        // (the caller sets the views)
+        void adoptMapping(unique_ptr<MappedFile>&& mapping)
+        {
+            upcStorage.clear();
+            rowStartStorage.clear();
+            inputIndexStorage.clear();
+            coeffStorage.clear();
+            laborStorage.clear();
+            outputStorage.clear();
+            resourceCodeStorage.clear();
+            resourceStorage.clear();
+            mappedTable = move(mapping);
+        }
+
+    private:
+        vector<long int> upcStorage;
+        vector<uint64_t> rowStartStorage;
+        vector<uint32_t> inputIndexStorage;
+        vector<double>   coeffStorage;
+        vector<double>   laborStorage;
+        vector<double>   outputStorage;
+        vector<long int> resourceCodeStorage;
+        vector<double>   resourceStorage;
+        unique_ptr<MappedFile> mappedTable;
+};
+
+
+
+
+// How far one sweep moved the prices, gathered by the sweep itself as it
+// writes each price, so checking for convergence takes no second pass.
+// A Jacobi sweep's change is also the residual l + Ap - p of the prices it
+// started from, so residualNorm() is the L2 norm of that residual.
+// max() drops a NaN change, but sumSquares carries any NaN or infinite one
+// through every add and merge, so finite() tells whether all were finite.
+class SweepChange
+{
+    public:
+        double maxAbsolute{0};      // max |new - old|
+        double maxRelative{0};      // max |new - old| / |new|
+        double sumSquares{0};       // sum of (new - old)^2
+
+        void add(double oldPrice, double newPrice)
+        {
+            double change = abs(newPrice - oldPrice);
+            maxAbsolute = max(maxAbsolute, change);
+            if (change != 0) maxRelative = max(maxRelative, change / abs(newPrice));
+            sumSquares += change * change;
+        }
+
+        void merge(const SweepChange& other)
+        {
+            maxAbsolute = max(maxAbsolute, other.maxAbsolute);
+            maxRelative = max(maxRelative, other.maxRelative);
+            sumSquares += other.sumSquares;
+        }
+
+        double residualNorm() const { return sqrt(sumSquares); }
+        bool   finite()       const { return isfinite(sumSquares); }
+};
+
+
+
+
+/*///////////////////////
+    ENGINE FUNCTIONS
+///////////////////////*/
+
+
+// Builds the engine from the raw table entries. If the same (product, input)
+// pair appears more than once, the last one wins, as it does when the
+// entries are inserted into the hash map one at a time.
+void buildPriceEngine(const vector<TableEntry>& entries, PriceEngine& engine)
+{
+    // dense indices, in UPC order
+    vector<long int> upcs;
+    upcs.reserve(entries.size() / 4);
+    for (const TableEntry& entry : entries) upcs.push_back(entry.product);
+    sort(upcs.begin(), upcs.end());
+    upcs.erase(unique(upcs.begin(), upcs.end()), upcs.end());
+
+    const size_t productCount = upcs.size();
+    if (productCount > UINT32_MAX) throw malformed_table("Too many products for 32-bit indices.");
+
+    auto indexOf = [&upcs, productCount](long int upc) -> size_t
+    {
+        auto found = lower_bound(upcs.begin(), upcs.end(), upc);
+        if (found == upcs.end() || *found != upc) return productCount;
+        return found - upcs.begin();
+    };
+
+    // the resource codes in use, so products get one slot per code
+    vector<long int> resourceCodes;
+    for (const TableEntry& entry : entries)
+    {
+        if (isResourceCode(entry.input)) resourceCodes.push_back(entry.input);
+    }
+    sort(resourceCodes.begin(), resourceCodes.end());
+    resourceCodes.erase(unique(resourceCodes.begin(), resourceCodes.end()), resourceCodes.end());
+    const size_t resourceCount = resourceCodes.size();
+
+    vector<double> labor(productCount, 0.0);
+    vector<double> output(productCount, 0.0);
+    vector<double> resources(productCount * resourceCount, 0.0);
+    vector<uint32_t> entryRow(entries.size());
+
+    // count the inputs of each row, resolving UPCs to indices only once
+    vector<uint64_t> rowStart(productCount + 1, 0);
+    for (size_t e = 0; e < entries.size(); e++)
+    {
+        const TableEntry& entry = entries[e];
+        size_t row = indexOf(entry.product);
+        entryRow[e] = row;
+
+        if      (entry.input == 0) labor[row]  = entry.quantity;
+        else if (entry.input == 1) output[row] = entry.quantity;
+        else if (isResourceCode(entry.input))
+        {
+            size_t j = lower_bound(resourceCodes.begin(), resourceCodes.end(), entry.input) - resourceCodes.begin();
+            resources[row * resourceCount + j] = entry.quantity;
+        }
+        else rowStart[row+1]++;
+    }
+    for (size_t r = 0; r < productCount; r++) rowStart[r+1] += rowStart[r];
+
+    // scatter the inputs into their rows, in file order
+    vector<pair<uint32_t,double>> rowEntries(rowStart[productCount]);
+    vector<uint64_t> fillPosition(rowStart.begin(), rowStart.end() - 1);
+    for (size_t e = 0; e < entries.size(); e++)
+    {
+        const TableEntry& entry = entries[e];
+        if (entry.input == 0 || entry.input == 1 || isResourceCode(entry.input)) continue;
+
+        size_t input = indexOf(entry.input);
+        if (input == productCount)
+        {
+            throw malformed_table("Input " + to_string(entry.input) + " of product "
+                                  + to_string(entry.product) + " is never produced.");
+        }
+        rowEntries[fillPosition[entryRow[e]]++] = {(uint32_t) input, entry.quantity};
+    }
+
+    // sort each row by input and drop duplicates (keeping the last one),
+    // compacting the rows as we go, then normalize by the output quantity
+    vector<uint32_t> inputIndex;
+    vector<double>   coeffs;
+    vector<double>   laborOnly(productCount, 0.0);
+    inputIndex.reserve(rowEntries.size());
+    coeffs.reserve(rowEntries.size());
+
+    uint64_t rowBegin = 0;
+    for (size_t r = 0; r < productCount; r++)
+    {
+        if (output[r] == 0)
+        {
+            throw malformed_table("No output quantity (column 1) recorded for product "
+                                  + to_string(upcs[r]) + ".");
+        }
+
+        auto first = rowEntries.begin() + rowBegin;
+        auto last  = rowEntries.begin() + rowStart[r+1];
+        stable_sort(first, last, [](const pair<uint32_t,double>& a, const pair<uint32_t,double>& b)
+                                 { return a.first < b.first; });
+
+        for (auto item = first; item != last; ++item)
+        {
+            if ((item + 1) != last && (item + 1)->first == item->first) continue;
+            if (item->second == 0) continue;
+
+            inputIndex.push_back(item->first);
+            coeffs.push_back(item->second / output[r]);
+        }
+
+        rowBegin = rowStart[r+1];
+        rowStart[r+1] = coeffs.size();
+        laborOnly[r] = labor[r] / output[r];
+        for (size_t j = 0; j < resourceCount; j++) resources[r * resourceCount + j] /= output[r];
+    }
+
+    engine.adoptArrays(move(upcs), move(rowStart), move(inputIndex), move(coeffs), move(laborOnly), move(output));
+    engine.adoptResources(move(resourceCodes), move(resources));
+}
+
+
+// for tables that were loaded into the hash map
+void buildPriceEngine(const unordered_map<ProdInputPair,double>& ioTable, PriceEngine& engine)
+{
+    vector<TableEntry> entries;
+    entries.reserve(ioTable.size());
+    for (const auto &[PIpair, quantity] : ioTable)
+    {
+        entries.push_back({PIpair.product, PIpair.input, quantity});
+    }
+
+    buildPriceEngine(entries, engine);
+}
+
+
+// One Jacobi sweep of the algorithm over rows [firstRow, lastRow):
+// every price in that range is recomputed from the previous iteration's prices.
+// Rows outside the range are left alone, so that threads can split the work.
+// Returns how far the sweep moved those prices.
+SweepChange jacobiSweep(const PriceEngine&    engine,
+                        const vector<double>& prevIterPrices,
+                        vector<double>&       prices,
+                        size_t                firstRow,
+                        size_t                lastRow)
+{
+    const uint64_t* rowStart   = engine.rowStart.data();
+    const uint32_t* inputIndex = engine.inputIndex.data();
+    const double*   coeffs     = engine.coeffs.data();
+    const double*   laborOnly  = engine.laborOnly.data();
+    const double*   prevPrices = prevIterPrices.data();
+    SweepChange     change;
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double price = laborOnly[r];
+        for (uint64_t k = rowStart[r]; k < rowStart[r+1]; k++)
+        {
+            price += coeffs[k] * prevPrices[inputIndex[k]];
+        }
+        change.add(prevPrices[r], price);
+        prices[r] = price;
+    }
+    return change;
+}
+
+
+// the coefficient of each product on itself (e.g. fuel used to make fuel),
+// which the in-place sweeps solve for rather than iterate on
+vector<double> selfCoefficients(const PriceEngine& engine)
+{
+    vector<double> selfCoeffs(engine.productCount(), 0.0);
+    for (size_t r = 0; r < engine.productCount(); r++)
+    {
+        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+        {
+            if (engine.inputIndex[k] == r) selfCoeffs[r] = engine.coeffs[k];
+        }
+
+        if (selfCoeffs[r] >= 1)
+        {
+            throw malformed_table("Product " + to_string(engine.upcs[r]) 
+                                  + " uses at least as much of itself as it produces.");
+        }
+    }
+    return selfCoeffs;
+}
+
+
+// One Gauss-Seidel sweep over rows [firstRow, lastRow), updating prices in place
+// so that rows later in the sweep already use the new prices of earlier ones.
+// With omega != 1 each update is over- (or under-) relaxed, which is SOR.
+//
+// Inputs outside [firstRow, lastRow) are read from outsidePrices instead,
+// so that threads can each sweep their own rows while reading a stable copy
+// of everyone else's; a single-threaded sweep passes prices for both.
+//
+// Returns how far the sweep moved the prices.
+SweepChange sorSweep(const PriceEngine&    engine,
+                     const vector<double>& selfCoeffs,
+                     vector<double>&       prices,
+                     const vector<double>& outsidePrices,
+                     size_t                firstRow,
+                     size_t                lastRow,
+                     double                omega)
+{
+    const uint64_t* rowStart   = engine.rowStart.data();
+    const uint32_t* inputIndex = engine.inputIndex.data();
+    const double*   coeffs     = engine.coeffs.data();
+    const double*   laborOnly  = engine.laborOnly.data();
+    const double*   outside    = outsidePrices.data();
+    double*         current    = prices.data();
+    SweepChange     change;
+    const bool      ownRowsOnly = &prices != &outsidePrices;
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double price = laborOnly[r];
+        for (uint64_t k = rowStart[r]; k < rowStart[r+1]; k++)
+        {
+            uint32_t input = inputIndex[k];
+            bool     own   = !ownRowsOnly || (input >= firstRow && input < lastRow);
+            price += coeffs[k] * (own ? current[input] : outside[input]);
+        }
+
+        // take the product's own (old) price back out and solve for it instead
+        double oldPrice = current[r];
+        price = (price - selfCoeffs[r] * oldPrice) / (1 - selfCoeffs[r]);
+        price = oldPrice + omega * (price - oldPrice);
+
+        change.add(oldPrice, price);
+        current[r] = price;
+    }
+
+    return change;
+}
+
+
+// True once a sweep's change is within every tolerance given on the command
+// line: -p (absolute), --tol-rel (relative) and --tol-res (residual norm).
+// Never true if none was given, when only -i stops the sweeps.
+// Throws diverged if the sweep made any price NaN or infinite.
+bool toleranceMet(const SweepChange& change, const RunOptions& options)
+{
+    if (!change.finite()) throw diverged("The prices diverged to NaN or infinity. The table may not be productive.");
+    if (!options.stopsOnTolerance()) return false;
+    if (options.precision && change.maxAbsolute > pow(10, -options.precision))                return false;
+    if (options.relativeTolerance > 0 && change.maxRelative > options.relativeTolerance)     return false;
+    if (options.residualTolerance > 0 && change.residualNorm() > options.residualTolerance) return false;
+    return true;
+}
+
+
+// Throws diverged if any of the solved values is NaN or infinite, so that a
+// solve that blew up isn't written out as prices. With -i alone no sweep's
+// change is ever checked.
+void checkFinitePrices(const vector<double>& values)
+{
+    for (double value : values)
+    {
+        if (!isfinite(value)) throw diverged("The prices diverged to NaN or infinity. The table may not be productive.");
+    }
+}
+
+
+// the tolerances toleranceMet checks, for the log
+string describeTolerances(const RunOptions& options)
+{
+    ostringstream description;
+    const char* separator = "";
+
+    if (options.precision)             { description << separator << "precision == "      << options.precision;         separator = ", "; }
+    if (options.relativeTolerance > 0) { description << separator << "relative change <= " << options.relativeTolerance; separator = ", "; }
+    if (options.residualTolerance > 0) { description << separator << "residual norm <= "   << options.residualTolerance; }
+    return description.str();
+}
+
+
+// For each product, the rows (products) that use it as an input: the
+// transpose of the engine's matrix, for walking the graph downstream
+class ConsumerIndex
+{
+    public:
+        vector<uint64_t> consumerStart;   // size productCount()+1
+        vector<uint32_t> consumers;
+};
+
+
+void buildConsumerIndex(const PriceEngine& engine, ConsumerIndex& index)
+{
+    const size_t n = engine.productCount();
+    index.consumerStart.assign(n + 1, 0);
+    for (uint64_t k = 0; k < engine.nonzeroCount(); k++) index.consumerStart[engine.inputIndex[k] + 1]++;
+    for (size_t c = 0; c < n; c++) index.consumerStart[c+1] += index.consumerStart[c];
+
+    index.consumers.resize(engine.nonzeroCount());
+    vector<uint64_t> fillPosition(index.consumerStart.begin(), index.consumerStart.end() - 1);
+    for (size_t r = 0; r < n; r++)
+    {
+        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+        {
+            index.consumers[fillPosition[engine.inputIndex[k]]++] = r;
+        }
+    }
+}
+
+
+// turns the engine back into raw table entries (quantities, not coefficients)
+void engineToEntries(const PriceEngine& engine, vector<TableEntry>& entries)
+{
+    entries.clear();
+    entries.reserve(engine.nonzeroCount() + 2 * engine.productCount());
+    for (size_t r = 0; r < engine.productCount(); r++)
+    {
+        long int product = engine.upcs[r];
+        entries.push_back({product, 0, engine.laborOnly[r] * engine.output[r]});
+        entries.push_back({product, 1, engine.output[r]});
+        for (size_t j = 0; j < engine.resourceCount(); j++)
+        {
+            double perUnit = engine.resourceOnly[r * engine.resourceCount() + j];
+            if (perUnit != 0) entries.push_back({product, engine.resourceCodes[j], perUnit * engine.output[r]});
+        }
+        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+        {
+            entries.push_back({product, engine.upcs[engine.inputIndex[k]], engine.coeffs[k] * engine.output[r]});
+        }
+    }
+}
+
+
+// Looks up each product's price in a UPC-keyed map; products missing from
+// it get their labor-only price. Returns how many were found.
+size_t densePricesFromMap(const PriceEngine& engine,
+                          const unordered_map<long int, double>& priceMap,
+                          vector<double>& prices)
+{
+    size_t found{0};
+    prices.assign(engine.laborOnly.begin(), engine.laborOnly.end());
+    for (size_t r = 0; r < engine.productCount(); r++)
+    {
+        auto entry = priceMap.find(engine.upcs[r]);
+        if (entry == priceMap.end()) continue;
+        prices[r] = entry->second;
+        found++;
+    }
+    return found;
+}
+
+
+// The point every solve starts iterating from: direct labor per unit, or,
+// with --warm-start, the prices of an earlier solve (products the earlier
+// solve didn't have fall back to direct labor)
+void startingPrices(const PriceEngine& engine,
+                    const RunOptions&  options,
+                    vector<double>&    prices)
+{
+    if (!options.warmStartFile)
+    {
+        prices.assign(engine.laborOnly.begin(), engine.laborOnly.end());
+        return;
+    }
+
+    unordered_map<long int, double> previousPrices;
+    loadPricesFromFile(options.warmStartFile, previousPrices);
+    size_t seeded = densePricesFromMap(engine, previousPrices, prices);
+
+    cout << "Warm start: seeded " << seeded << " of " << engine.productCount() << " products from "
+         << options.warmStartFile << " (" << engine.productCount() - seeded << " start from labor only)" << endl;
+}
+
+
+// the dense prices as a table for the output functions (see priceFiles.hpp)
+PriceTable priceTable(const PriceEngine& engine, const vector<double>& densePrices)
+{
+    PriceTable table;
+    table.upcs   = engine.upcs.data();
+    table.values = densePrices.data();
+    table.count  = engine.productCount();
+    return table;
+}
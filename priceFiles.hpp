@@ -0,0 +1,337 @@
+// header file for writing and reading price files.
+//
+// Prices are written from the dense arrays the solvers work on, so they
+// come out in ascending UPC order at no cost. CSV rows are formatted with
+// std::to_chars, which gives the shortest text that reads back as exactly
+// the same double, into large buffers that are written with one call each;
+// big outputs are formatted by several threads at once, a block of rows
+// each, and written in order.
+//
+// With --binary, -o instead writes a binary price file that can be
+// memory-mapped as it is:
+//
+//     offset 0    PriceFileHeader (magic "PLECPRPF", version, byte order
+//                 mark, counts, and the offset of every array below)
+//     then        upcs           int64[productCount]
+//                 resourceCodes  int64[width - 1], the codes of the columns after labor
+//                 values         double[productCount * width], row by row
+//
+// Arrays start on 64-byte boundaries. --warm-start and --base read either
+// kind of file, telling them apart by the magic number.
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include <charconv>
+#include <cstring>
+using namespace std;
+
+const char     PRICE_FILE_MAGIC[8]   = {'P','L','E','C','P','R','P','F'};
+const uint32_t PRICE_FILE_VERSION    = 1;
+const uint32_t PRICE_FILE_BYTE_ORDER = 0x01020304;
+const uint64_t PRICE_FILE_ALIGNMENT  = 64;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// Prices to write: width values per product (labor first, then the
+// resources of resourceCodes), products in the order of upcs
+class PriceTable
+{
+    public:
+        const long int*  upcs{nullptr};
+        const double*    values{nullptr};
+        size_t           count{0};
+        size_t           width{1};
+        vector<long int> resourceCodes;
+        bool             quantities{false};     // gross output and labor per product (--quantity), not prices
+        vector<string>   scenarioNames;         // --scenarios: a price column for each, after the table's own
+};
+
+class PriceFileHeader
+{
+    public:
+        char     magic[8];
+        uint32_t version;
+        uint32_t byteOrderMark;
+        uint64_t productCount;
+        uint64_t width;
+
+        // byte offsets from the start of the file
+        uint64_t upcsOffset;
+        uint64_t resourceCodesOffset;
+        uint64_t valuesOffset;
+        uint64_t fileSize;
+};
+
+
+
+
+/*///////////////////////
+    UTILITY FUNCTIONS
+///////////////////////*/
+
+
+uint64_t alignPriceOffset(uint64_t offset)
+{
+    return (offset + PRICE_FILE_ALIGNMENT - 1) / PRICE_FILE_ALIGNMENT * PRICE_FILE_ALIGNMENT;
+}
+
+
+void layOutPriceFile(PriceFileHeader& header, uint64_t productCount, uint64_t width)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PRICE_FILE_MAGIC, sizeof(header.magic));
+    header.version       = PRICE_FILE_VERSION;
+    header.byteOrderMark = PRICE_FILE_BYTE_ORDER;
+    header.productCount  = productCount;
+    header.width         = width;
+
+    header.upcsOffset          = alignPriceOffset(sizeof(header));
+    header.resourceCodesOffset = alignPriceOffset(header.upcsOffset          + productCount * sizeof(long int));
+    header.valuesOffset        = alignPriceOffset(header.resourceCodesOffset + (width - 1)  * sizeof(long int));
+    header.fileSize            = header.valuesOffset + productCount * width * sizeof(double);
+}
+
+
+// true if the file starts with the binary price file magic number
+bool isBinaryPriceFile(const char* fileLoc)
+{
+    ifstream fin(fileLoc, ios::in | ios::binary);
+    char magic[sizeof(PRICE_FILE_MAGIC)]{};
+
+    if (!fin.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, PRICE_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+
+// Formats rows [firstRow, lastRow) of the table into text, appended to out.
+// CSV rows are "upc,value,value..."; console rows read "upc: value lh/unit"
+// followed by each resource (or scenario), or "upc: output units, labor lh"
+// for quantities.
+void formatPriceRows(const PriceTable& table,
+                     size_t            firstRow,
+                     size_t            lastRow,
+                     bool              console,
+                     string&           out)
+{
+    char number[32];
+    auto append = [&](auto value)
+    {
+        out.append(number, to_chars(number, number + sizeof(number), value).ptr);
+    };
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        const double* values = table.values + r * table.width;
+        append(table.upcs[r]);
+        if (!console)
+        {
+            for (size_t j = 0; j < table.width; j++)
+            {
+                out += ',';
+                append(values[j]);
+            }
+        }
+        else if (table.quantities)
+        {
+            out += ": ";
+            append(values[0]);
+            out += " units, ";
+            append(values[1]);
+            out += " lh";
+        }
+        else
+        {
+            out += ": ";
+            append(values[0]);
+            out += " lh/unit";
+            for (size_t j = 1; j < table.width; j++)
+            {
+                out += ", ";
+                append(values[j]);
+                if (!table.scenarioNames.empty())
+                {
+                    out += " lh/unit in ";
+                    out += table.scenarioNames[j-1];
+                    continue;
+                }
+                out += " of resource ";
+                append(table.resourceCodes[j-1]);
+                out += "/unit";
+            }
+        }
+        out += '\n';
+    }
+}
+
+
+// Writes every row of the table to out. Rows are formatted a block per
+// thread, a round of blocks at a time, and each round is written in order
+// with one call per block.
+void writePriceRows(const PriceTable& table, bool console, FILE* out)
+{
+    const size_t BLOCK_ROWS = 1 << 16;     // not worth a thread below this
+
+    size_t threadCount = max(1u, thread::hardware_concurrency());
+    threadCount = min(threadCount, table.count / BLOCK_ROWS + 1);
+
+    vector<string> blocks(threadCount);
+    for (size_t roundStart = 0; roundStart < table.count; roundStart += threadCount * BLOCK_ROWS)
+    {
+        auto formatBlock = [&](size_t t)
+        {
+            size_t first = min(table.count, roundStart + t * BLOCK_ROWS);
+            size_t last  = min(table.count, first + BLOCK_ROWS);
+            blocks[t].clear();
+            formatPriceRows(table, first, last, console, blocks[t]);
+        };
+
+        vector<thread> formatters;
+        for (size_t t = 1; t < threadCount; t++) formatters.emplace_back(formatBlock, t);
+        formatBlock(0);
+        for (thread& formatter : formatters) formatter.join();
+
+        for (const string& block : blocks)
+        {
+            if (fwrite(block.data(), 1, block.size(), out) != block.size()) throw bad_file();
+        }
+    }
+}
+
+
+
+
+/*///////////////////////
+    OUTPUT FUNCTIONS
+///////////////////////*/
+
+
+// writes the table as CSV (with a header), or as a binary price file
+void savePricesToFile(const PriceTable& table, const char* outputFile, bool binary = false)
+{
+    FILE* out = fopen(outputFile, "wb");
+    if (!out) throw bad_file();
+    cout << "\nSaving data..." << endl;
+
+    try
+    {
+        if (binary)
+        {
+            PriceFileHeader header;
+            layOutPriceFile(header, table.count, table.width);
+
+            // writes one array at its offset, padding with zeros up to it
+            uint64_t written{0};
+            auto writeSection = [&](uint64_t offset, const void* data, size_t bytes)
+            {
+                static const char padding[PRICE_FILE_ALIGNMENT]{};
+                if (fwrite(padding, 1, offset - written, out) != offset - written) throw bad_file();
+                if (bytes && fwrite(data, 1, bytes, out) != bytes)                 throw bad_file();
+                written = offset + bytes;
+            };
+            writeSection(0,                          &header,                     sizeof(header));
+            writeSection(header.upcsOffset,          table.upcs,                  table.count * sizeof(long int));
+            writeSection(header.resourceCodesOffset, table.resourceCodes.data(),  table.resourceCodes.size() * sizeof(long int));
+            writeSection(header.valuesOffset,        table.values,                table.count * table.width * sizeof(double));
+        }
+        else
+        {
+            string header(table.quantities ? "ProductUPC,Output,Labor" : "ProductUPC,Price");
+            for (long int code : table.resourceCodes) header += ",Resource" + to_string(code);
+            for (const string& name : table.scenarioNames) header += "," + name;
+            header += '\n';
+            if (fwrite(header.data(), 1, header.size(), out) != header.size()) throw bad_file();
+
+            writePriceRows(table, false, out);
+        }
+    }
+    catch (...)
+    {
+        fclose(out);
+        throw;
+    }
+    if (fclose(out) != 0) throw bad_file();
+
+    cout << "Prices data saved to: " << outputFile << endl << endl;
+}
+
+
+void printPrices(const PriceTable& table)
+{
+    cout << flush;
+    writePriceRows(table, true, stdout);
+    fflush(stdout);
+}
+
+
+// Reads the labor values of a price file written by savePricesToFile,
+// either a CSV (whose header must name a Price column first) or a binary
+// price file
+void loadPricesFromFile(const char* pricesFile, unordered_map<long int, double>& prices)
+{
+    if (isBinaryPriceFile(pricesFile))
+    {
+        MappedFile mapping(pricesFile);
+
+        PriceFileHeader header;
+        if (mapping.size < sizeof(header)) throw malformed_table("Price file is truncated.");
+        memcpy(&header, mapping.data, sizeof(header));
+
+        if (header.byteOrderMark != PRICE_FILE_BYTE_ORDER)
+        {
+            throw malformed_table("Price file was written on a machine with a different byte order.");
+        }
+        if (header.version != PRICE_FILE_VERSION)
+        {
+            throw malformed_table("Price file version " + to_string(header.version) + " is not supported.");
+        }
+
+        // recompute the layout rather than trusting the offsets blindly
+        PriceFileHeader expected;
+        layOutPriceFile(expected, header.productCount, max<uint64_t>(header.width, 1));
+        if (memcmp(&expected, &header, sizeof(header)) != 0 || mapping.size < header.fileSize)
+        {
+            throw malformed_table("Price file is truncated or corrupt.");
+        }
+
+        const long int* upcs   = (const long int*) (mapping.data + header.upcsOffset);
+        const double*   values = (const double*)   (mapping.data + header.valuesOffset);
+        prices.reserve(prices.size() + header.productCount);
+        for (uint64_t r = 0; r < header.productCount; r++) prices[upcs[r]] = values[r * header.width];
+        return;
+    }
+
+    ifstream fin(pricesFile, ios::in);
+    if (!fin.good()) throw bad_file();
+
+    // the labor value is the first column only in files of prices, not in
+    // --quantity output ("ProductUPC,Output,Labor")
+    string file_line("");
+    getline(fin, file_line, '\n');
+    if (!file_line.empty() && file_line.back() == '\r') file_line.pop_back();
+    if (file_line != "ProductUPC,Price" && file_line.rfind("ProductUPC,Price,", 0) != 0)
+    {
+        throw malformed_table("Not a prices file written with -o (its header is \"" + file_line + "\").");
+    }
+
+    while (getline(fin, file_line, '\n'))
+    {
+        if (file_line.empty() || file_line == "\r") continue;
+
+        long int upc{0};
+        double   price{0};
+        const char* lineEnd = file_line.data() + file_line.size();
+        auto upcParse = from_chars(file_line.data(), lineEnd, upc);
+        bool parsed   = upcParse.ec == errc() && upcParse.ptr < lineEnd && *upcParse.ptr == ',';
+        if (parsed) parsed = from_chars(upcParse.ptr + 1, lineEnd, price).ec == errc();
+
+        if (!parsed)
+        {
+            throw malformed_table("Unreadable line in prices file: \"" + file_line + "\"");
+        }
+        prices[upc] = price;
+    }
+}
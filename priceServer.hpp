@@ -0,0 +1,326 @@
+// header file for serving prices from a resident solver (--serve).
+//
+// Starting plecpr costs a load (or map), an index build and a whole solve
+// before the first price comes out. With --serve the executable does all of
+// that once and then stays up, keeping the engine and the converged prices
+// in memory and answering requests on a Unix domain socket (or, given "-",
+// on stdin and stdout). Requests and replies are single lines of text:
+//
+//     price UPC [UPC ...]         ok PRICE [PRICE ...]   ("unknown" for a UPC not in the table)
+//     solve [-p D] [-i N] [--tol-rel X] [--tol-res X]
+//                                 re-solves from the current prices, with these
+//                                 halting points (or the last ones); ok SECONDS
+//     delta [-p D] [-i N] [--tol-rel X] [--tol-res X] UPC,UPC QTY[; ...]
+//                                 applies delta entries, as in a --what-if file,
+//                                 and reprices what is downstream of them to
+//                                 these halting points (or the last solve's),
+//                                 as --what-if would; ok CHANGED REPRICED SWEEPS
+//     save FILE                   writes the prices as -o would; ok
+//     stats                       ok PRODUCTS NONZEROS SOLVES DELTAS
+//     quit                        closes this connection
+//     shutdown                    stops the server
+//
+// A request that can't be carried out gets "error MESSAGE" instead. Clients
+// are served on one thread, a line at a time, from a poll() loop, so
+// requests never run concurrently and need no locking. A price lookup is a
+// binary search in the engine's UPC list, so it takes microseconds.
+
+#pragma once
+#include "priceEngine.hpp"
+#include "whatIf.hpp"
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+
+// re-solves the engine's prices in place, starting from the prices given
+typedef function<void(PriceEngine&, vector<double>&, const RunOptions&)> PriceSolve;
+
+// set by SIGINT/SIGTERM, so the server can remove its socket on the way out
+volatile sig_atomic_t serverStopping = 0;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+class PriceServer
+{
+    public:
+        PriceServer(PriceEngine& engine, vector<double>& prices, const RunOptions& options, PriceSolve solve)
+            : engine(engine), prices(prices), options(options), solve(solve) {}
+
+        // Handles one request line, and returns the reply (without its
+        // newline). Sets stopping for a shutdown request.
+        string handle(const string& line)
+        {
+            istringstream request(line);
+            string        command;
+            request >> command;
+
+            try
+            {
+                if (command == "price")    return lookUp(request);
+                if (command == "solve")    return resolve(request);
+                if (command == "delta")    return applyDelta(line.substr(line.find("delta") + 5));
+                if (command == "save")     return save(request);
+                if (command == "stats")    return stats();
+                if (command == "shutdown") { stopping = true; return "ok"; }
+                return "error unknown request \"" + command + "\"";
+            }
+            catch (const exception& e)
+            {
+                // the exception classes' messages end in a newline
+                string message(e.what());
+                while (!message.empty() && isspace((unsigned char) message.back())) message.pop_back();
+                return "error " + message;
+            }
+        }
+
+        bool stopping{false};
+
+    private:
+        PriceEngine&    engine;
+        vector<double>& prices;
+        RunOptions      options;        // the halting points of the last solve
+        PriceSolve      solve;
+        ConsumerIndex   consumers;      // built on the first delta
+        size_t          solves{1};      // counting the one before serving
+        size_t          deltas{0};
+
+        string lookUp(istringstream& request)
+        {
+            string   reply("ok");
+            char     number[32];
+            long int upc;
+            while (request >> upc)
+            {
+                size_t row = engine.indexOf(upc);
+                reply += ' ';
+                if (row == engine.productCount()) reply += "unknown";
+                else reply.append(number, to_chars(number, number + sizeof(number), prices[row]).ptr);
+            }
+            if (!request.eof()) return "error unreadable UPC";
+            return reply;
+        }
+
+        // Reads the halting points (-p, -i, --tol-rel, --tol-res) in the rest
+        // of the request into given; with none, given gets the last solve's.
+        // Returns an error reply, or an empty string. Halting points the
+        // serving mode can't use throw, as they would on the command line.
+        string readHaltingPoints(istringstream& request, RunOptions& given)
+        {
+            given = options;
+            given.precision = given.iterations = 0;
+            given.relativeTolerance = given.residualTolerance = 0;
+
+            string option;
+            bool   anyGiven{false};
+            while (request >> option)
+            {
+                string value;
+                if (!(request >> value)) return "error " + option + " needs a value";
+                if      (option == "-p")        given.precision         = stoi(value);
+                else if (option == "-i")        given.iterations        = stoi(value);
+                else if (option == "--tol-rel") given.relativeTolerance = stod(value);
+                else if (option == "--tol-res") given.residualTolerance = stod(value);
+                else return "error unknown solve option \"" + option + "\"";
+                anyGiven = true;
+            }
+            if (!anyGiven) given = options;
+            checkModeOptions(given);
+            checkHaltingPoints(given);
+            return "";
+        }
+
+        string resolve(istringstream& request)
+        {
+            RunOptions given;
+            string     error = readHaltingPoints(request, given);
+            if (!error.empty()) return error;
+            given.whatIfFile = given.warmStartFile = nullptr;
+
+            auto start = chrono::high_resolution_clock::now();
+            solve(engine, prices, given);
+            options = given;
+            solves++;
+            return "ok " + to_string(chrono::duration<double>(chrono::high_resolution_clock::now() - start).count());
+        }
+
+        string applyDelta(string entries)
+        {
+            // any halting points come first; the entries start at the
+            // first token with a comma in it
+            size_t comma      = entries.find(',');
+            size_t entryStart = comma == string::npos ? entries.size() : entries.find_last_of(" \t", comma) + 1;
+            istringstream haltingPoints(entries.substr(0, entryStart));
+            entries.erase(0, entryStart);
+
+            RunOptions repriceOptions;
+            string     error = readHaltingPoints(haltingPoints, repriceOptions);
+            if (!error.empty()) return error;
+
+            replace(entries.begin(), entries.end(), ';', '\n');
+            vector<TableEntry> delta;
+            parseTableChunk(entries.data(), entries.data() + entries.size(), delta);
+            if (delta.empty()) return "error no delta entries";
+
+            WhatIfResult result = applyWhatIf(engine, delta, prices, consumers, repriceOptions);
+            deltas++;
+            return "ok " + to_string(result.changedProducts) + " " + to_string(result.repricedProducts)
+                   + " " + to_string(result.sweeps);
+        }
+
+        string save(istringstream& request)
+        {
+            string file;
+            if (!(request >> file)) return "error save needs a file";
+            savePricesToFile(priceTable(engine, prices), file.c_str(), options.binaryOutput);
+            return "ok";
+        }
+
+        string stats()
+        {
+            return "ok " + to_string(engine.productCount()) + " " + to_string(engine.nonzeroCount())
+                   + " " + to_string(solves) + " " + to_string(deltas);
+        }
+};
+
+
+
+
+/*///////////////////////
+     SERVER FUNCTIONS
+///////////////////////*/
+
+
+void stopServer(int)
+{
+    serverStopping = 1;
+}
+
+
+// When serving on stdio, stdout carries only replies: everything else
+// the run prints goes to stderr from the start
+void reserveStdoutForReplies(const RunOptions& options)
+{
+    if (options.serveSocket && string(options.serveSocket) == "-") cout.rdbuf(cerr.rdbuf());
+}
+
+
+// answers requests from stdin on stdout until end of input
+void servePricesOnStdio(PriceServer& server)
+{
+    string line;
+    while (!server.stopping && getline(cin, line))
+    {
+        if (line == "quit") break;
+        string reply = server.handle(line);
+        reply += '\n';
+        fwrite(reply.data(), 1, reply.size(), stdout);
+        fflush(stdout);
+    }
+}
+
+
+// Answers requests on a Unix domain socket at socketPath, from any number
+// of clients, until a shutdown request or SIGINT/SIGTERM
+void servePricesOnSocket(PriceServer& server, const char* socketPath)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) throw bad_option("--serve socket path is too long.");
+    strcpy(address.sun_path, socketPath);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) throw bad_file();
+    unlink(socketPath);
+    if (bind(listener, (sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        close(listener);
+        throw bad_file();
+    }
+
+    signal(SIGINT,  stopServer);
+    signal(SIGTERM, stopServer);
+    signal(SIGPIPE, SIG_IGN);
+    cout << "Serving prices on " << socketPath << endl;
+
+    vector<pollfd> sockets{{listener, POLLIN, 0}};
+    vector<string> pending{""};         // each client's unfinished request line
+    char           buffer[1 << 16];
+
+    while (!server.stopping && !serverStopping)
+    {
+        if (poll(sockets.data(), sockets.size(), -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (sockets[0].revents & POLLIN)
+        {
+            int client = accept(listener, nullptr, nullptr);
+            if (client >= 0)
+            {
+                sockets.push_back({client, POLLIN, 0});
+                pending.emplace_back();
+            }
+        }
+
+        for (size_t c = 1; c < sockets.size(); c++)
+        {
+            if (!sockets[c].revents) continue;
+
+            ssize_t received = recv(sockets[c].fd, buffer, sizeof(buffer), 0);
+            bool    closing  = received <= 0;
+            if (!closing) pending[c].append(buffer, received);
+
+            // every complete line is a request; replies go out in one send
+            string replies;
+            size_t lineStart{0}, lineEnd;
+            while (!closing && (lineEnd = pending[c].find('\n', lineStart)) != string::npos)
+            {
+                string line = pending[c].substr(lineStart, lineEnd - lineStart);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                lineStart = lineEnd + 1;
+
+                if (line == "quit") { closing = true; break; }
+                replies += server.handle(line);
+                replies += '\n';
+            }
+            pending[c].erase(0, lineStart);
+
+            for (size_t sent = 0; sent < replies.size(); )
+            {
+                ssize_t bytes = send(sockets[c].fd, replies.data() + sent, replies.size() - sent, 0);
+                if (bytes <= 0) { closing = true; break; }
+                sent += bytes;
+            }
+
+            if (closing)
+            {
+                close(sockets[c].fd);
+                sockets.erase(sockets.begin() + c);
+                pending.erase(pending.begin() + c);
+                c--;
+            }
+        }
+    }
+
+    for (const pollfd& socket : sockets) close(socket.fd);
+    unlink(socketPath);
+    cout << "Server stopped" << endl;
+}
+
+
+// serves the engine's prices on the socket (or stdio, for "-") given to --serve
+void servePrices(PriceEngine& engine, vector<double>& prices, const RunOptions& options, PriceSolve solve)
+{
+    PriceServer server(engine, prices, options, solve);
+    if (string(options.serveSocket) == "-") servePricesOnStdio(server);
+    else                                   servePricesOnSocket(server, options.serveSocket);
+}
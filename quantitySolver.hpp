@@ -0,0 +1,282 @@
+// header file for solving the quantity side of the plan (--quantity).
+//
+// The price solve finds the labor value of every product, p = l + Ap: each
+// product's price is its direct labor plus the prices of its inputs, read
+// along its row. Its dual is the plan's quantities: given a final demand d
+// (what households, investment and exports take out of the economy), the
+// gross output x that every product has to be made in so that, after all
+// the products have been made from each other, d is left over:
+//
+//     x = Ax + d,  that is  x_j = d_j + sum over products i of a_ij x_i
+//
+// The sum for product j runs down a column of A: over the products that use
+// j, each for as much of j as it takes. The engine keeps its rows, so the
+// quantity sweeps run over a transposed copy of its structure (compressed
+// columns), built from the table already loaded. A has the same spectral
+// radius either way round, so the quantity sweeps converge as fast as the
+// price sweeps do, and stop on the same -p, --tol-rel, --tol-res or -i.
+//
+// Each product's labor requirement is then its direct labor per unit times
+// its gross output, and their sum, the labor the plan needs, equals p.d, the
+// labor value of the final demand.
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include "runProfile.hpp"
+#include <functional>
+using namespace std;
+
+// out = d + A^T in, over every product; returns the change from in
+typedef function<SweepChange(const vector<double>&, vector<double>&)> QuantitySweep;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// The engine's coefficients by column: the products that use product j are
+// consumers[columnStart[j]] to consumers[columnStart[j+1] - 1], in index
+// order, and coeffs holds how much of j each uses per unit it makes
+class TransposedTable
+{
+    public:
+        vector<uint64_t> columnStart;     // size productCount()+1
+        vector<uint32_t> consumers;
+        vector<double>   coeffs;
+};
+
+
+class QuantityResult
+{
+    public:
+        int    sweeps{0};
+        size_t demandedProducts{0};     // products with a final demand
+        double totalLabor{0};           // person-hours over the whole plan
+};
+
+
+
+
+/*///////////////////////
+    TABLE FUNCTIONS
+///////////////////////*/
+
+
+// Builds the column copy of the engine's structure, the same way the
+// consumer index is built, with the coefficients carried along
+void buildTransposedTable(const PriceEngine& engine, TransposedTable& transposed)
+{
+    const size_t n = engine.productCount();
+    transposed.columnStart.assign(n + 1, 0);
+    for (uint64_t k = 0; k < engine.nonzeroCount(); k++) transposed.columnStart[engine.inputIndex[k] + 1]++;
+    for (size_t c = 0; c < n; c++) transposed.columnStart[c+1] += transposed.columnStart[c];
+
+    transposed.consumers.resize(engine.nonzeroCount());
+    transposed.coeffs.resize(engine.nonzeroCount());
+    vector<uint64_t> fillPosition(transposed.columnStart.begin(), transposed.columnStart.end() - 1);
+    for (size_t r = 0; r < n; r++)
+    {
+        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+        {
+            uint64_t position = fillPosition[engine.inputIndex[k]]++;
+            transposed.consumers[position] = r;
+            transposed.coeffs[position]    = engine.coeffs[k];
+        }
+    }
+}
+
+
+// Cuts the columns into parts ranges holding about the same number of
+// nonzeros each: bounds[t] to bounds[t+1] is part t's
+vector<size_t> partitionColumns(const TransposedTable& transposed, size_t parts)
+{
+    const size_t n = transposed.columnStart.size() - 1;
+    vector<size_t> bounds(parts + 1, n);
+    bounds[0] = 0;
+
+    size_t column{0};
+    for (size_t t = 1; t < parts; t++)
+    {
+        uint64_t target = transposed.consumers.size() * t / parts;
+        while (column < n && transposed.columnStart[column] < target) column++;
+        bounds[t] = column;
+    }
+    return bounds;
+}
+
+
+// Reads the final demand, one "UPC,quantity" line per product (lines for
+// the same product add up), into demand, indexed like the engine. Returns
+// how many products have a demand.
+size_t loadFinalDemand(const PriceEngine& engine, const char* fileLoc, vector<double>& demand)
+{
+    MappedFile demandFile(fileLoc);
+    demand.assign(engine.productCount(), 0.0);
+    vector<bool> demanded(engine.productCount(), false);
+    size_t       found{0};
+
+    const char* cursor  = demandFile.data;
+    const char* fileEnd = demandFile.data + demandFile.size;
+    while (cursor < fileEnd)
+    {
+        const char* lineEnd = (const char*) memchr(cursor, '\n', fileEnd - cursor);
+        if (!lineEnd) lineEnd = fileEnd;
+        while (cursor < lineEnd && isspace((unsigned char) *cursor)) cursor++;
+        if (cursor == lineEnd)
+        {
+            cursor = lineEnd + 1;
+            continue;
+        }
+
+        long int upc{0};
+        double   quantity{0};
+        auto upcParse = from_chars(cursor, lineEnd, upc);
+        bool parsed   = upcParse.ec == errc() && upcParse.ptr < lineEnd && *upcParse.ptr == ',';
+        if (parsed) parsed = from_chars(upcParse.ptr + 1, lineEnd, quantity).ec == errc();
+        if (!parsed)
+        {
+            throw malformed_table("Unreadable line in final demand file: \"" + string(cursor, lineEnd) + "\"");
+        }
+
+        size_t row = engine.indexOf(upc);
+        if (row == engine.productCount())
+        {
+            throw malformed_table("Final demand for product " + to_string(upc) + ", which the table doesn't have.");
+        }
+        demand[row] += quantity;
+        if (!demanded[row]) { demanded[row] = true; found++; }
+        cursor = lineEnd + 1;
+    }
+    return found;
+}
+
+
+
+
+/*///////////////////////
+     SWEEP FUNCTIONS
+///////////////////////*/
+
+
+// Jacobi sweep of columns [firstColumn, lastColumn): out = d + A^T in.
+// Returns the change from in over these columns.
+SweepChange quantitySweep(const TransposedTable& transposed,
+                          const vector<double>&  demand,
+                          const vector<double>&  prevIterOutput,
+                          vector<double>&        output,
+                          size_t                 firstColumn,
+                          size_t                 lastColumn)
+{
+    const uint64_t* columnStart = transposed.columnStart.data();
+    const uint32_t* consumers   = transposed.consumers.data();
+    const double*   coeffs      = transposed.coeffs.data();
+    const double*   prevOutput  = prevIterOutput.data();
+    SweepChange     change;
+
+    for (size_t c = firstColumn; c < lastColumn; c++)
+    {
+        double quantity = demand[c];
+        for (uint64_t k = columnStart[c]; k < columnStart[c+1]; k++)
+        {
+            quantity += coeffs[k] * prevOutput[consumers[k]];
+        }
+        change.add(prevOutput[c], quantity);
+        output[c] = quantity;
+    }
+    return change;
+}
+
+
+
+
+/*///////////////////////
+     SOLVER FUNCTIONS
+///////////////////////*/
+
+
+// Sweeps the gross output from the final demand until the tolerances are
+// met, or -i times. output comes in holding the demand and leaves holding
+// the gross output. Returns the sweeps made.
+int solveQuantities(const QuantitySweep& sweep,
+                    vector<double>&      output,
+                    const RunOptions&    options)
+{
+    vector<double> prevIterOutput(output.size());
+    SweepChange    change;
+    int sweeps{0};
+    while (true)
+    {
+        prevIterOutput.swap(output);
+        change = sweep(prevIterOutput, output);
+        sweeps++;
+
+        cout << "iteration " << sweeps << " complete" << endl;
+        if (options.stopsOnTolerance() ? profiledToleranceMet(change, options) : sweeps >= options.iterations) break;
+    }
+    return sweeps;
+}
+
+
+// Lays the gross output out for the output functions, two values per
+// product: its gross output, then the labor it takes. Returns the total labor.
+double quantityBlock(const PriceEngine& engine, const vector<double>& output, vector<double>& block)
+{
+    double totalLabor{0};
+    block.resize(2 * engine.productCount());
+    for (size_t r = 0; r < engine.productCount(); r++)
+    {
+        block[2*r]     = output[r];
+        block[2*r + 1] = engine.laborOnly[r] * output[r];
+        totalLabor    += block[2*r + 1];
+    }
+    return totalLabor;
+}
+
+
+// The whole quantity solve: read the final demand, transpose the table and
+// sweep the gross output. sweepOf gets the transposed table and the demand
+// and returns the sweep to use, so plecpr-mt can split it between threads.
+// block gets two values per product (see quantityBlock).
+QuantityResult calcQuantities(const PriceEngine& engine,
+                              const function<QuantitySweep(const TransposedTable&, const vector<double>&)>& sweepOf,
+                              vector<double>&    block,
+                              const RunOptions&  options)
+{
+    QuantityResult result;
+    vector<double> demand;
+    result.demandedProducts = loadFinalDemand(engine, options.demandFile, demand);
+
+    TransposedTable transposed;
+    buildTransposedTable(engine, transposed);
+
+    if (options.stopsOnTolerance()) cout << "Now solving for gross output until " << describeTolerances(options) << endl;
+    else                            cout << "\nNow solving for gross output." << endl;
+
+    vector<double> output(demand);
+    result.sweeps     = solveQuantities(sweepOf(transposed, demand), output, options);
+    result.totalLabor = quantityBlock(engine, output, block);
+    return result;
+}
+
+
+void printQuantityResult(const QuantityResult& result)
+{
+    cout << "Gross output for the final demand of " << result.demandedProducts << " products solved in "
+         << result.sweeps << " sweeps; the plan takes " << result.totalLabor << " person-hours" << endl;
+}
+
+
+// the block as a table for the output functions (see priceFiles.hpp):
+// "Output" and "Labor" columns rather than prices
+PriceTable quantityTable(const PriceEngine& engine, const vector<double>& block)
+{
+    PriceTable table;
+    table.upcs       = engine.upcs.data();
+    table.values     = block.data();
+    table.count      = engine.productCount();
+    table.width      = 2;
+    table.quantities = true;
+    return table;
+}
@@ -0,0 +1,287 @@
+// header file for reordering products for locality (--reorder).
+//
+// Products are indexed in UPC order, and UPCs say nothing about which
+// products are used together, so the inputs of a row are scattered over the
+// whole price vector and every sweep's gathers miss the cache (and the TLB)
+// on any table much bigger than it. With --reorder the products are
+// renumbered so that those used together get nearby indices. The table is
+// taken as an undirected graph, a product being next to its inputs and to
+// its consumers, and ordered in one of two ways:
+//
+//   - rcm: reverse Cuthill-McKee, a breadth-first search from a product of
+//     least degree, visiting each product's neighbours least-connected
+//     first, with the whole order reversed at the end. This keeps the
+//     bandwidth of tables that are nearly banded (supply chains) small, but
+//     on tables with a power-law in-degree the search reaches everything
+//     through the few hubs within a couple of levels, and barely helps.
+//   - communities: label propagation first splits the products into
+//     communities that mostly trade among themselves (sectors, in effect),
+//     each is made contiguous, and RCM orders the products within it.
+//
+// Neither is used unless asked for.
+//
+// The solve then runs on a renumbered copy of the engine, and the prices are
+// put back in UPC order afterwards. Each row keeps its inputs in the same
+// order, so Jacobi sweeps add them up in the same order and give exactly the
+// same prices; Gauss-Seidel and SOR visit the rows in the new order, so
+// theirs differ within the tolerances. The rows are therefore no longer
+// sorted by input index; the Krylov solvers sort their own copy (see
+// buildSystemMatrix).
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include <algorithm>
+using namespace std;
+
+// most rounds of label propagation when looking for communities
+const int COMMUNITY_ROUNDS = 5;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// The engine renumbered: row i of engine is row order[i] of the original.
+// Its upcs are in the new order, not sorted, so indexOf can't be used on it.
+class ReorderedTable
+{
+    public:
+        vector<uint32_t> order;
+        PriceEngine      engine;
+};
+
+
+
+
+/*///////////////////////
+    ORDERING FUNCTIONS
+///////////////////////*/
+
+
+// Reverse Cuthill-McKee order of the engine's products: order[i] is the
+// product to put i-th. Every connected part of the table is ordered in turn,
+// each from its least connected product.
+void reverseCuthillMcKee(const PriceEngine& engine, const ConsumerIndex& consumers, vector<uint32_t>& order)
+{
+    const size_t n = engine.productCount();
+
+    vector<uint64_t> degree(n);
+    for (size_t r = 0; r < n; r++)
+    {
+        degree[r] = (engine.rowStart[r+1] - engine.rowStart[r]) + (consumers.consumerStart[r+1] - consumers.consumerStart[r]);
+    }
+    auto lessConnected = [&degree](uint32_t a, uint32_t b)
+    {
+        return degree[a] < degree[b] || (degree[a] == degree[b] && a < b);
+    };
+
+    vector<uint32_t> byDegree(n);
+    for (size_t r = 0; r < n; r++) byDegree[r] = r;
+    sort(byDegree.begin(), byDegree.end(), lessConnected);
+
+    vector<bool>     placed(n, false);
+    vector<uint32_t> neighbours;
+    order.clear();
+    order.reserve(n);
+
+    for (uint32_t start : byDegree)
+    {
+        if (placed[start]) continue;
+        placed[start] = true;
+        order.push_back(start);
+
+        for (size_t head = order.size() - 1; head < order.size(); head++)
+        {
+            uint32_t r = order[head];
+            neighbours.clear();
+            for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+            {
+                uint32_t input = engine.inputIndex[k];
+                if (!placed[input]) { placed[input] = true; neighbours.push_back(input); }
+            }
+            for (uint64_t k = consumers.consumerStart[r]; k < consumers.consumerStart[r+1]; k++)
+            {
+                uint32_t consumer = consumers.consumers[k];
+                if (!placed[consumer]) { placed[consumer] = true; neighbours.push_back(consumer); }
+            }
+            sort(neighbours.begin(), neighbours.end(), lessConnected);
+            order.insert(order.end(), neighbours.begin(), neighbours.end());
+        }
+    }
+
+    reverse(order.begin(), order.end());
+}
+
+
+// Finds communities by label propagation: every product starts in its own,
+// then, a round at a time, joins the one most of its neighbours are in (ties
+// going to the lowest label), until hardly any product moves. community[r]
+// is product r's community, named after one of its products. Returns the
+// number of communities.
+size_t findCommunities(const PriceEngine& engine, const ConsumerIndex& consumers, vector<uint32_t>& community)
+{
+    const size_t n = engine.productCount();
+    community.resize(n);
+    for (size_t r = 0; r < n; r++) community[r] = r;
+
+    vector<uint32_t> votes(n, 0);
+    vector<uint32_t> candidates;
+    for (int round = 0; round < COMMUNITY_ROUNDS; round++)
+    {
+        size_t moved{0};
+        for (size_t r = 0; r < n; r++)
+        {
+            candidates.clear();
+            auto vote = [&](uint32_t neighbour)
+            {
+                uint32_t c = community[neighbour];
+                if (votes[c]++ == 0) candidates.push_back(c);
+            };
+            for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++) vote(engine.inputIndex[k]);
+            for (uint64_t k = consumers.consumerStart[r]; k < consumers.consumerStart[r+1]; k++) vote(consumers.consumers[k]);
+
+            uint32_t best = community[r], bestVotes = votes[best];
+            for (uint32_t c : candidates)
+            {
+                if (votes[c] > bestVotes || (votes[c] == bestVotes && c < best)) { best = c; bestVotes = votes[c]; }
+                votes[c] = 0;
+            }
+            if (best != community[r]) { community[r] = best; moved++; }
+        }
+        if (moved <= n / 1000) break;
+    }
+
+    size_t count{0};
+    for (size_t r = 0; r < n; r++) if (community[r] == r) count++;
+    return count;
+}
+
+
+// Reorders products so each community is contiguous, keeping the order
+// given within each one; communities come in the order they first appear
+void groupByCommunity(const vector<uint32_t>& community, vector<uint32_t>& order)
+{
+    vector<uint32_t> rank(community.size(), UINT32_MAX);
+    uint32_t next{0};
+    for (uint32_t r : order) if (rank[community[r]] == UINT32_MAX) rank[community[r]] = next++;
+
+    stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        return rank[community[a]] < rank[community[b]];
+    });
+}
+
+
+// Builds the engine with its products in the given order (see ReorderedTable)
+void permuteEngine(const PriceEngine& engine, const vector<uint32_t>& order, PriceEngine& reordered)
+{
+    const size_t n     = engine.productCount();
+    const size_t width = engine.resourceCount();
+
+    vector<uint32_t> position(n);
+    for (size_t i = 0; i < n; i++) position[order[i]] = i;
+
+    vector<long int> upcs(n);
+    vector<uint64_t> rowStart(n + 1, 0);
+    vector<uint32_t> inputIndex(engine.nonzeroCount());
+    vector<double>   coeffs(engine.nonzeroCount());
+    vector<double>   laborOnly(n);
+    vector<double>   output(n);
+    vector<double>   resourceOnly(n * width);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t r = order[i];
+        upcs[i]      = engine.upcs[r];
+        laborOnly[i] = engine.laborOnly[r];
+        output[i]    = engine.output[r];
+        for (size_t j = 0; j < width; j++) resourceOnly[i * width + j] = engine.resourceOnly[r * width + j];
+
+        // the row's inputs stay in their order, only renumbered
+        uint64_t next = rowStart[i];
+        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++, next++)
+        {
+            inputIndex[next] = position[engine.inputIndex[k]];
+            coeffs[next]     = engine.coeffs[k];
+        }
+        rowStart[i+1] = next;
+    }
+
+    vector<long int> resourceCodes(engine.resourceCodes.begin(), engine.resourceCodes.end());
+    reordered.adoptArrays(move(upcs), move(rowStart), move(inputIndex), move(coeffs), move(laborOnly), move(output));
+    reordered.adoptResources(move(resourceCodes), move(resourceOnly));
+}
+
+
+// the mean distance between a product's index and its inputs' indices,
+// a rough measure of how far apart each sweep's gathers land
+double meanInputDistance(const PriceEngine& engine)
+{
+    if (engine.nonzeroCount() == 0) return 0;
+
+    double total{0};
+    for (size_t r = 0; r < engine.productCount(); r++)
+    {
+        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+        {
+            total += abs((double) engine.inputIndex[k] - (double) r);
+        }
+    }
+    return total / engine.nonzeroCount();
+}
+
+
+// Renumbers the engine's products in reverse Cuthill-McKee order, grouped
+// by community first unless only RCM was asked for
+void reorderTable(const PriceEngine& engine, Reordering reordering, ReorderedTable& reordered)
+{
+    cout << "\nReordering products..." << endl;
+    ConsumerIndex consumers;
+    buildConsumerIndex(engine, consumers);
+
+    reverseCuthillMcKee(engine, consumers, reordered.order);
+    if (reordering == Reordering::COMMUNITIES)
+    {
+        vector<uint32_t> community;
+        size_t count = findCommunities(engine, consumers, community);
+        groupByCommunity(community, reordered.order);
+        cout << "Found " << count << " communities" << endl;
+    }
+    permuteEngine(engine, reordered.order, reordered.engine);
+
+    cout << "Mean distance from a product to its inputs: " << meanInputDistance(engine)
+         << " before, " << meanInputDistance(reordered.engine) << " after" << endl;
+}
+
+
+
+
+/*///////////////////////
+   PERMUTING FUNCTIONS
+///////////////////////*/
+
+
+// puts width values per product, in UPC order, into the reordered table's order
+void toReorderedOrder(const ReorderedTable& reordered, vector<double>& values, size_t width = 1)
+{
+    vector<double> permuted(values.size());
+    for (size_t i = 0; i < reordered.order.size(); i++)
+    {
+        copy_n(values.begin() + reordered.order[i] * width, width, permuted.begin() + i * width);
+    }
+    values.swap(permuted);
+}
+
+
+// puts width values per product back from the reordered table's order into UPC order
+void toTableOrder(const ReorderedTable& reordered, vector<double>& values, size_t width = 1)
+{
+    vector<double> permuted(values.size());
+    for (size_t i = 0; i < reordered.order.size(); i++)
+    {
+        copy_n(values.begin() + i * width, width, permuted.begin() + reordered.order[i] * width);
+    }
+    values.swap(permuted);
+}
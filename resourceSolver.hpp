@@ -0,0 +1,143 @@
+// header file for solving for several embodied resources at once.
+//
+// Labor is not the only primary input a table can record: input codes 2 to 9
+// hold others, such as energy, emissions or scarce materials. The embodied
+// amount of each follows the same recurrence as the labor value,
+//
+//     x[r] = direct[r] + sum_k coeffs[k] * x[inputIndex[k]],
+//
+// with only the direct term differing. So rather than sweeping the matrix
+// once per resource, these sweeps carry a block of 1 + resourceCount()
+// values per product (labor first, then each resource in code order) and
+// update the whole block for every nonzero they read: a sparse
+// matrix-matrix product instead of a matrix-vector one. The matrix is read
+// once per sweep however many resources there are.
+
+#pragma once
+#include "priceEngine.hpp"
+using namespace std;
+
+// labor plus every resource code
+const size_t MAX_RESOURCE_COLUMNS = 1 + (LAST_RESOURCE_CODE - FIRST_RESOURCE_CODE + 1);
+
+
+/*///////////////////////
+     BLOCK FUNCTIONS
+///////////////////////*/
+
+
+// values per product in a resource block
+size_t resourceColumns(const PriceEngine& engine)
+{
+    return 1 + engine.resourceCount();
+}
+
+
+// the direct term of every column: labor, then each resource, per unit
+void directResourceBlock(const PriceEngine& engine, vector<double>& direct)
+{
+    const size_t width = resourceColumns(engine);
+    direct.resize(engine.productCount() * width);
+    for (size_t r = 0; r < engine.productCount(); r++)
+    {
+        direct[r * width] = engine.laborOnly[r];
+        for (size_t j = 1; j < width; j++) direct[r * width + j] = engine.resourceOnly[r * (width - 1) + j - 1];
+    }
+}
+
+
+// The block the sweeps start from: the labor column from laborPrices (as
+// set up by startingPrices, so it can be warm-started), the other columns
+// from direct use alone.
+void startingResourceBlock(const PriceEngine&    engine,
+                           const vector<double>& laborPrices,
+                           vector<double>&       block)
+{
+    const size_t width = resourceColumns(engine);
+    directResourceBlock(engine, block);
+    for (size_t r = 0; r < engine.productCount(); r++) block[r * width] = laborPrices[r];
+}
+
+
+// One Jacobi sweep of rows [firstRow, lastRow) for a block Width values wide.
+// Returns how far the sweep moved the block, over all columns.
+template <size_t Width>
+SweepChange jacobiSweepBlockOf(const PriceEngine&    engine,
+                               const vector<double>& direct,
+                               const vector<double>& prevBlock,
+                               vector<double>&       block,
+                               size_t                firstRow,
+                               size_t                lastRow)
+{
+    const uint64_t* rowStart   = engine.rowStart.data();
+    const uint32_t* inputIndex = engine.inputIndex.data();
+    const double*   coeffs     = engine.coeffs.data();
+    const double*   prev       = prevBlock.data();
+    SweepChange     change;
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double sum[Width];
+        for (size_t j = 0; j < Width; j++) sum[j] = direct[r * Width + j];
+
+        for (uint64_t k = rowStart[r]; k < rowStart[r+1]; k++)
+        {
+            const double  coeff = coeffs[k];
+            const double* input = prev + (size_t) inputIndex[k] * Width;
+            for (size_t j = 0; j < Width; j++) sum[j] += coeff * input[j];
+        }
+
+        for (size_t j = 0; j < Width; j++)
+        {
+            change.add(prev[r * Width + j], sum[j]);
+            block[r * Width + j] = sum[j];
+        }
+    }
+    return change;
+}
+
+
+// jacobiSweepBlockOf for the engine's block width, which is known only at
+// run time; each width gets its own instantiation so the inner loops unroll
+SweepChange jacobiSweepBlock(const PriceEngine&    engine,
+                             const vector<double>& direct,
+                             const vector<double>& prevBlock,
+                             vector<double>&       block,
+                             size_t                firstRow,
+                             size_t                lastRow)
+{
+    switch (resourceColumns(engine))
+    {
+        case 1: return jacobiSweepBlockOf<1>(engine, direct, prevBlock, block, firstRow, lastRow);
+        case 2: return jacobiSweepBlockOf<2>(engine, direct, prevBlock, block, firstRow, lastRow);
+        case 3: return jacobiSweepBlockOf<3>(engine, direct, prevBlock, block, firstRow, lastRow);
+        case 4: return jacobiSweepBlockOf<4>(engine, direct, prevBlock, block, firstRow, lastRow);
+        case 5: return jacobiSweepBlockOf<5>(engine, direct, prevBlock, block, firstRow, lastRow);
+        case 6: return jacobiSweepBlockOf<6>(engine, direct, prevBlock, block, firstRow, lastRow);
+        case 7: return jacobiSweepBlockOf<7>(engine, direct, prevBlock, block, firstRow, lastRow);
+        case 8: return jacobiSweepBlockOf<8>(engine, direct, prevBlock, block, firstRow, lastRow);
+        default: return jacobiSweepBlockOf<MAX_RESOURCE_COLUMNS>(engine, direct, prevBlock, block, firstRow, lastRow);
+    }
+}
+
+
+
+
+/*///////////////////////
+    OUTPUT FUNCTIONS
+///////////////////////*/
+
+
+// the block as a table for the output functions (see priceFiles.hpp): the
+// labor value under "Price" (so the file still works with --warm-start and
+// --base), then "Resource<code>" for each other resource
+PriceTable resourcePriceTable(const PriceEngine& engine, const vector<double>& block)
+{
+    PriceTable table;
+    table.upcs          = engine.upcs.data();
+    table.values        = block.data();
+    table.count         = engine.productCount();
+    table.width         = resourceColumns(engine);
+    table.resourceCodes = vector<long int>(engine.resourceCodes.begin(), engine.resourceCodes.end());
+    return table;
+}
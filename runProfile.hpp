@@ -0,0 +1,313 @@
+// header file for profiling a run (--profile).
+//
+// The "Time taken" line at the end of a run lumps everything together. With
+// --profile, each phase (parsing or mapping the table, building the engine,
+// setting up the starting prices, solving, writing) is timed on its own,
+// every sweep is timed, and so is every convergence check between sweeps.
+// From those and the size of the table come throughputs: bytes parsed per
+// second, and nonzeros and bytes swept per second (the bytes a sweep moves
+// are estimated from the CSR layout: each nonzero's coefficient, input index
+// and input price, and each row's offsets, direct labor and two prices).
+//
+// Where the kernel allows it (Linux, with hardware counters exposed and
+// perf_event_paranoid permitting), CPU cycles, last-level cache misses and
+// branch misses are counted during the sweeps alone, over every thread.
+// Everything is written to a JSON file at the end of the run.
+
+#pragma once
+#include "priceEngine.hpp"
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// Hardware counters for the sweeps. They are opened before any sweep
+// threads start and inherited by them, and only count while enabled.
+class SweepCounters
+{
+    public:
+        static const size_t COUNT = 3;
+
+        bool     available{false};
+        string   problem;               // why not, if they aren't
+        uint64_t values[COUNT]{};
+
+        SweepCounters() = default;
+        SweepCounters(const SweepCounters&) = delete;
+        SweepCounters& operator=(const SweepCounters&) = delete;
+
+        ~SweepCounters()
+        {
+#ifdef __linux__
+            for (int fd : fds) if (fd >= 0) close(fd);
+#endif
+        }
+
+        static const char* name(size_t i)
+        {
+            static const char* names[COUNT] = {"cycles", "llc_misses", "branch_misses"};
+            return names[i];
+        }
+
+        void open()
+        {
+#ifdef __linux__
+            const uint64_t configs[COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+            for (size_t i = 0; i < COUNT; i++)
+            {
+                perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size           = sizeof(attr);
+                attr.type           = PERF_TYPE_HARDWARE;
+                attr.config         = configs[i];
+                attr.disabled       = 1;
+                attr.inherit        = 1;    // count the sweep pool's threads too
+                attr.exclude_kernel = 1;
+                attr.exclude_hv     = 1;
+                attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+                if (fds[i] < 0)
+                {
+                    problem = string("perf_event_open failed for ") + name(i) + ": " + strerror(errno);
+                    return;
+                }
+            }
+            available = true;
+#else
+            problem = "hardware counters are only read on Linux";
+#endif
+        }
+
+        void start()
+        {
+#ifdef __linux__
+            if (available) for (int fd : fds) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+        }
+
+        void stop()
+        {
+#ifdef __linux__
+            if (available) for (int fd : fds) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+        }
+
+        // reads the totals into values, scaled up if the kernel had to
+        // multiplex the counters onto fewer hardware registers
+        void read()
+        {
+#ifdef __linux__
+            for (size_t i = 0; available && i < COUNT; i++)
+            {
+                uint64_t reading[3];   // value, time enabled, time running
+                if (::read(fds[i], reading, sizeof(reading)) != (ssize_t) sizeof(reading))
+                {
+                    available = false;
+                    problem   = string("could not read ") + name(i);
+                    return;
+                }
+                values[i] = reading[2] && reading[2] < reading[1]
+                          ? (uint64_t) ((double) reading[0] * reading[1] / reading[2])
+                          : reading[0];
+            }
+#endif
+        }
+
+    private:
+        int fds[COUNT]{-1, -1, -1};
+};
+
+
+class RunProfile
+{
+    public:
+        bool enabled{false};
+
+        // called once the options are known; nothing is recorded otherwise
+        void start(const string& executable, size_t threads)
+        {
+            enabled          = true;
+            this->executable = executable;
+            this->threads    = threads;
+            runStart         = chrono::high_resolution_clock::now();
+            counters.open();
+        }
+
+        // the table being solved, and how many values each product's price has
+        void describeTable(const PriceEngine& engine, const char* fileLoc, size_t columns = 1)
+        {
+            if (!enabled) return;
+            products   = engine.productCount();
+            nonzeros   = engine.nonzeroCount();
+            tableBytes = filesystem::file_size(fileLoc);
+            sweepBytes = nonzeros * (sizeof(double) + sizeof(uint32_t) + columns * sizeof(double))
+                       + products * (sizeof(uint64_t) + 3 * columns * sizeof(double));
+        }
+
+        // adds ms to the phase, which is listed in the order first recorded
+        void addPhase(const string& phase, double ms)
+        {
+            if (!enabled) return;
+            for (auto& recorded : phases)
+            {
+                if (recorded.first == phase) { recorded.second += ms; return; }
+            }
+            phases.emplace_back(phase, ms);
+        }
+
+        void beginSweep()
+        {
+            if (!enabled) return;
+            counters.start();
+            sweepStart = chrono::high_resolution_clock::now();
+        }
+
+        void endSweep()
+        {
+            if (!enabled) return;
+            sweepMs.push_back(chrono::duration<double, milli>(chrono::high_resolution_clock::now() - sweepStart).count());
+            counters.stop();
+        }
+
+        void addCheck(double ms) { checkMs += ms; }
+
+        void saveToFile(const char* profileFile)
+        {
+            ofstream fout(profileFile, ios::out);
+            if (!fout.good()) throw bad_file();
+
+            double totalMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - runStart).count();
+            double sweepTotalMs{0}, sweepMinMs{0}, sweepMaxMs{0};
+            if (!sweepMs.empty())
+            {
+                sweepTotalMs = accumulate(sweepMs.begin(), sweepMs.end(), 0.0);
+                sweepMinMs   = *min_element(sweepMs.begin(), sweepMs.end());
+                sweepMaxMs   = *max_element(sweepMs.begin(), sweepMs.end());
+            }
+            double parseMs = phaseMs("parse");
+            counters.read();
+
+            fout << "{" << endl;
+            fout << "  \"executable\": \"" << executable << "\"," << endl;
+            fout << "  \"threads\": " << threads << "," << endl;
+            fout << "  \"products\": " << products << "," << endl;
+            fout << "  \"nonzeros\": " << nonzeros << "," << endl;
+            fout << "  \"table_bytes\": " << tableBytes << "," << endl;
+            fout << "  \"phases_ms\": {";
+            for (const auto& phase : phases) fout << "\"" << phase.first << "\": " << phase.second << ", ";
+            fout << "\"total\": " << totalMs << "}," << endl;
+            fout << "  \"sweeps\": {\"count\": " << sweepMs.size() << ", \"total_ms\": " << sweepTotalMs
+                 << ", \"mean_ms\": " << (sweepMs.empty() ? 0 : sweepTotalMs / sweepMs.size())
+                 << ", \"min_ms\": " << sweepMinMs << ", \"max_ms\": " << sweepMaxMs << ", \"each_ms\": [";
+            for (size_t i = 0; i < sweepMs.size(); i++) fout << (i ? ", " : "") << sweepMs[i];
+            fout << "]}," << endl;
+            fout << "  \"convergence_check_ms\": " << checkMs << "," << endl;
+            fout << "  \"throughput\": {\"parse_bytes_per_s\": " << perSecond(tableBytes, parseMs)
+                 << ", \"sweep_nonzeros_per_s\": " << perSecond(nonzeros * sweepMs.size(), sweepTotalMs)
+                 << ", \"sweep_bytes_per_s\": " << perSecond(sweepBytes * sweepMs.size(), sweepTotalMs) << "}," << endl;
+            if (counters.available)
+            {
+                fout << "  \"counters\": {";
+                for (size_t i = 0; i < SweepCounters::COUNT; i++)
+                {
+                    fout << (i ? ", " : "") << "\"" << SweepCounters::name(i) << "\": " << counters.values[i];
+                }
+                fout << "}" << endl;
+            }
+            else
+            {
+                fout << "  \"counters\": {\"unavailable\": \"" << counters.problem << "\"}" << endl;
+            }
+            fout << "}" << endl;
+
+            cout << "Profile saved to: " << profileFile << endl;
+        }
+
+    private:
+        string   executable;
+        size_t   threads{1};
+        size_t   products{0};
+        size_t   nonzeros{0};
+        uint64_t tableBytes{0};
+        uint64_t sweepBytes{0};     // estimated bytes one sweep moves
+
+        chrono::high_resolution_clock::time_point runStart;
+        chrono::high_resolution_clock::time_point sweepStart;
+        vector<pair<string, double>> phases;
+        vector<double> sweepMs;
+        double         checkMs{0};
+        SweepCounters  counters;
+
+        double phaseMs(const string& phase) const
+        {
+            for (const auto& recorded : phases) if (recorded.first == phase) return recorded.second;
+            return 0;
+        }
+
+        static double perSecond(double amount, double ms)
+        {
+            return ms > 0 ? amount / (ms / 1000) : 0;
+        }
+};
+
+// the run being profiled; each executable has one
+RunProfile runProfile;
+
+
+// Times the enclosing scope as a phase of the run
+class PhaseTimer
+{
+    public:
+        PhaseTimer(const char* phase)
+            : phase(phase), start(chrono::high_resolution_clock::now()) {}
+
+        ~PhaseTimer()
+        {
+            runProfile.addPhase(phase, chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+        }
+
+    private:
+        const char* phase;
+        chrono::high_resolution_clock::time_point start;
+};
+
+
+// Times the enclosing scope as one sweep
+class SweepTimer
+{
+    public:
+        SweepTimer()  { runProfile.beginSweep(); }
+        ~SweepTimer() { runProfile.endSweep(); }
+};
+
+
+
+
+/*///////////////////////
+    PROFILED FUNCTIONS
+///////////////////////*/
+
+
+// toleranceMet, timed as a convergence check
+bool profiledToleranceMet(const SweepChange& change, const RunOptions& options)
+{
+    if (!runProfile.enabled) return toleranceMet(change, options);
+
+    auto start = chrono::high_resolution_clock::now();
+    bool met   = toleranceMet(change, options);
+    runProfile.addCheck(chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+    return met;
+}
@@ -0,0 +1,267 @@
+// header file for solving the price system one strongly connected component
+// at a time.
+//
+// A product's price depends only on the prices of its inputs, so the table
+// is a dependency graph with an edge from each product to each of its
+// inputs. Its strongly connected components (found with Tarjan's algorithm)
+// are the groups of products that feed into each other in a cycle. Taken in
+// topological order, every component only needs the prices of components
+// before it, so:
+//
+//   - a product on no cycle is priced exactly, in a single pass, and
+//   - iteration is only needed inside the cyclic components, with all the
+//     prices coming in from outside already final.
+//
+// Components are also grouped into levels (one more than the deepest
+// component they depend on); components in the same level are independent
+// and can be solved in parallel.
+
+#pragma once
+#include "priceEngine.hpp"
+using namespace std;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+class ComponentPlan
+{
+    public:
+        vector<uint32_t> rows;            // rows grouped by component, components in level order
+        vector<uint64_t> componentStart;  // component c is rows[componentStart[c] .. componentStart[c+1])
+        vector<uint64_t> levelStart;      // level L is components [levelStart[L] .. levelStart[L+1])
+        vector<bool>     cyclic;          // whether component c needs iterating
+
+        size_t componentCount() const { return cyclic.size(); }
+        size_t levelCount()     const { return levelStart.size() - 1; }
+        size_t componentSize(size_t c) const { return componentStart[c+1] - componentStart[c]; }
+};
+
+
+
+
+/*///////////////////////
+    PLANNING FUNCTIONS
+///////////////////////*/
+
+
+// Tarjan's algorithm, written with an explicit stack so deep supply chains
+// can't overflow the call stack. Components come out with every component
+// after all the components it depends on.
+void buildComponentPlan(const PriceEngine& engine, ComponentPlan& plan)
+{
+    const size_t   n = engine.productCount();
+    const uint32_t UNVISITED = UINT32_MAX;
+
+    vector<uint32_t> discovery(n, UNVISITED), lowLink(n, 0), componentOf(n, 0);
+    vector<bool>     onStack(n, false);
+    vector<uint32_t> tarjanStack;
+    vector<pair<uint32_t,uint64_t>> callStack;     // (row, next edge to look at)
+    vector<uint32_t> foundRows;
+    vector<uint64_t> foundStart{0};
+    uint32_t counter{0};
+
+    for (size_t root = 0; root < n; root++)
+    {
+        if (discovery[root] != UNVISITED) continue;
+
+        // rows get their discovery number as they are pushed
+        auto visit = [&](uint32_t row)
+        {
+            discovery[row] = lowLink[row] = counter++;
+            tarjanStack.push_back(row);
+            onStack[row] = true;
+            callStack.push_back({row, engine.rowStart[row]});
+        };
+        visit(root);
+
+        while (!callStack.empty())
+        {
+            uint32_t row = callStack.back().first;
+
+            // walk the remaining inputs, descending into the first unvisited one
+            bool descended{false};
+            while (callStack.back().second < engine.rowStart[row+1])
+            {
+                uint32_t input = engine.inputIndex[callStack.back().second++];
+                if (discovery[input] == UNVISITED)
+                {
+                    visit(input);
+                    descended = true;
+                    break;
+                }
+                if (onStack[input]) lowLink[row] = min(lowLink[row], discovery[input]);
+            }
+            if (descended) continue;
+
+            // row is finished: it either roots a component or passes its low link up
+            uint32_t finished = row;
+            callStack.pop_back();
+            if (!callStack.empty())
+            {
+                uint32_t parent = callStack.back().first;
+                lowLink[parent] = min(lowLink[parent], lowLink[finished]);
+            }
+
+            if (lowLink[finished] == discovery[finished])
+            {
+                uint32_t member;
+                do
+                {
+                    member = tarjanStack.back();
+                    tarjanStack.pop_back();
+                    onStack[member] = false;
+                    componentOf[member] = foundStart.size() - 1;
+                    foundRows.push_back(member);
+                }
+                while (member != finished);
+                foundStart.push_back(foundRows.size());
+            }
+        }
+    }
+
+    // levels: one deeper than the deepest component an input belongs to
+    const size_t componentCount = foundStart.size() - 1;
+    vector<uint32_t> level(componentCount, 0);
+    vector<bool>     cyclic(componentCount, false);
+    uint32_t deepest{0};
+    for (size_t c = 0; c < componentCount; c++)
+    {
+        cyclic[c] = foundStart[c+1] - foundStart[c] > 1;
+        for (uint64_t i = foundStart[c]; i < foundStart[c+1]; i++)
+        {
+            uint32_t row = foundRows[i];
+            for (uint64_t k = engine.rowStart[row]; k < engine.rowStart[row+1]; k++)
+            {
+                uint32_t inputComponent = componentOf[engine.inputIndex[k]];
+                if (inputComponent == c) cyclic[c] = true;      // catches self-loops too
+                else level[c] = max(level[c], level[inputComponent] + 1);
+            }
+        }
+        deepest = max(deepest, level[c]);
+    }
+
+    // regroup the components by level (a counting sort keeps topological order)
+    plan.levelStart.assign(deepest + 2, 0);
+    for (size_t c = 0; c < componentCount; c++) plan.levelStart[level[c] + 1]++;
+    for (size_t L = 0; L <= deepest; L++) plan.levelStart[L+1] += plan.levelStart[L];
+
+    vector<uint64_t> slot(plan.levelStart.begin(), plan.levelStart.end() - 1);
+    vector<uint32_t> order(componentCount);
+    for (size_t c = 0; c < componentCount; c++) order[slot[level[c]]++] = c;
+
+    plan.rows.clear();
+    plan.rows.reserve(n);
+    plan.componentStart.assign(1, 0);
+    plan.cyclic.resize(componentCount);
+    for (size_t position = 0; position < componentCount; position++)
+    {
+        uint32_t c = order[position];
+        plan.rows.insert(plan.rows.end(), foundRows.begin() + foundStart[c], foundRows.begin() + foundStart[c+1]);
+        plan.componentStart.push_back(plan.rows.size());
+        plan.cyclic[position] = cyclic[c];
+    }
+}
+
+
+// prints a short summary of how the table decomposed
+void printComponentPlan(const ComponentPlan& plan)
+{
+    size_t cyclicCount{0}, cyclicRows{0}, largest{0};
+    for (size_t c = 0; c < plan.componentCount(); c++)
+    {
+        if (plan.componentSize(c) < 2) continue;     // self-loops are still solved exactly
+        cyclicCount++;
+        cyclicRows += plan.componentSize(c);
+        largest     = max(largest, plan.componentSize(c));
+    }
+
+    cout << "\n" << plan.componentCount() << " components in " << plan.levelCount() << " levels: "
+         << plan.rows.size() - cyclicRows << " products priced in one pass, "
+         << cyclicRows << " in " << cyclicCount << " cycles (largest has " << largest << " products)" << endl;
+}
+
+
+
+
+/*///////////////////////
+     BLOCK SOLVING
+///////////////////////*/
+
+
+// One sweep over the given rows. Gauss-Seidel/SOR sweeps update in place;
+// Jacobi sweeps compute every row from the old prices (via scratch) first.
+// Returns how far the sweep moved the prices.
+SweepChange componentSweep(const PriceEngine&    engine,
+                           const vector<double>& selfCoeffs,
+                           vector<double>&       prices,
+                           const uint32_t*       rows,
+                           size_t                rowCount,
+                           const RunOptions&     options,
+                           vector<double>&       scratch)
+{
+    const bool jacobi = options.sweepMode == SweepMode::JACOBI;
+    const double omega = jacobi ? 1.0 : options.omega;
+    SweepChange change;
+    if (jacobi) scratch.resize(rowCount);
+
+    for (size_t i = 0; i < rowCount; i++)
+    {
+        uint32_t r = rows[i];
+        double price = engine.laborOnly[r];
+        for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+        {
+            price += engine.coeffs[k] * prices[engine.inputIndex[k]];
+        }
+
+        double oldPrice = prices[r];
+        if (!jacobi) price = (price - selfCoeffs[r] * oldPrice) / (1 - selfCoeffs[r]);
+        price = oldPrice + omega * (price - oldPrice);
+
+        change.add(oldPrice, price);
+        if (jacobi) scratch[i] = price;
+        else        prices[r]  = price;
+    }
+
+    if (jacobi) for (size_t i = 0; i < rowCount; i++) prices[rows[i]] = scratch[i];
+    return change;
+}
+
+
+// Prices component c, assuming every component it depends on is done.
+// A single product takes one exact pass (solving for its own coefficient
+// when it is its own input); a cycle is swept until it meets the tolerances
+// (-p, --tol-rel, --tol-res), or -i times. Returns the number of sweeps used.
+int solveComponent(const PriceEngine&    engine,
+                   const ComponentPlan&  plan,
+                   const vector<double>& selfCoeffs,
+                   size_t                c,
+                   vector<double>&       prices,
+                   const RunOptions&     options,
+                   vector<double>&       scratch)
+{
+    const uint32_t* rows     = plan.rows.data() + plan.componentStart[c];
+    const size_t    rowCount = plan.componentSize(c);
+
+    if (!plan.cyclic[c] || rowCount == 1)
+    {
+        RunOptions exact = options;
+        exact.sweepMode = SweepMode::GAUSS_SEIDEL;
+        exact.omega     = 1.0;
+        componentSweep(engine, selfCoeffs, prices, rows, rowCount, exact, scratch);
+        return 1;
+    }
+
+    int sweeps{0};
+    while (true)
+    {
+        SweepChange change = componentSweep(engine, selfCoeffs, prices, rows, rowCount, options, scratch);
+        sweeps++;
+
+        if (toleranceMet(change, options))                      break;
+        if (options.iterations && sweeps >= options.iterations) break;
+    }
+    return sweeps;
+}
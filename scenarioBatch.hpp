@@ -0,0 +1,553 @@
+// header file for pricing a batch of scenarios side by side (--scenarios).
+//
+// Planning rounds price dozens of variants of the same table: a new
+// technology for a few products, a rise in labor productivity in a sector.
+// Each only changes a handful of labor or input quantities, so every
+// scenario has the table's sparsity pattern and almost all of its
+// coefficients. The scenario file lists each scenario's changes, in the
+// format of the table itself (new absolute quantities), under a "[name]"
+// line:
+//
+//     [steel-2030]
+//     101010282293,882872662923 180.2
+//     101010282293,0 31000
+//     [faster-looms]
+//     ...
+//
+// The changes are kept as per-row overrides: how much each changed
+// coefficient (or direct labor) differs from the table's. The sweeps carry a
+// block of 1 + scenarios prices per product, the table's own prices first
+// and then one per scenario, and, as for --resources, update the whole block
+// for every nonzero they read. Each row is summed with the shared
+// coefficients for every scenario at once, and then each of its overrides
+// adds its difference to its own scenario's price. The matrix is read once
+// per sweep for the whole batch.
+//
+// A row's prices for the whole batch sit side by side, so each nonzero
+// multiplies a run of contiguous prices, eight at a time: one AVX-512
+// vector, or two AVX2 ones. As for the SELL-C-sigma kernels, --kernel picks
+// the instruction set (by default the widest the CPU has), and every kernel
+// gives exactly the same prices.
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include "priceEngine.hpp"
+#include "sellKernel.hpp"
+#include "whatIf.hpp"
+#include <map>
+using namespace std;
+
+// an override's input for a change to direct labor
+const uint32_t LABOR_OVERRIDE = UINT32_MAX;
+
+// columns of the block summed together: one AVX-512 vector, or two AVX2 vectors, of doubles
+const size_t   SCENARIO_PANEL = 8;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// How one scenario's row differs from the table's: its coefficient on input
+// (or its direct labor, for LABOR_OVERRIDE) is delta more
+class ScenarioOverride
+{
+    public:
+        uint32_t scenario;      // 1 for the first scenario; 0 is the table itself
+        uint32_t input;
+        double   delta;
+};
+
+
+// Every scenario's overrides, by row: row r's are overrides[overrideStart[r]]
+// to overrides[overrideStart[r+1] - 1]
+class ScenarioSet
+{
+    public:
+        vector<string>           names;
+        vector<uint64_t>         overrideStart;     // size productCount()+1
+        vector<ScenarioOverride> overrides;
+        SweepKernel              kernel{SweepKernel::SCALAR};
+
+        // prices per product in a scenario block
+        size_t width() const { return 1 + names.size(); }
+};
+
+
+// A sweep's change kept per lane of a panel (column mod SCENARIO_PANEL), the
+// way the SIMD kernels keep it in their vectors. As in SweepChange, a NaN
+// change can slip past the max (_mm_max_pd too), but never past sumSquares,
+// and total() keeps it there for toleranceMet.
+class PanelChange
+{
+    public:
+        double maxAbsolute[SCENARIO_PANEL]{};
+        double maxRelative[SCENARIO_PANEL]{};
+        double sumSquares[SCENARIO_PANEL]{};
+
+        void add(size_t lane, double oldPrice, double newPrice)
+        {
+            double change = abs(newPrice - oldPrice);
+            maxAbsolute[lane] = max(maxAbsolute[lane], change);
+            if (change != 0) maxRelative[lane] = max(maxRelative[lane], change / abs(newPrice));
+            sumSquares[lane] += change * change;
+        }
+
+        // the lanes together, totalled in lane order
+        SweepChange total() const
+        {
+            SweepChange change;
+            for (size_t lane = 0; lane < SCENARIO_PANEL; lane++)
+            {
+                change.merge({maxAbsolute[lane], maxRelative[lane], sumSquares[lane]});
+            }
+            return change;
+        }
+};
+
+
+
+
+/*///////////////////////
+    LOADING FUNCTIONS
+///////////////////////*/
+
+
+// The overrides one scenario's entries (new absolute quantities, later ones
+// winning) make to the engine's rows. A new output rescales every
+// coefficient of its row. Scenarios can't add inputs or products, which
+// would change the shared structure.
+void scenarioOverrides(const PriceEngine&        engine,
+                       const vector<TableEntry>& entries,
+                       uint32_t                  scenario,
+                       const string&             name,
+                       vector<pair<uint32_t, ScenarioOverride>>& overrides)
+{
+    // each changed row's new output, labor and inputs, all as quantities
+    class RowChange
+    {
+        public:
+            double output{0};
+            double labor{0};
+            bool   laborGiven{false};
+            map<uint32_t, double> inputs;
+    };
+    map<uint32_t, RowChange> rows;
+
+    for (const TableEntry& entry : entries)
+    {
+        size_t row = engine.indexOf(entry.product);
+        if (row == engine.productCount())
+        {
+            throw malformed_table("Scenario " + name + " changes product " + to_string(entry.product)
+                                  + ", which the table doesn't have.");
+        }
+        RowChange& change = rows[row];
+        if (entry.input == 0)
+        {
+            change.labor      = entry.quantity;
+            change.laborGiven = true;
+        }
+        else if (entry.input == 1)
+        {
+            if (entry.quantity == 0)
+            {
+                throw malformed_table("Scenario " + name + " sets the output of product " + to_string(entry.product) + " to 0.");
+            }
+            change.output = entry.quantity;
+        }
+        else if (isResourceCode(entry.input))
+        {
+            throw malformed_table("Scenario " + name + " changes resource " + to_string(entry.input)
+                                  + "; scenarios are priced in labor only.");
+        }
+        else
+        {
+            size_t input = engine.indexOf(entry.input);
+            if (input == engine.productCount() || (findInput(engine, row, input) == engine.rowStart[row+1] && entry.quantity != 0))
+            {
+                throw malformed_table("Scenario " + name + " adds input " + to_string(entry.input) + " to product "
+                                      + to_string(entry.product) + "; scenarios can only change quantities the table has"
+                                      + " (use --what-if for new ones).");
+            }
+            change.inputs[input] = entry.quantity;
+        }
+    }
+
+    for (const auto& [row, change] : rows)
+    {
+        bool   rescaled = change.output != 0 && change.output != engine.output[row];
+        double output   = rescaled ? change.output : engine.output[row];
+        auto   overrideBy = [&](uint32_t input, double oldCoeff, double newCoeff)
+        {
+            if (newCoeff != oldCoeff) overrides.push_back({row, {scenario, input, newCoeff - oldCoeff}});
+        };
+
+        double labor = change.laborGiven ? change.labor / output
+                     : rescaled          ? engine.laborOnly[row] * engine.output[row] / output
+                                         : engine.laborOnly[row];
+        overrideBy(LABOR_OVERRIDE, engine.laborOnly[row], labor);
+
+        for (uint64_t k = engine.rowStart[row]; k < engine.rowStart[row+1]; k++)
+        {
+            auto   given = change.inputs.find(engine.inputIndex[k]);
+            double coeff = given != change.inputs.end() ? given->second / output
+                         : rescaled                     ? engine.coeffs[k] * engine.output[row] / output
+                                                        : engine.coeffs[k];
+            overrideBy(engine.inputIndex[k], engine.coeffs[k], coeff);
+        }
+    }
+}
+
+
+// Reads the scenario file (see the top of this file) into scenarios, and
+// picks their sweep kernel from the one asked for (csr, the default, which
+// has no copy to skip here, meaning auto)
+void loadScenarios(const PriceEngine& engine, const RunOptions& options, ScenarioSet& scenarios)
+{
+    scenarios.kernel = chooseKernel(options.kernel == SweepKernel::CSR ? SweepKernel::AUTO : options.kernel);
+
+    MappedFile scenarioFile(options.scenarioFile);
+    vector<pair<uint32_t, ScenarioOverride>> overrides;     // by row, in file order
+
+    const char* cursor  = scenarioFile.data;
+    const char* fileEnd = scenarioFile.data + scenarioFile.size;
+    while (cursor < fileEnd)
+    {
+        const char* lineEnd = (const char*) memchr(cursor, '\n', fileEnd - cursor);
+        if (!lineEnd) lineEnd = fileEnd;
+        const char* nameEnd = lineEnd;
+        while (cursor < lineEnd && isspace((unsigned char) *cursor)) cursor++;
+        while (nameEnd > cursor && isspace((unsigned char) nameEnd[-1])) nameEnd--;
+        if (cursor == lineEnd)
+        {
+            cursor = lineEnd + 1;
+            continue;
+        }
+        if (*cursor != '[' || nameEnd[-1] != ']' || nameEnd - cursor < 3)
+        {
+            throw malformed_table("Scenario file lines must follow a \"[name]\" line: \"" + string(cursor, lineEnd) + "\"");
+        }
+        string name(cursor + 1, nameEnd - 1);
+
+        // the scenario's entries run up to the next line that starts with "["
+        const char* entriesBegin = lineEnd < fileEnd ? lineEnd + 1 : fileEnd;
+        const char* entriesEnd   = entriesBegin;
+        while (entriesEnd < fileEnd)
+        {
+            const char* next = entriesEnd;
+            while (next < fileEnd && (*next == ' ' || *next == '\t')) next++;
+            if (next < fileEnd && *next == '[') break;
+            const char* end = (const char*) memchr(entriesEnd, '\n', fileEnd - entriesEnd);
+            entriesEnd = end ? end + 1 : fileEnd;
+        }
+
+        vector<TableEntry> entries;
+        parseTableChunk(entriesBegin, entriesEnd, entries);
+        scenarios.names.push_back(name);
+        scenarioOverrides(engine, entries, scenarios.names.size(), name, overrides);
+        cursor = entriesEnd;
+    }
+
+    // overrides for the same row end up together, in scenario order
+    stable_sort(overrides.begin(), overrides.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    scenarios.overrideStart.assign(engine.productCount() + 1, 0);
+    scenarios.overrides.clear();
+    scenarios.overrides.reserve(overrides.size());
+    for (const auto& [row, change] : overrides)
+    {
+        scenarios.overrideStart[row + 1]++;
+        scenarios.overrides.push_back(change);
+    }
+    for (size_t r = 0; r < engine.productCount(); r++) scenarios.overrideStart[r+1] += scenarios.overrideStart[r];
+}
+
+
+
+
+/*///////////////////////
+     BLOCK FUNCTIONS
+///////////////////////*/
+
+
+// The block the sweeps start from: every scenario from the table's starting
+// prices (as set up by startingPrices, so they can be warm-started)
+void startingScenarioBlock(const ScenarioSet& scenarios, const vector<double>& prices, vector<double>& block)
+{
+    const size_t width = scenarios.width();
+    block.resize(prices.size() * width);
+    for (size_t r = 0; r < prices.size(); r++) fill_n(block.begin() + r * width, width, prices[r]);
+}
+
+
+// adds row's overrides to the sums the shared coefficients gave its scenarios
+void applyOverrides(const ScenarioSet& scenarios, const double* prev, size_t row, double* sum)
+{
+    const size_t width = scenarios.width();
+    for (uint64_t o = scenarios.overrideStart[row]; o < scenarios.overrideStart[row+1]; o++)
+    {
+        const ScenarioOverride& edit = scenarios.overrides[o];
+        double input = edit.input == LABOR_OVERRIDE ? 1 : prev[(size_t) edit.input * width + edit.scenario];
+        sum[edit.scenario] += edit.delta * input;
+    }
+}
+
+
+
+
+/*///////////////////////
+      SWEEP KERNELS
+///////////////////////*/
+
+
+// Each kernel computes rows [firstRow, lastRow) of the block, a row at a time
+// and eight columns (a panel) at a time, then adds the row's overrides. The
+// row's inputs stay in L1 from one panel to the next, so the matrix is read
+// from memory once per sweep. Column by column, every kernel does the same
+// additions in the same order, and each keeps the change per lane (column
+// mod 8) and totals the lanes the same way, so all of them give exactly the
+// same prices and stop after the same sweep.
+
+// one row, over Width columns from column first on
+template <size_t Width>
+void scenarioRowPanel(const PriceEngine& engine,
+                      const double*      prev,
+                      size_t             width,
+                      size_t             first,
+                      size_t             row,
+                      double*            sum)
+{
+    double panel[Width];
+    for (size_t j = 0; j < Width; j++) panel[j] = engine.laborOnly[row];
+
+    for (uint64_t k = engine.rowStart[row]; k < engine.rowStart[row+1]; k++)
+    {
+        const double  coeff = engine.coeffs[k];
+        const double* input = prev + (size_t) engine.inputIndex[k] * width + first;
+        for (size_t j = 0; j < Width; j++) panel[j] += coeff * input[j];
+    }
+    for (size_t j = 0; j < Width; j++) sum[first + j] = panel[j];
+}
+
+
+SweepChange scenarioSweepScalar(const PriceEngine& engine,
+                                const ScenarioSet& scenarios,
+                                const double*      prev,
+                                double*            block,
+                                size_t             firstRow,
+                                size_t             lastRow)
+{
+    const size_t P     = SCENARIO_PANEL;
+    const size_t width = scenarios.width();
+    PanelChange  change;
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double* sum = block + r * width;
+        size_t  first{0};
+        for (; first + P <= width; first += P) scenarioRowPanel<SCENARIO_PANEL>(engine, prev, width, first, r, sum);
+        switch (width - first)
+        {
+            case 1: scenarioRowPanel<1>(engine, prev, width, first, r, sum); break;
+            case 2: scenarioRowPanel<2>(engine, prev, width, first, r, sum); break;
+            case 3: scenarioRowPanel<3>(engine, prev, width, first, r, sum); break;
+            case 4: scenarioRowPanel<4>(engine, prev, width, first, r, sum); break;
+            case 5: scenarioRowPanel<5>(engine, prev, width, first, r, sum); break;
+            case 6: scenarioRowPanel<6>(engine, prev, width, first, r, sum); break;
+            case 7: scenarioRowPanel<7>(engine, prev, width, first, r, sum); break;
+        }
+        applyOverrides(scenarios, prev, r, sum);
+
+        const double* old = prev + r * width;
+        for (size_t j = 0; j < width; j++) change.add(j % P, old[j], sum[j]);
+    }
+    return change.total();
+}
+
+
+#ifdef PLECPR_X86_KERNELS
+
+__attribute__((target("avx2")))
+SweepChange scenarioSweepAvx2(const PriceEngine& engine,
+                              const ScenarioSet& scenarios,
+                              const double*      prev,
+                              double*            block,
+                              size_t             firstRow,
+                              size_t             lastRow)
+{
+    const size_t  P        = SCENARIO_PANEL;
+    const size_t  width    = scenarios.width();
+    const __m256d zero     = _mm256_setzero_pd();
+    const __m256d signBit  = _mm256_set1_pd(-0.0);
+    const __m256i laneLow  = _mm256_setr_epi64x(0, 1, 2, 3);
+    const __m256i laneHigh = _mm256_setr_epi64x(4, 5, 6, 7);
+
+    // the last panel's columns, if the width isn't a multiple of P
+    const __m256i tail     = _mm256_set1_epi64x(width % P ? width % P : P);
+    const __m256i tailLow  = _mm256_cmpgt_epi64(tail, laneLow);
+    const __m256i tailHigh = _mm256_cmpgt_epi64(tail, laneHigh);
+    const __m256i all      = _mm256_set1_epi64x(-1);
+
+    __m256d maxAbsolute[2]{zero, zero}, maxRelative[2]{zero, zero}, sumSquares[2]{zero, zero};
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double*       sum = block + r * width;
+        const double* old = prev + r * width;
+
+        for (size_t first = 0; first < width; first += P)
+        {
+            bool    whole   = first + P <= width;
+            __m256i maskLow = whole ? all : tailLow, maskHigh = whole ? all : tailHigh;
+            __m256d low     = _mm256_set1_pd(engine.laborOnly[r]);
+            __m256d high    = low;
+            for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+            {
+                __m256d       coeff = _mm256_set1_pd(engine.coeffs[k]);
+                const double* input = prev + (size_t) engine.inputIndex[k] * width + first;
+                low  = _mm256_add_pd(low,  _mm256_mul_pd(coeff, _mm256_maskload_pd(input,     maskLow)));
+                high = _mm256_add_pd(high, _mm256_mul_pd(coeff, _mm256_maskload_pd(input + 4, maskHigh)));
+            }
+            _mm256_maskstore_pd(sum + first,     maskLow,  low);
+            _mm256_maskstore_pd(sum + first + 4, maskHigh, high);
+        }
+        applyOverrides(scenarios, prev, r, sum);
+
+        for (size_t first = 0; first < width; first += P)
+        {
+            bool    whole    = first + P <= width;
+            __m256i masks[2] = {whole ? all : tailLow, whole ? all : tailHigh};
+            for (int half = 0; half < 2; half++)
+            {
+                __m256d newPrice = _mm256_maskload_pd(sum + first + 4 * half, masks[half]);
+                __m256d oldPrice = _mm256_maskload_pd(old + first + 4 * half, masks[half]);
+                __m256d change   = _mm256_andnot_pd(signBit, _mm256_sub_pd(newPrice, oldPrice));
+                __m256d moved    = _mm256_cmp_pd(change, zero, _CMP_NEQ_OQ);
+                maxAbsolute[half] = _mm256_max_pd(maxAbsolute[half], change);
+                maxRelative[half] = _mm256_max_pd(maxRelative[half],
+                                                  _mm256_and_pd(moved, _mm256_div_pd(change, _mm256_andnot_pd(signBit, newPrice))));
+                sumSquares[half]  = _mm256_add_pd(sumSquares[half], _mm256_mul_pd(change, change));
+            }
+        }
+    }
+
+    PanelChange change;
+    for (int half = 0; half < 2; half++)
+    {
+        _mm256_storeu_pd(change.maxAbsolute + 4 * half, maxAbsolute[half]);
+        _mm256_storeu_pd(change.maxRelative + 4 * half, maxRelative[half]);
+        _mm256_storeu_pd(change.sumSquares  + 4 * half, sumSquares[half]);
+    }
+    return change.total();
+}
+
+
+__attribute__((target("avx512f")))
+SweepChange scenarioSweepAvx512(const PriceEngine& engine,
+                                const ScenarioSet& scenarios,
+                                const double*      prev,
+                                double*            block,
+                                size_t             firstRow,
+                                size_t             lastRow)
+{
+    const size_t  P     = SCENARIO_PANEL;
+    const size_t  width = scenarios.width();
+    const __m512d zero  = _mm512_setzero_pd();
+    const __mmask8 tail = width % P ? (__mmask8) ((1u << (width % P)) - 1) : (__mmask8) 0xFF;
+
+    __m512d maxAbsolute = zero, maxRelative = zero, sumSquares = zero;
+
+    for (size_t r = firstRow; r < lastRow; r++)
+    {
+        double*       sum = block + r * width;
+        const double* old = prev + r * width;
+
+        for (size_t first = 0; first < width; first += P)
+        {
+            __mmask8 mask = first + P <= width ? (__mmask8) 0xFF : tail;
+            __m512d  acc  = _mm512_set1_pd(engine.laborOnly[r]);
+            for (uint64_t k = engine.rowStart[r]; k < engine.rowStart[r+1]; k++)
+            {
+                const double* input = prev + (size_t) engine.inputIndex[k] * width + first;
+                acc = _mm512_add_pd(acc, _mm512_mul_pd(_mm512_set1_pd(engine.coeffs[k]), _mm512_maskz_loadu_pd(mask, input)));
+            }
+            _mm512_mask_storeu_pd(sum + first, mask, acc);
+        }
+        applyOverrides(scenarios, prev, r, sum);
+
+        for (size_t first = 0; first < width; first += P)
+        {
+            __mmask8 mask     = first + P <= width ? (__mmask8) 0xFF : tail;
+            __m512d  newPrice = _mm512_maskz_loadu_pd(mask, sum + first);
+            __m512d  change   = _mm512_abs_pd(_mm512_sub_pd(newPrice, _mm512_maskz_loadu_pd(mask, old + first)));
+            __mmask8 moved    = _mm512_cmp_pd_mask(change, zero, _CMP_NEQ_OQ);
+            maxAbsolute = _mm512_max_pd(maxAbsolute, change);
+            maxRelative = _mm512_max_pd(maxRelative, _mm512_maskz_div_pd(moved, change, _mm512_abs_pd(newPrice)));
+            sumSquares  = _mm512_add_pd(sumSquares, _mm512_mul_pd(change, change));
+        }
+    }
+
+    PanelChange change;
+    _mm512_storeu_pd(change.maxAbsolute, maxAbsolute);
+    _mm512_storeu_pd(change.maxRelative, maxRelative);
+    _mm512_storeu_pd(change.sumSquares,  sumSquares);
+    return change.total();
+}
+
+#endif
+
+
+// One Jacobi sweep of rows [firstRow, lastRow) for every scenario at once,
+// through the kernel chosen for the set. Returns how far the sweep moved
+// the block, over all scenarios.
+SweepChange scenarioSweep(const PriceEngine&    engine,
+                          const ScenarioSet&    scenarios,
+                          const vector<double>& prevBlock,
+                          vector<double>&       block,
+                          size_t                firstRow,
+                          size_t                lastRow)
+{
+    switch (scenarios.kernel)
+    {
+#ifdef PLECPR_X86_KERNELS
+        case SweepKernel::AVX512:
+            return scenarioSweepAvx512(engine, scenarios, prevBlock.data(), block.data(), firstRow, lastRow);
+        case SweepKernel::AVX2:
+            return scenarioSweepAvx2(engine, scenarios, prevBlock.data(), block.data(), firstRow, lastRow);
+#endif
+        default:
+            return scenarioSweepScalar(engine, scenarios, prevBlock.data(), block.data(), firstRow, lastRow);
+    }
+}
+
+
+
+
+/*///////////////////////
+    OUTPUT FUNCTIONS
+///////////////////////*/
+
+
+// the block as a table for the output functions (see priceFiles.hpp): the
+// table's own prices under "Price" (so the file still works with
+// --warm-start and --base), then a column named after each scenario
+PriceTable scenarioTable(const PriceEngine& engine, const ScenarioSet& scenarios, const vector<double>& block)
+{
+    PriceTable table;
+    table.upcs          = engine.upcs.data();
+    table.values        = block.data();
+    table.count         = engine.productCount();
+    table.width         = scenarios.width();
+    table.scenarioNames = scenarios.names;
+    return table;
+}
+
+
+void printScenarioSet(const ScenarioSet& scenarios)
+{
+    cout << "Loaded " << scenarios.names.size() << " scenarios, overriding " << scenarios.overrides.size()
+         << " coefficients and labor values in all" << endl;
+    cout << "Scenario sweep kernel: " << (scenarios.kernel == SweepKernel::AVX512 ? "AVX-512"
+                                        : scenarios.kernel == SweepKernel::AVX2   ? "AVX2" : "scalar") << endl;
+}
@@ -0,0 +1,356 @@
+// header file for the vectorized Jacobi sweep kernel.
+//
+// A Jacobi sweep is one sparse matrix-vector product, p' = l + A p, and on
+// large tables it is bound by memory bandwidth. The CSR rows the engine
+// keeps are a poor fit for SIMD, since every row has a different length, so
+// this kernel sweeps a second copy of the coefficients in the sliced
+// ELLPACK layout SELL-C-sigma (Kreutzer et al., 2014):
+//
+//   - rows are taken C at a time (a "chunk"), one row per SIMD lane, and
+//     each chunk is padded to the length of its longest row;
+//   - a chunk is stored column by column, so the j-th input of all C rows
+//     sits in C consecutive slots and is one vector load (plus one gather
+//     of the input prices);
+//   - within windows of sigma rows, rows are sorted longest first, so rows
+//     of about the same length share a chunk and little padding is needed.
+//
+// The AVX2 and AVX-512 kernels are compiled for their instruction sets
+// through function attributes and picked at run time from what the CPU
+// supports; the scalar kernel runs on anything. Every kernel adds a row's
+// terms in the same order as jacobiSweep does, without fused multiply-adds
+// (GCC and Clang need -ffp-contract=off for that, which CMakeLists.txt
+// sets), so all of them give exactly the same prices as the CSR sweep.
+//
+// The copy takes as much memory again as the table and a few sweeps' time
+// to build, so it's only built when --kernel asks for it.
+
+#pragma once
+#include "priceEngine.hpp"
+#include <algorithm>
+using namespace std;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLECPR_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+const size_t   SELL_CHUNK_ROWS = 8;      // C: one AVX-512 vector, or two AVX2 vectors, of doubles
+const size_t   SELL_SORT_WINDOW = 256;   // sigma
+const uint32_t SELL_NO_ROW = UINT32_MAX; // lane of a chunk's padding
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+class SellMatrix
+{
+    public:
+        SweepKernel      kernel{SweepKernel::CSR};  // what sweeps run on (CSR means this copy is unused)
+        vector<size_t>   segmentRow;        // segment s is rows [segmentRow[s], segmentRow[s+1]) ...
+        vector<size_t>   segmentChunk;      // ... and chunks [segmentChunk[s], segmentChunk[s+1])
+        vector<uint64_t> chunkStart;        // chunk c's slots start at chunkStart[c], C per column
+        vector<uint32_t> rowOf;             // row in each lane of each chunk, or SELL_NO_ROW
+        vector<double>   labor;             // direct labor per lane
+        vector<uint32_t> inputIndex;        // per slot; padding points at input 0 ...
+        vector<double>   coeffs;            // ... with a coefficient of 0
+
+        size_t chunkCount() const { return chunkStart.size() - 1; }
+        size_t segmentCount() const { return segmentRow.size() - 1; }
+};
+
+
+
+
+/*///////////////////////
+    KERNEL SELECTION
+///////////////////////*/
+
+
+bool cpuSupports(SweepKernel kernel)
+{
+#ifdef PLECPR_X86_KERNELS
+    if (kernel == SweepKernel::AVX2)   return __builtin_cpu_supports("avx2");
+    if (kernel == SweepKernel::AVX512) return __builtin_cpu_supports("avx512f");
+#else
+    if (kernel == SweepKernel::AVX2 || kernel == SweepKernel::AVX512) return false;
+#endif
+    return true;
+}
+
+
+// the kernel --kernel asked for, or the best one this CPU runs for auto;
+// asking for an instruction set the CPU lacks falls back to scalar
+SweepKernel chooseKernel(SweepKernel requested)
+{
+    if (requested == SweepKernel::AUTO)
+    {
+        if (cpuSupports(SweepKernel::AVX512)) return SweepKernel::AVX512;
+        if (cpuSupports(SweepKernel::AVX2))   return SweepKernel::AVX2;
+        return SweepKernel::SCALAR;
+    }
+
+    if (!cpuSupports(requested))
+    {
+        cout << "This CPU doesn't support the requested sweep kernel; using the scalar one" << endl;
+        return SweepKernel::SCALAR;
+    }
+    return requested;
+}
+
+
+string kernelName(SweepKernel kernel)
+{
+    switch (kernel)
+    {
+        case SweepKernel::CSR:    return "CSR";
+        case SweepKernel::SCALAR: return "SELL-C-sigma, scalar";
+        case SweepKernel::AVX2:   return "SELL-C-sigma, AVX2";
+        case SweepKernel::AVX512: return "SELL-C-sigma, AVX-512";
+        default:                  return "auto";
+    }
+}
+
+
+
+
+/*///////////////////////
+     LAYOUT FUNCTIONS
+///////////////////////*/
+
+
+// Builds the SELL-C-sigma copy of the engine's rows for the given kernel.
+// segmentBounds splits the rows into ranges (one per thread in plecpr-mt)
+// that no sort window or chunk crosses, so each can be swept on its own.
+void buildSellMatrix(const PriceEngine&    engine,
+                     const vector<size_t>& segmentBounds,
+                     SweepKernel           requested,
+                     SellMatrix&           sell)
+{
+    sell.kernel     = chooseKernel(requested);
+    sell.segmentRow = segmentBounds;
+    sell.segmentChunk.assign(1, 0);
+    sell.chunkStart.assign(1, 0);
+    sell.rowOf.clear();
+    sell.labor.clear();
+    sell.inputIndex.clear();
+    sell.coeffs.clear();
+    if (sell.kernel == SweepKernel::CSR) return;
+
+    const size_t C = SELL_CHUNK_ROWS;
+    auto rowLength = [&engine](uint32_t r) { return engine.rowStart[r+1] - engine.rowStart[r]; };
+
+    vector<uint32_t> window;
+    for (size_t s = 0; s + 1 < segmentBounds.size(); s++)
+    {
+        for (size_t windowStart = segmentBounds[s]; windowStart < segmentBounds[s+1]; windowStart += SELL_SORT_WINDOW)
+        {
+            size_t windowEnd = min(windowStart + SELL_SORT_WINDOW, segmentBounds[s+1]);
+            window.resize(windowEnd - windowStart);
+            for (size_t i = 0; i < window.size(); i++) window[i] = windowStart + i;
+
+            // longest rows first; stable, so equal rows keep their order
+            stable_sort(window.begin(), window.end(),
+                        [&](uint32_t a, uint32_t b) { return rowLength(a) > rowLength(b); });
+
+            for (size_t first = 0; first < window.size(); first += C)
+            {
+                size_t   lanes = min(C, window.size() - first);
+                uint64_t width = rowLength(window[first]);
+                uint64_t start = sell.chunkStart.back();
+
+                sell.inputIndex.resize(start + width * C, 0);
+                sell.coeffs.resize(start + width * C, 0.0);
+                for (size_t lane = 0; lane < C; lane++)
+                {
+                    if (lane >= lanes)
+                    {
+                        sell.rowOf.push_back(SELL_NO_ROW);
+                        sell.labor.push_back(0.0);
+                        continue;
+                    }
+
+                    uint32_t r = window[first + lane];
+                    sell.rowOf.push_back(r);
+                    sell.labor.push_back(engine.laborOnly[r]);
+                    for (uint64_t j = 0; j < rowLength(r); j++)
+                    {
+                        sell.inputIndex[start + j*C + lane] = engine.inputIndex[engine.rowStart[r] + j];
+                        sell.coeffs[start + j*C + lane]     = engine.coeffs[engine.rowStart[r] + j];
+                    }
+                }
+                sell.chunkStart.push_back(start + width * C);
+            }
+        }
+        sell.segmentChunk.push_back(sell.chunkCount());
+    }
+}
+
+
+// prints the kernel in use and how much padding the layout needed
+void printSellMatrix(const SellMatrix& sell, const PriceEngine& engine)
+{
+    cout << "Sweep kernel: " << kernelName(sell.kernel);
+    if (sell.kernel != SweepKernel::CSR && !sell.coeffs.empty())
+    {
+        double padding = 1.0 - (double) engine.nonzeroCount() / sell.coeffs.size();
+        cout << " (C = " << SELL_CHUNK_ROWS << ", sigma = " << SELL_SORT_WINDOW << ", "
+             << sell.chunkCount() << " chunks, " << round(1000 * padding) / 10 << "% padding)";
+    }
+    cout << endl;
+}
+
+
+
+
+/*///////////////////////
+      SWEEP KERNELS
+///////////////////////*/
+
+
+// Each kernel computes chunks [firstChunk, lastChunk) of l + A prevPrices
+// into prices and returns how far they moved. Lane by lane, they all do the
+// same additions in the same order.
+
+SweepChange sellSweepScalar(const SellMatrix& sell,
+                            const double*     prevPrices,
+                            double*           prices,
+                            size_t            firstChunk,
+                            size_t            lastChunk)
+{
+    const size_t C = SELL_CHUNK_ROWS;
+    double sum[SELL_CHUNK_ROWS];
+    SweepChange change;
+
+    for (size_t c = firstChunk; c < lastChunk; c++)
+    {
+        for (size_t lane = 0; lane < C; lane++) sum[lane] = sell.labor[c*C + lane];
+        for (uint64_t k = sell.chunkStart[c]; k < sell.chunkStart[c+1]; k += C)
+        {
+            for (size_t lane = 0; lane < C; lane++)
+            {
+                sum[lane] += sell.coeffs[k + lane] * prevPrices[sell.inputIndex[k + lane]];
+            }
+        }
+        for (size_t lane = 0; lane < C; lane++)
+        {
+            uint32_t r = sell.rowOf[c*C + lane];
+            if (r == SELL_NO_ROW) continue;
+            change.add(prevPrices[r], sum[lane]);
+            prices[r] = sum[lane];
+        }
+    }
+    return change;
+}
+
+
+#ifdef PLECPR_X86_KERNELS
+
+__attribute__((target("avx2")))
+SweepChange sellSweepAvx2(const SellMatrix& sell,
+                          const double*     prevPrices,
+                          double*           prices,
+                          size_t            firstChunk,
+                          size_t            lastChunk)
+{
+    const size_t C = SELL_CHUNK_ROWS;
+    alignas(32) double sum[SELL_CHUNK_ROWS];
+    SweepChange change;
+
+    for (size_t c = firstChunk; c < lastChunk; c++)
+    {
+        __m256d low  = _mm256_loadu_pd(&sell.labor[c*C]);
+        __m256d high = _mm256_loadu_pd(&sell.labor[c*C + 4]);
+        for (uint64_t k = sell.chunkStart[c]; k < sell.chunkStart[c+1]; k += C)
+        {
+            __m128i lowIndex  = _mm_loadu_si128((const __m128i*) &sell.inputIndex[k]);
+            __m128i highIndex = _mm_loadu_si128((const __m128i*) &sell.inputIndex[k + 4]);
+            __m256d lowPrice  = _mm256_i32gather_pd(prevPrices, lowIndex, 8);
+            __m256d highPrice = _mm256_i32gather_pd(prevPrices, highIndex, 8);   // (signed indices: fine below 2^31 products)
+
+            low  = _mm256_add_pd(low,  _mm256_mul_pd(_mm256_loadu_pd(&sell.coeffs[k]),     lowPrice));
+            high = _mm256_add_pd(high, _mm256_mul_pd(_mm256_loadu_pd(&sell.coeffs[k + 4]), highPrice));
+        }
+        _mm256_store_pd(sum, low);
+        _mm256_store_pd(sum + 4, high);
+
+        for (size_t lane = 0; lane < C; lane++)
+        {
+            uint32_t r = sell.rowOf[c*C + lane];
+            if (r == SELL_NO_ROW) continue;
+            change.add(prevPrices[r], sum[lane]);
+            prices[r] = sum[lane];
+        }
+    }
+    return change;
+}
+
+
+__attribute__((target("avx512f")))
+SweepChange sellSweepAvx512(const SellMatrix& sell,
+                            const double*     prevPrices,
+                            double*           prices,
+                            size_t            firstChunk,
+                            size_t            lastChunk)
+{
+    const size_t C = SELL_CHUNK_ROWS;
+    alignas(64) double sum[SELL_CHUNK_ROWS];
+    SweepChange change;
+
+    for (size_t c = firstChunk; c < lastChunk; c++)
+    {
+        __m512d acc = _mm512_loadu_pd(&sell.labor[c*C]);
+        for (uint64_t k = sell.chunkStart[c]; k < sell.chunkStart[c+1]; k += C)
+        {
+            __m256i index = _mm256_loadu_si256((const __m256i*) &sell.inputIndex[k]);
+            __m512d price = _mm512_i32gather_pd(index, prevPrices, 8);
+            acc = _mm512_add_pd(acc, _mm512_mul_pd(_mm512_loadu_pd(&sell.coeffs[k]), price));
+        }
+        _mm512_store_pd(sum, acc);
+
+        for (size_t lane = 0; lane < C; lane++)
+        {
+            uint32_t r = sell.rowOf[c*C + lane];
+            if (r == SELL_NO_ROW) continue;
+            change.add(prevPrices[r], sum[lane]);
+            prices[r] = sum[lane];
+        }
+    }
+    return change;
+}
+
+#endif
+
+
+// One Jacobi sweep of segment s, through whichever kernel the matrix was
+// built for. With the CSR kernel this is just jacobiSweep over its rows;
+// the matrix then has no chunks, only segmentRow.
+SweepChange kernelSweep(const PriceEngine&    engine,
+                        const SellMatrix&     sell,
+                        const vector<double>& prevIterPrices,
+                        vector<double>&       prices,
+                        size_t                segment)
+{
+    if (sell.kernel == SweepKernel::CSR)
+    {
+        return jacobiSweep(engine, prevIterPrices, prices, sell.segmentRow[segment], sell.segmentRow[segment+1]);
+    }
+
+    size_t firstChunk = sell.segmentChunk[segment];
+    size_t lastChunk  = sell.segmentChunk[segment+1];
+
+    switch (sell.kernel)
+    {
+#ifdef PLECPR_X86_KERNELS
+        case SweepKernel::AVX512:
+            return sellSweepAvx512(sell, prevIterPrices.data(), prices.data(), firstChunk, lastChunk);
+        case SweepKernel::AVX2:
+            return sellSweepAvx2(sell, prevIterPrices.data(), prices.data(), firstChunk, lastChunk);
+#endif
+        case SweepKernel::SCALAR:
+            return sellSweepScalar(sell, prevIterPrices.data(), prices.data(), firstChunk, lastChunk);
+        default:
+            return jacobiSweep(engine, prevIterPrices, prices, sell.segmentRow[segment], sell.segmentRow[segment+1]);
+    }
+}
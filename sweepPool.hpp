@@ -0,0 +1,198 @@
+// header file for the thread pool that plecpr-mt sweeps the matrix with.
+//
+// The pool's threads are started once and each owns a fixed range of rows,
+// cut so that every range holds about the same number of nonzeros. Threads
+// only ever write prices in their own range, so the sole synchronization
+// is a barrier: one crossing to hand out a sweep, one to collect it.
+
+#pragma once
+#include "priceEngine.hpp"
+#include "sellKernel.hpp"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+using namespace std;
+
+
+/*///////////////////////
+       CLASSES
+///////////////////////*/
+
+
+// Reusable barrier for a fixed number of threads. Waiters spin for a short
+// while first, since sweeps are usually much shorter than a context switch,
+// and then go to sleep so an idle pool doesn't burn its cores.
+class SweepBarrier
+{
+    public:
+        SweepBarrier(size_t parties): parties(parties) {}
+
+        void wait()
+        {
+            const size_t SPIN_LIMIT = 1 << 14;
+            size_t myGeneration = generation.load(memory_order_acquire);
+
+            if (arrived.fetch_add(1, memory_order_acq_rel) + 1 == parties)
+            {
+                arrived.store(0, memory_order_relaxed);
+                {
+                    lock_guard<mutex> lock(sleepMutex);
+                    generation.fetch_add(1, memory_order_release);
+                }
+                wakeUp.notify_all();
+                return;
+            }
+
+            for (size_t spin = 0; spin < SPIN_LIMIT; spin++)
+            {
+                if (generation.load(memory_order_acquire) != myGeneration) return;
+            }
+
+            unique_lock<mutex> lock(sleepMutex);
+            wakeUp.wait(lock, [&]() { return generation.load(memory_order_acquire) != myGeneration; });
+        }
+
+    private:
+        const size_t       parties;
+        atomic<size_t>     arrived{0};
+        atomic<size_t>     generation{0};
+        mutex              sleepMutex;
+        condition_variable wakeUp;
+};
+
+
+// A task is called as task(threadIndex, firstRow, lastRow) on every thread
+// of the pool, with the rows that thread owns.
+typedef function<void(size_t, size_t, size_t)> SweepTask;
+
+// Persistent pool with static, nnz-balanced row partitions. The calling
+// thread takes part as thread 0, so a pool of n threads starts n-1 workers.
+class SweepPool
+{
+    public:
+        SweepPool(const PriceEngine& engine, size_t threadCount)
+            : threadCount(max<size_t>(1, min(threadCount, max<size_t>(1, engine.productCount())))),
+              barrier(this->threadCount)
+        {
+            partitionRows(engine);
+            for (size_t t = 1; t < this->threadCount; t++)
+            {
+                workers.emplace_back(&SweepPool::workerLoop, this, t);
+            }
+        }
+
+        ~SweepPool()
+        {
+            stopping = true;
+            barrier.wait();
+            for (thread& worker : workers) worker.join();
+        }
+
+        SweepPool(const SweepPool&) = delete;
+        SweepPool& operator=(const SweepPool&) = delete;
+
+        size_t size() const { return threadCount; }
+        size_t firstRow(size_t t) const { return rowBounds[t]; }
+        size_t lastRow(size_t t)  const { return rowBounds[t+1]; }
+        const vector<size_t>& partition() const { return rowBounds; }
+
+        // runs the task on every thread and returns once all of them are done
+        void run(const SweepTask& task)
+        {
+            currentTask = &task;
+            barrier.wait();                          // hand out the sweep...
+            task(0, rowBounds[0], rowBounds[1]);
+            barrier.wait();                          // ...and wait for all of it
+        }
+
+    private:
+        const size_t   threadCount;
+        vector<size_t> rowBounds;       // thread t owns rows [rowBounds[t], rowBounds[t+1])
+        vector<thread> workers;
+        SweepBarrier   barrier;
+
+        const SweepTask* currentTask{nullptr};
+        bool             stopping{false};   // published through the barrier
+
+        // Splits the rows so each thread gets about the same amount of work,
+        // counting one unit per nonzero plus one per row for its bookkeeping.
+        void partitionRows(const PriceEngine& engine)
+        {
+            const size_t productCount = engine.productCount();
+            const size_t totalWork    = engine.nonzeroCount() + productCount;
+
+            rowBounds.assign(threadCount + 1, productCount);
+            rowBounds[0] = 0;
+            for (size_t t = 1; t < threadCount; t++)
+            {
+                size_t target = totalWork * t / threadCount;
+
+                // first row whose cumulative work reaches the target
+                size_t low = rowBounds[t-1], high = productCount;
+                while (low < high)
+                {
+                    size_t mid = (low + high) / 2;
+                    if (engine.rowStart[mid] + mid < target) low = mid + 1;
+                    else                                     high = mid;
+                }
+                rowBounds[t] = low;
+            }
+        }
+
+        void workerLoop(size_t t)
+        {
+            while (true)
+            {
+                barrier.wait();
+                if (stopping) return;
+                (*currentTask)(t, rowBounds[t], rowBounds[t+1]);
+                barrier.wait();
+            }
+        }
+};
+
+
+
+
+/*///////////////////////
+     SWEEP FUNCTIONS
+///////////////////////*/
+
+
+// per-thread price change of a sweep, padded to its own cache line so the
+// threads don't share one
+struct alignas(64) ThreadChange
+{
+    SweepChange value;
+};
+
+
+// the threads' changes combined into the whole sweep's
+SweepChange mergeChanges(const vector<ThreadChange>& changes)
+{
+    SweepChange total;
+    for (const ThreadChange& change : changes) total.merge(change.value);
+    return total;
+}
+
+
+// runs one Jacobi sweep, each pool thread computing the prices of its own rows
+// (sell is built with the pool's row ranges as its segments) and measuring
+// how far they moved. Returns the change of the whole sweep.
+SweepChange parallelSweep(SweepPool&            pool,
+                          const PriceEngine&    engine,
+                          const SellMatrix&     sell,
+                          const vector<double>& prevIterPrices,
+                          vector<double>&       prices)
+{
+    vector<ThreadChange> changes(pool.size());
+
+    pool.run([&](size_t t, size_t, size_t)
+    {
+        changes[t].value = kernelSweep(engine, sell, prevIterPrices, prices, t);
+    });
+
+    return mergeChanges(changes);
+}
@@ -0,0 +1,240 @@
+// header file for generating synthetic input-output tables.
+//
+// Replaces iotable_generator.py for anything large: the tables are streamed
+// straight to disk, so their size is limited by the disk rather than memory,
+// and the same seed always gives the same file (the random numbers come from
+// mt19937_64, whose sequence the standard fixes, and are turned into draws
+// here rather than by the library's distributions, which it doesn't).
+//
+// Beyond size and density, a table can be given the shape real ones have:
+//
+//   - a power-law in-degree: the k-th most popular product of a sector is
+//     used as an input about k^-alpha as often as the most popular one, so a
+//     few products (energy, transport...) go into almost everything;
+//   - sectors: products are split into sectors that mostly buy from
+//     themselves, with a fraction of inputs drawn from the whole table;
+//   - a chosen spectral radius: every product's output is set so that its
+//     inputs' coefficients sum to the radius, which makes that the spectral
+//     radius of the coefficient matrix exactly, and so fixes how fast the
+//     sweeps converge (the error shrinks by about that factor each sweep).
+
+#pragma once
+#include "ioTableAnalysis.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <random>
+using namespace std;
+
+// generated UPCs are 12 digits, spread over the whole range
+const uint64_t UPC_BASE       = 100000000000;
+const uint64_t UPC_RANGE      = 900000000000;
+const uint64_t UPC_MULTIPLIER = 556230589841;     // prime, so i -> UPC is one-to-one
+
+class GeneratorOptions
+{
+    public:
+        uint64_t products{1000};
+        double   inputsPerProduct{10};  // on average; each product has at least one
+        uint64_t seed{1};
+        double   powerLaw{1.0};         // alpha; 0 draws inputs uniformly
+        uint64_t sectors{1};
+        double   withinSector{0.8};     // fraction of inputs bought from the product's own sector
+        double   spectralRadius{0.9};
+};
+
+
+/*///////////////////////
+     DRAW FUNCTIONS
+///////////////////////*/
+
+
+// uniform in [0, 1), from the top 53 bits
+double uniformDraw(mt19937_64& rng)
+{
+    return (rng() >> 11) * 0x1.0p-53;
+}
+
+
+// uniform integer in [low, high]
+uint64_t integerDraw(mt19937_64& rng, uint64_t low, uint64_t high)
+{
+    return low + (uint64_t) (uniformDraw(rng) * (high - low + 1));
+}
+
+
+// UPC of the i-th generated product; the seed shifts the whole set
+uint64_t generatedUpc(uint64_t i, uint64_t seed)
+{
+    unsigned __int128 scrambled = (unsigned __int128) i * UPC_MULTIPLIER + seed * 7919;
+    return UPC_BASE + (uint64_t) (scrambled % UPC_RANGE);
+}
+
+
+// first product of sector s (sectors are contiguous runs of products)
+uint64_t sectorStart(const GeneratorOptions& options, uint64_t s)
+{
+    return (uint64_t) ((unsigned __int128) s * options.products / options.sectors);
+}
+
+
+uint64_t sectorOf(const GeneratorOptions& options, uint64_t i)
+{
+    return (uint64_t) (((unsigned __int128) (i + 1) * options.sectors - 1) / options.products);
+}
+
+
+// Popularity of each product as an input, as running totals: the k-th
+// product of a sector weighs k^-alpha, so a draw can pick from one sector
+// or from the whole table with a single binary search.
+void buildPopularity(const GeneratorOptions& options, vector<double>& cumulative)
+{
+    cumulative.assign(options.products + 1, 0.0);
+    for (uint64_t s = 0; s < options.sectors; s++)
+    {
+        uint64_t first = sectorStart(options, s), last = sectorStart(options, s + 1);
+        for (uint64_t i = first; i < last; i++)
+        {
+            cumulative[i+1] = cumulative[i] + pow((double) (i - first + 1), -options.powerLaw);
+        }
+    }
+}
+
+
+// a product in [first, last), drawn by popularity
+uint64_t popularDraw(mt19937_64& rng, const vector<double>& cumulative, uint64_t first, uint64_t last)
+{
+    double target = cumulative[first] + uniformDraw(rng) * (cumulative[last] - cumulative[first]);
+    auto   found  = upper_bound(cumulative.begin() + first + 1, cumulative.begin() + last + 1, target);
+    return min<uint64_t>(found - cumulative.begin() - 1, last - 1);
+}
+
+
+
+
+/*///////////////////////
+     OUTPUT FUNCTIONS
+///////////////////////*/
+
+
+// Writes the table to the stream, one product at a time: its labor line,
+// its input lines, then its output line. Returns the number of input lines.
+uint64_t generateIOTable(const GeneratorOptions& options, FILE* out)
+{
+    const size_t FLUSH_BYTES = 1 << 20;
+
+    mt19937_64 rng(options.seed);
+    vector<double> cumulative;
+    buildPopularity(options, cumulative);
+
+    // inputs of the current product, and which products they are
+    vector<uint64_t> inputs;
+    vector<bool>     used(options.products, false);
+    uint64_t         inputLines{0};
+
+    string buffer;
+    buffer.reserve(FLUSH_BYTES + 256);
+    char number[32];
+    auto append = [&](auto value)
+    {
+        buffer.append(number, to_chars(number, number + sizeof(number), value).ptr);
+    };
+    auto appendLine = [&](uint64_t product, uint64_t input, auto quantity)
+    {
+        append(product);
+        buffer += ',';
+        append(input);
+        buffer += ' ';
+        append(quantity);
+        buffer += '\n';
+    };
+
+    for (uint64_t i = 0; i < options.products; i++)
+    {
+        const uint64_t upc         = generatedUpc(i, options.seed);
+        const uint64_t sector      = sectorOf(options, i);
+        const uint64_t sectorFirst = sectorStart(options, sector);
+        const uint64_t sectorLast  = sectorStart(options, sector + 1);
+
+        // at least one input, about inputsPerProduct on average, and never
+        // more than there are products; repeats are drawn again (a few times)
+        double   spread = max(0.0, 2 * options.inputsPerProduct - 1);
+        uint64_t degree = min<uint64_t>(1 + (uint64_t) (uniformDraw(rng) * spread), options.products);
+
+        inputs.clear();
+        for (uint64_t attempt = 0; inputs.size() < degree && attempt < 8 * degree; attempt++)
+        {
+            uint64_t input = options.sectors > 1 && uniformDraw(rng) < options.withinSector
+                           ? popularDraw(rng, cumulative, sectorFirst, sectorLast)
+                           : popularDraw(rng, cumulative, 0, options.products);
+            if (used[input]) continue;
+            used[input] = true;
+            inputs.push_back(input);
+        }
+
+        appendLine(upc, 0, integerDraw(rng, 100, 10000));
+
+        uint64_t totalQuantity{0};
+        for (uint64_t input : inputs)
+        {
+            uint64_t quantity = integerDraw(rng, 10, 10000);
+            totalQuantity += quantity;
+            appendLine(upc, generatedUpc(input, options.seed), quantity);
+            used[input] = false;
+        }
+        inputLines += inputs.size();
+
+        // the coefficients of this row sum to the spectral radius
+        appendLine(upc, 1, totalQuantity / options.spectralRadius);
+
+        if (buffer.size() >= FLUSH_BYTES)
+        {
+            if (fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) throw bad_file();
+            buffer.clear();
+        }
+    }
+
+    if (fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) throw bad_file();
+    return inputLines;
+}
+
+
+// generateIOTable into a file
+uint64_t generateIOTable(const GeneratorOptions& options, const char* outputFile)
+{
+    FILE* out = fopen(outputFile, "wb");
+    if (!out) throw bad_file();
+
+    uint64_t inputLines;
+    try
+    {
+        inputLines = generateIOTable(options, out);
+    }
+    catch (...)
+    {
+        fclose(out);
+        throw;
+    }
+    if (fclose(out) != 0) throw bad_file();
+    return inputLines;
+}
+
+
+// rejects options no table can be generated from
+void checkGeneratorOptions(const GeneratorOptions& options)
+{
+    if (options.products == 0)                                  throw bad_option("-n must be at least 1.");
+    if (options.products > UPC_RANGE)                           throw bad_option("-n is larger than there are 12-digit UPCs.");
+    if (options.products > UINT32_MAX)                          throw bad_option("-n is larger than an engine can index.");
+    if (options.inputsPerProduct <= 0)                          throw bad_option("--inputs must be positive.");
+    if (options.powerLaw < 0)                                   throw bad_option("--alpha can't be negative.");
+    if (options.sectors == 0 || options.sectors > options.products)
+    {
+        throw bad_option("--sectors must be between 1 and the number of products.");
+    }
+    if (options.withinSector < 0 || options.withinSector > 1)   throw bad_option("--intra must be between 0 and 1.");
+    if (options.spectralRadius <= 0 || options.spectralRadius >= 1)
+    {
+        throw bad_option("--radius must be between 0 and 1 (exclusive), or the prices diverge.");
+    }
+}
@@ -0,0 +1,282 @@
+// header file for incremental "what-if" repricing.
+//
+// Given prices already solved for a table, and a small delta file in the
+// same "UPC,UPC qty" format, the delta is applied to the engine in memory
+// and only the products downstream of the changed entries (the ones that
+// use a changed product, directly or through other products) are
+// re-iterated, starting from the old prices. Everything upstream or off to
+// the side keeps its price, since none of its inputs moved.
+
+#pragma once
+#include "priceEngine.hpp"
+#include "sccSolver.hpp"
+using namespace std;
+
+
+/*///////////////////////
+     DELTA FUNCTIONS
+///////////////////////*/
+
+
+// position of a resource code in engine.resourceCodes, or resourceCount() if the table has none of it
+size_t findResource(const PriceEngine& engine, long int code)
+{
+    auto found = lower_bound(engine.resourceCodes.begin(), engine.resourceCodes.end(), code);
+    if (found == engine.resourceCodes.end() || *found != code) return engine.resourceCount();
+    return found - engine.resourceCodes.begin();
+}
+
+
+// position of input within row, or engine.rowStart[row+1] if it isn't there
+uint64_t findInput(const PriceEngine& engine, size_t row, uint32_t input)
+{
+    const uint32_t* first = engine.inputIndex.data() + engine.rowStart[row];
+    const uint32_t* last  = engine.inputIndex.data() + engine.rowStart[row+1];
+    const uint32_t* found = lower_bound(first, last, input);
+    if (found == last || *found != input) return engine.rowStart[row+1];
+    return found - engine.inputIndex.data();
+}
+
+
+// Applies the delta entries (new absolute quantities, later ones winning)
+// to the engine and returns the rows that changed, as indices into the
+// updated engine. Labor, output, resources and existing inputs are edited
+// in place; a delta that adds a new input, resource or product rebuilds the
+// engine instead.
+vector<uint32_t> applyTableDelta(PriceEngine& engine, const vector<TableEntry>& delta)
+{
+    vector<uint32_t> changedRows;
+
+    // anything the existing rows have no slot for means rebuilding
+    bool structural{false};
+    for (const TableEntry& entry : delta)
+    {
+        size_t row = engine.indexOf(entry.product);
+        if (row == engine.productCount()) { structural = true; break; }
+        if (entry.input == 0 || entry.input == 1) continue;
+        if (isResourceCode(entry.input))
+        {
+            if (findResource(engine, entry.input) == engine.resourceCount()) { structural = true; break; }
+            continue;
+        }
+
+        size_t input = engine.indexOf(entry.input);
+        if (input == engine.productCount()) { structural = true; break; }
+        if (findInput(engine, row, input) == engine.rowStart[row+1] && entry.quantity != 0)
+        {
+            structural = true;
+            break;
+        }
+    }
+
+    if (structural)
+    {
+        cout << "Delta adds new inputs or products; rebuilding the engine" << endl;
+        vector<TableEntry> entries;
+        engineToEntries(engine, entries);
+        entries.insert(entries.end(), delta.begin(), delta.end());
+
+        PriceEngine rebuilt;
+        buildPriceEngine(entries, rebuilt);
+        engine = move(rebuilt);
+
+        for (const TableEntry& entry : delta) changedRows.push_back(engine.indexOf(entry.product));
+    }
+    else
+    {
+        // new output quantities first, since everything else in the row is divided by them
+        for (const TableEntry& entry : delta)
+        {
+            if (entry.input != 1) continue;
+
+            size_t row = engine.indexOf(entry.product);
+            if (entry.quantity == 0)
+            {
+                throw malformed_table("Delta sets the output of product " + to_string(entry.product) + " to 0.");
+            }
+
+            double rescale = engine.output[row] / entry.quantity;
+            for (uint64_t k = engine.rowStart[row]; k < engine.rowStart[row+1]; k++) engine.coeffs[k] *= rescale;
+            engine.laborOnly[row] *= rescale;
+            for (size_t j = 0; j < engine.resourceCount(); j++) engine.resourceOnly[row * engine.resourceCount() + j] *= rescale;
+            engine.output[row]     = entry.quantity;
+            changedRows.push_back(row);
+        }
+
+        for (const TableEntry& entry : delta)
+        {
+            if (entry.input == 1) continue;
+
+            size_t row = engine.indexOf(entry.product);
+            if (entry.input == 0)
+            {
+                engine.laborOnly[row] = entry.quantity / engine.output[row];
+            }
+            else if (isResourceCode(entry.input))
+            {
+                size_t j = findResource(engine, entry.input);
+                engine.resourceOnly[row * engine.resourceCount() + j] = entry.quantity / engine.output[row];
+            }
+            else
+            {
+                // a zero for an input the row doesn't have is nothing to do
+                uint64_t position = findInput(engine, row, engine.indexOf(entry.input));
+                if (position == engine.rowStart[row+1]) continue;
+                engine.coeffs[position] = entry.quantity / engine.output[row];
+            }
+            changedRows.push_back(row);
+        }
+    }
+
+    sort(changedRows.begin(), changedRows.end());
+    changedRows.erase(unique(changedRows.begin(), changedRows.end()), changedRows.end());
+    return changedRows;
+}
+
+
+// every row reachable downstream of the seed rows, seeds included,
+// in breadth-first order (so, roughly, inputs before their users)
+vector<uint32_t> downstreamRows(const ConsumerIndex&    consumers,
+                                const vector<uint32_t>& seedRows,
+                                size_t                  productCount)
+{
+    vector<bool>     reached(productCount, false);
+    vector<uint32_t> affected;
+
+    for (uint32_t row : seedRows)
+    {
+        if (reached[row]) continue;
+        reached[row] = true;
+        affected.push_back(row);
+    }
+
+    for (size_t next = 0; next < affected.size(); next++)
+    {
+        uint32_t row = affected[next];
+        for (uint64_t k = consumers.consumerStart[row]; k < consumers.consumerStart[row+1]; k++)
+        {
+            uint32_t consumer = consumers.consumers[k];
+            if (reached[consumer]) continue;
+            reached[consumer] = true;
+            affected.push_back(consumer);
+        }
+    }
+    return affected;
+}
+
+
+// Re-iterates only the given rows, starting from the prices already in
+// prices, until the tolerances are met or -i sweeps are done. Returns the
+// sweeps used.
+int repriceRows(const PriceEngine&      engine,
+                const vector<uint32_t>& rows,
+                vector<double>&         prices,
+                const RunOptions&       options)
+{
+    // own coefficients are only needed for the rows being swept
+    vector<double> selfCoeffs(engine.productCount(), 0.0);
+    for (uint32_t r : rows)
+    {
+        uint64_t position = findInput(engine, r, r);
+        if (position != engine.rowStart[r+1]) selfCoeffs[r] = engine.coeffs[position];
+        if (selfCoeffs[r] >= 1)
+        {
+            throw malformed_table("Product " + to_string(engine.upcs[r])
+                                  + " uses at least as much of itself as it produces.");
+        }
+    }
+
+    vector<double> scratch;
+    int sweeps{0};
+    while (!rows.empty())
+    {
+        SweepChange change = componentSweep(engine, selfCoeffs, prices, rows.data(), rows.size(), options, scratch);
+        sweeps++;
+
+        if (toleranceMet(change, options))                      break;
+        if (options.iterations && sweeps >= options.iterations) break;
+    }
+    return sweeps;
+}
+
+
+// what applying one delta did
+class WhatIfResult
+{
+    public:
+        size_t deltaEntries{0};
+        size_t changedProducts{0};
+        size_t repricedProducts{0};
+        int    sweeps{0};
+};
+
+
+// Applies the delta to the engine and reprices everything downstream of it.
+// prices holds solved prices for the engine as it was, and on return for
+// the engine as it is (a delta that adds products renumbers them). consumers
+// must be the engine's consumer index, or empty; it is rebuilt when needed.
+WhatIfResult applyWhatIf(PriceEngine&              engine,
+                         const vector<TableEntry>& delta,
+                         vector<double>&           prices,
+                         ConsumerIndex&            consumers,
+                         const RunOptions&         options)
+{
+    // the prices by UPC, in case the delta rebuilds the engine
+    const long int* oldUpcsData = engine.upcs.data();
+    vector<long int> oldUpcs(engine.upcs.begin(), engine.upcs.end());
+
+    WhatIfResult result;
+    result.deltaEntries = delta.size();
+    vector<uint32_t> changedRows = applyTableDelta(engine, delta);
+    result.changedProducts = changedRows.size();
+
+    if (engine.upcs.data() != oldUpcsData)
+    {
+        // both UPC lists are sorted, so one merge carries the prices over
+        vector<double> oldPrices;
+        oldPrices.swap(prices);
+        prices.assign(engine.laborOnly.begin(), engine.laborOnly.end());
+        size_t old{0};
+        for (size_t r = 0; r < engine.productCount(); r++)
+        {
+            while (old < oldUpcs.size() && oldUpcs[old] < engine.upcs[r]) old++;
+            if (old < oldUpcs.size() && oldUpcs[old] == engine.upcs[r]) prices[r] = oldPrices[old];
+        }
+        consumers = ConsumerIndex();
+    }
+    if (consumers.consumerStart.empty()) buildConsumerIndex(engine, consumers);
+
+    vector<uint32_t> affected = downstreamRows(consumers, changedRows, engine.productCount());
+    result.repricedProducts = affected.size();
+    result.sweeps = repriceRows(engine, affected, prices, options);
+    return result;
+}
+
+
+// The whole what-if: load the base prices and the delta, apply it, and
+// reprice everything downstream of it
+void calcPricesWhatIf(PriceEngine& engine,
+                      vector<double>& prices,
+                      const RunOptions& options)
+{
+    unordered_map<long int, double> basePrices;
+    loadPricesFromFile(options.basePricesFile, basePrices);
+
+    vector<TableEntry> delta;
+    loadIOTable(options.whatIfFile, delta);
+
+    auto start = chrono::high_resolution_clock::now();
+    size_t found = densePricesFromMap(engine, basePrices, prices);
+    if (found < engine.productCount())
+    {
+        cout << engine.productCount() - found << " products had no base price; starting them from labor only" << endl;
+    }
+
+    ConsumerIndex consumers;
+    WhatIfResult  result = applyWhatIf(engine, delta, prices, consumers, options);
+
+    auto stop = chrono::high_resolution_clock::now();
+    cout << "\nWhat-if: " << result.deltaEntries << " delta entries changed " << result.changedProducts << " products; "
+         << result.repricedProducts << " of " << engine.productCount() << " products repriced in "
+         << result.sweeps << " sweeps (" << chrono::duration<double, milli>(stop - start).count() << " ms)" << endl;
+}